@@ -10,6 +10,15 @@
 class automation : public unit {
 public:
     virtual void sync(time_point current_time) {}
+
+    ////////////////////////////////////////////////////////////////////////////
+    // The next time at which sync() might act even if no device changes state,
+    // or time_point::max() if it only reacts to state changes (which arrive
+    // through listeners). Called after sync() with the same current_time.
+    ////////////////////////////////////////////////////////////////////////////
+    virtual time_point next_deadline(time_point) {
+        return time_point::max();
+    }
 };
 
 #endif
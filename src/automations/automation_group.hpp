@@ -24,6 +24,14 @@ protected:
             automations[i]->sync(current_time);
     }
 
+    time_point next_deadline(time_point current_time) {
+        std::unique_lock<std::mutex> lck(mtx);
+        time_point earliest = time_point::max();
+        for (size_t i = 0; i < automations.size(); i++)
+            earliest = std::min(earliest, automations[i]->next_deadline(current_time));
+        return earliest;
+    }
+
 public:
     ////////////////////////////////////////////////////////////////////////////
     //
@@ -15,10 +15,17 @@ private:
     ////////////////////////////////////////////////////////////////////////////
     std::mutex mtx;
     std::vector<automation*> automations;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Automations are evaluated at their next deadline and whenever a listened
+    // module changes. This periodic pass only catches anything else, such as
+    // a sun time which moved or a clock change.
+    ////////////////////////////////////////////////////////////////////////////
+    static inline const int FALLBACK_PERIOD = 15*60;
 protected:
 
     ////////////////////////////////////////////////////////////////////////////////
-    //
+    // Evaluate every automation, then sleep until the earliest deadline.
     ////////////////////////////////////////////////////////////////////////////////
     void sync(bool last) {
         if (last) return;
@@ -26,12 +33,19 @@ protected:
         time_point current_time = now_floor();
         for (int i = 0; i < automations.size(); i++)
             automations[i]->sync(current_time);
+        time_point earliest = time_point::max();
+        for (size_t i = 0; i < automations.size(); i++) {
+            time_point deadline = automations[i]->next_deadline(current_time);
+            if (deadline > current_time && deadline < earliest)
+                earliest = deadline;
+        }
+        if (earliest != time_point::max()) set_sync_time(earliest);
     }
 public:
     ////////////////////////////////////////////////////////////////////////////////
     //
     ////////////////////////////////////////////////////////////////////////////////
-    automation_module() : module(true, 60) {
+    automation_module() : module(true, FALLBACK_PERIOD) {
         char name[64];
         snprintf(name, 64, "automation_module");
         set_name(name);
@@ -68,6 +68,24 @@ protected:
         }
     }
 
+    ////////////////////////////////////////////////////////////////////////////
+    // Each plug's delay window closes 'delay' minutes after the relevant
+    // last_time_on/off. While a plug stays in that state its window stays
+    // open, and leaving the state notifies listeners.
+    ////////////////////////////////////////////////////////////////////////////
+    time_point next_deadline(time_point current_time) {
+        std::unique_lock<std::mutex> lck(mtx);
+        time_point earliest = automation_obj->next_deadline(current_time);
+        bool on = (target == kasa::ON) == (combination == OR);
+        for (size_t i = 0; i < kasa_plugs.size(); i++) {
+            time_point t = on ? kasa_plugs[i]->get_last_time_on() :
+                                kasa_plugs[i]->get_last_time_off();
+            time_point closes = t + duration(60 * delay + 1);
+            if (closes > current_time && closes < earliest) earliest = closes;
+        }
+        return earliest;
+    }
+
 public:
     ////////////////////////////////////////////////////////////////////////////
     //
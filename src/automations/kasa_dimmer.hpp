@@ -28,6 +28,7 @@ public:
 
         lt.tm_hour = start_time_hour;
         lt.tm_min  = start_time_minute;
+        lt.tm_sec  = 0;
 
         tt = mktime(&lt);
         time_point start_time = std::chrono::floor<duration>(sc::from_time_t(tt));
@@ -35,6 +36,24 @@ public:
         plug->set_brightness_target(start_brightness, end_brightness, start_time, start_time + duration(duration_seconds));
     }
 
+    ////////////////////////////////////////////////////////////////////////////
+    // The fade is interpolated by the kasa module, so only the start of the
+    // next day's fade matters.
+    ////////////////////////////////////////////////////////////////////////////
+    time_point next_deadline(time_point current_time) {
+        std::time_t tt = sc::to_time_t(current_time);
+        std::tm lt;
+        localtime_r(&tt, &lt);
+        lt.tm_hour = start_time_hour;
+        lt.tm_min  = start_time_minute;
+        lt.tm_sec  = 0;
+        time_point start_time = std::chrono::floor<duration>(sc::from_time_t(mktime(&lt)));
+        if (start_time > current_time) return start_time;
+        lt.tm_mday++;
+        lt.tm_isdst = -1;
+        return std::chrono::floor<duration>(sc::from_time_t(mktime(&lt)));
+    }
+
     ////////////////////////////////////////////////////////////////////////////
     //
     ////////////////////////////////////////////////////////////////////////////
@@ -39,6 +39,19 @@ public:
             plug->set_target(target);
     }
 
+    ////////////////////////////////////////////////////////////////////////////
+    // The timer runs while the device is not in the target state. Once it has
+    // expired, only a state change can make it act again.
+    ////////////////////////////////////////////////////////////////////////////
+    time_point next_deadline(time_point current_time) {
+        int res = plug->get_status();
+        if (res != kasa::ON && res != kasa::OFF) return time_point::max();
+        if (res == target) return time_point::max();
+        time_point expiry = (target == kasa::ON) ?
+            plug->get_last_time_on() + dur : plug->get_last_time_off() + dur;
+        return (expiry > current_time) ? expiry : time_point::max();
+    }
+
     ////////////////////////////////////////////////////////////////////////////
     //
     ////////////////////////////////////////////////////////////////////////////
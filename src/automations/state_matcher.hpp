@@ -75,6 +75,15 @@ protected:
         }
     }
 
+    ////////////////////////////////////////////////////////////////////////////
+    // Changes are ignored until block_time has passed.
+    ////////////////////////////////////////////////////////////////////////////
+    time_point next_deadline(time_point current_time) {
+        std::unique_lock<std::mutex> lck(mtx);
+        if (block_time + duration(1) > current_time) return block_time + duration(1);
+        return time_point::max();
+    }
+
 public:
     ////////////////////////////////////////////////////////////////////////////
     // Once enabled, this object will apply the following rules:
@@ -24,6 +24,22 @@ public:
         sync(current_time, kt);
     }
 
+    ////////////////////////////////////////////////////////////////////////////
+    // The key time, or the same time tomorrow once it has passed. Tomorrow's
+    // snapped time is not known yet; the snap source notifies when it is.
+    ////////////////////////////////////////////////////////////////////////////
+    time_point next_deadline(time_point current_time) {
+        std::unique_lock<std::mutex> lck(mtx);
+        if (key_time > current_time) return key_time;
+        std::time_t tt = sc::to_time_t(key_time);
+        std::tm lt;
+        localtime_r(&tt, &lt);
+        lt.tm_mday++;
+        lt.tm_isdst = -1;
+        tt = mktime(&lt);
+        return std::chrono::floor<duration>(sc::from_time_t(tt));
+    }
+
     void set_time(int hour = 0, int minute = 0) {
         std::unique_lock<std::mutex> lck(mtx);
 
@@ -34,6 +50,7 @@ public:
 
         lt.tm_hour = hour;
         lt.tm_min = minute;
+        lt.tm_sec = 0;
 
         tt = mktime(&lt);
         key_time = std::chrono::floor<duration>(sc::from_time_t(tt));
@@ -48,6 +48,15 @@ protected:
         set_time(hour, minute);
     }
 
+    ////////////////////////////////////////////////////////////////////////////
+    // Either side of the key time may change the outcome, as may the wrapped
+    // automation.
+    ////////////////////////////////////////////////////////////////////////////
+    time_point next_deadline(time_point current_time) {
+        return std::min(time_automation::next_deadline(current_time),
+            automation_obj->next_deadline(current_time));
+    }
+
 public:
     ////////////////////////////////////////////////////////////////////////////
     //
@@ -0,0 +1,224 @@
+
+#include "../modules/module.hpp"
+#include <stdio.h>
+#include <cstring>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Counts context switches caused by automations polling heart_beat_missed() on
+// the modules they touch. Three implementations are compared, each in a
+// forked child:
+//   thread - a copy of the original, where every module owned a thread and
+//            each call woke that thread just to clear the request flag
+//   mutex  - a copy of the scheduler version, which locked the module mutex
+//            and notified waiters on every call
+//   atomic - module::heart_beat_missed(), which reads an atomic timestamp
+////////////////////////////////////////////////////////////////////////////////
+using sc = std::chrono::system_clock;
+using hc = std::chrono::steady_clock;
+using duration = std::chrono::seconds;
+using time_point = std::chrono::time_point<sc, duration>;
+
+time_point now_floor() {
+    return std::chrono::floor<duration>(sc::now());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// A stripped down copy of the original thread-per-module heart beat.
+////////////////////////////////////////////////////////////////////////////////
+class thread_module {
+private:
+    std::mutex mtx;
+    std::condition_variable cv_mt, cv_wt;
+    bool done = false, heart_beat_requested = false;
+    time_point heart_beat_request_time;
+    std::thread thread;
+
+    static void management_thread(thread_module* m) {
+        std::unique_lock<std::mutex> lck(m->mtx);
+        while (!m->done) {
+            m->cv_mt.wait_until(lck, sc::now() + duration(60));
+            m->heart_beat_requested = false;
+            m->cv_wt.notify_all();
+        }
+    }
+
+public:
+    void enable() { thread = std::thread(&management_thread, this); }
+    void disable() {
+        std::unique_lock<std::mutex> lck(mtx);
+        done = true;
+        cv_mt.notify_all();
+        lck.unlock();
+        thread.join();
+    }
+
+    duration heart_beat_missed() {
+        std::unique_lock<std::mutex> lck(mtx);
+        duration res = duration(0);
+        if (!heart_beat_requested) {
+            heart_beat_request_time = now_floor();
+        } else {
+            time_point nf = now_floor();
+            if (nf > heart_beat_request_time + duration(1))
+                res = nf - heart_beat_request_time - duration(1);
+        }
+        heart_beat_requested = true;
+        cv_mt.notify_all();
+        return res;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// A copy of the mutex based heart beat used with the shared scheduler.
+////////////////////////////////////////////////////////////////////////////////
+class mutex_module {
+private:
+    std::mutex mtx;
+    std::condition_variable cv_wt;
+    bool running = false, heart_beat_requested = false;
+    time_point heart_beat_request_time;
+
+public:
+    void enable() {}
+    void disable() {}
+
+    duration heart_beat_missed() {
+        std::unique_lock<std::mutex> lck(mtx);
+        duration res = duration(0);
+        if (!heart_beat_requested) {
+            heart_beat_request_time = now_floor();
+        } else {
+            time_point nf = now_floor();
+            if (nf > heart_beat_request_time + duration(1))
+                res = nf - heart_beat_request_time - duration(1);
+        }
+        heart_beat_requested = true;
+        if (!running) {
+            heart_beat_requested = false;
+            cv_wt.notify_all();
+        }
+        return res;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// A module which does nothing. Syncs once a minute, like automation_module.
+////////////////////////////////////////////////////////////////////////////////
+class atomic_module : public module {
+public:
+    atomic_module() : module(true, 60) {}
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// 'pollers' threads each sweep every module, then sleep for 'interval_us'.
+////////////////////////////////////////////////////////////////////////////////
+template <typename M>
+void run(const char* mode, int count, int pollers, int interval_us, int seconds) {
+    std::vector<M*> modules;
+    for (int i = 0; i < count; i++) {
+        modules.push_back(new M());
+        modules.back()->enable();
+    }
+    usleep(200000);
+
+    std::atomic<bool> stop{false};
+    std::atomic<long> calls{0};
+    struct rusage ru_start, ru_end;
+    getrusage(RUSAGE_SELF, &ru_start);
+    hc::time_point start = hc::now();
+    std::vector<std::thread> threads;
+    for (int p = 0; p < pollers; p++) {
+        threads.push_back(std::thread([&]() {
+            long n = 0;
+            while (!stop) {
+                for (M* m : modules) m->heart_beat_missed();
+                n += modules.size();
+                usleep(interval_us);
+            }
+            calls += n;
+        }));
+    }
+    sleep(seconds);
+    stop = true;
+    for (std::thread& t : threads) t.join();
+    double elapsed = std::chrono::duration<double>(hc::now() - start).count();
+    getrusage(RUSAGE_SELF, &ru_end);
+
+    long vol = ru_end.ru_nvcsw - ru_start.ru_nvcsw;
+    long invol = ru_end.ru_nivcsw - ru_start.ru_nivcsw;
+    double cpu = (ru_end.ru_utime.tv_sec - ru_start.ru_utime.tv_sec) +
+        (ru_end.ru_stime.tv_sec - ru_start.ru_stime.tv_sec) +
+        ((ru_end.ru_utime.tv_usec - ru_start.ru_utime.tv_usec) +
+         (ru_end.ru_stime.tv_usec - ru_start.ru_stime.tv_usec)) / 1e6;
+    printf("%-6s modules=%-5d calls/s=%-10.0f csw vol=%-8ld invol=%-8ld "
+        "per_1k_calls=%-8.2f cpu_pct=%.1f\n", mode, count, calls / elapsed, vol,
+        invol, 1000.0 * (vol + invol) / std::max(1L, calls.load()),
+        100 * cpu / elapsed);
+    fflush(stdout);
+
+    for (M* m : modules) m->disable();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char *argv[]) {
+    int count = 30, pollers = 4, interval_us = 10000, seconds = 5;
+    char mode[64];
+    strncpy(mode, "all", 64);
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && (argc > i + 1)) {
+            count = atoi(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-p") && (argc > i + 1)) {
+            pollers = atoi(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-i") && (argc > i + 1)) {
+            interval_us = atoi(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-t") && (argc > i + 1)) {
+            seconds = atoi(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-m") && (argc > i + 1)) {
+            strncpy(mode, argv[i+1], 64);
+            i++;
+        }
+        else {
+            printf("./bin/heart_beat_bench counts context switches caused by heart_beat_missed().\n");
+            printf("\n");
+            printf("Options are:\n");
+            printf("\n");
+            printf("  -n <number> : number of modules (default 30).\n");
+            printf("  -p <number> : polling threads, like automations (default 4).\n");
+            printf("  -i <number> : microseconds between sweeps of a poller (default 10000).\n");
+            printf("  -t <number> : seconds to run each mode (default 5).\n");
+            printf("  -m <mode>   : 'thread', 'mutex', 'atomic' or 'all' (default).\n");
+            printf("\n");
+            return 1;
+        }
+    }
+
+    module::set_verbosity(0);
+
+    const char* modes[] = {"thread", "mutex", "atomic"};
+    for (int i = 0; i < 3; i++) {
+        if (strcmp(mode, "all") && strcmp(mode, modes[i])) continue;
+        pid_t pid = fork();
+        if (pid == 0) {
+            if (i == 0) run<thread_module>(modes[i], count, pollers, interval_us, seconds);
+            if (i == 1) run<mutex_module>(modes[i], count, pollers, interval_us, seconds);
+            if (i == 2) run<atomic_module>(modes[i], count, pollers, interval_us, seconds);
+            _exit(0);
+        }
+        waitpid(pid, nullptr, 0);
+    }
+
+    return 0;
+}
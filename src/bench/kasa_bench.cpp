@@ -0,0 +1,437 @@
+
+#include "../modules/kasa.hpp"
+#include <stdio.h>
+#include <cstring>
+#include <csignal>
+#include <algorithm>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Measures kasa sync throughput and set_target() latency against bin/kasa_sim.
+// For each fleet size, a simulator is started with that many devices and the
+// bench runs itself again (-P) to drive the same number of kasa modules, so
+// that CPU time and RSS are measured per size.
+//
+// Each device is toggled roughly once per period. Latency runs from
+// set_target() to the first device query which reports the new relay state.
+// It is split into the queue time until the relay-set request went out and
+// the wire time of that request, as recorded by the kasa module. Syncs are
+// counted when their query got a reply.
+// Results are printed to stdout as JSON; progress goes to stderr.
+////////////////////////////////////////////////////////////////////////////////
+using hc = std::chrono::steady_clock;
+
+static const std::chrono::seconds CONFIRM_TIMEOUT(10);
+
+char base_addr[64], log_file[256];
+int seconds = 10, workers = 16;
+double period = 2, rate = 200, subnet_rate = 50;
+
+////////////////////////////////////////////////////////////////////////////////
+// Shared by the driver thread and queried() on the loop thread.
+////////////////////////////////////////////////////////////////////////////////
+std::mutex lat_mtx;
+std::vector<double> lats, queue_lats, wire_lats;
+std::atomic<long> syncs{0};
+bool measuring = false;
+
+////////////////////////////////////////////////////////////////////////////////
+// A kasa module which notes when a requested state is confirmed.
+////////////////////////////////////////////////////////////////////////////////
+class bench_kasa : public kasa {
+public:
+    int want = UNCHANGED;
+    hc::time_point asked, next;
+
+protected:
+    void queried() {
+        syncs++;
+        int status = get_status();
+        int queue_us, wire_us;
+        get_command_timing(&queue_us, &wire_us);
+        std::unique_lock<std::mutex> lck(lat_mtx);
+        if (want != UNCHANGED && status == want) {
+            hc::time_point now = hc::now();
+            if (measuring) {
+                lats.push_back(std::chrono::duration<double, std::milli>(
+                    now - asked).count());
+                queue_lats.push_back(queue_us / 1000.0);
+                wire_lats.push_back(wire_us / 1000.0);
+            }
+            want = UNCHANGED;
+            next = now + std::chrono::milliseconds(
+                (int)(period * (500 + rand() % 1000)));
+        }
+    }
+
+public:
+    bench_kasa(const char* name, const char* addr) :
+        kasa(name, addr, 1, 0, 15) {}
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+long proc_status(const char* key) {
+    char line[256];
+    long value = -1;
+    FILE* f = fopen("/proc/self/status", "r");
+    if (!f) return -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (!strncmp(line, key, strlen(key))) {
+            value = atol(line + strlen(key));
+            break;
+        }
+    }
+    fclose(f);
+    return value;
+}
+
+double cpu_seconds(const struct rusage& ru) {
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+        (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+double percentile(const std::vector<double>& v, int per_mille) {
+    if (v.empty()) return 0;
+    return v[std::min(v.size() - 1, (v.size() * per_mille) / 1000)];
+}
+
+void device_addr(int i, char* addr) {
+    struct in_addr a;
+    inet_pton(AF_INET, base_addr, &a);
+    a.s_addr = htonl(ntohl(a.s_addr) + i);
+    inet_ntop(AF_INET, &a, addr, 64);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// enable() and disable() block for a full sync, so large fleets are started
+// and stopped from several threads.
+////////////////////////////////////////////////////////////////////////////////
+void for_each_parallel(std::vector<bench_kasa*>& devices, void (*fn)(bench_kasa*)) {
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 64; t++) {
+        threads.push_back(std::thread([&]() {
+            for (size_t i = next++; i < devices.size(); i = next++)
+                fn(devices[i]);
+        }));
+    }
+    for (std::thread& t : threads) t.join();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// One fleet size, in its own process. Prints the JSON fields for this run.
+////////////////////////////////////////////////////////////////////////////////
+void run(int count) {
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+
+    unit::set_verbosity(0);
+    unit::set_log_file(log_file);
+    scheduler::set_worker_count(workers);
+    pacer::get().set_rate(rate, 20);
+    pacer::get().set_subnet_rate(subnet_rate, 10);
+
+    // Start up until every device has reported a state.
+    hc::time_point start = hc::now();
+    std::vector<bench_kasa*> devices;
+    for (int i = 0; i < count; i++) {
+        char name[64], addr[64];
+        snprintf(name, 64, "bench_%d", i);
+        device_addr(i, addr);
+        devices.push_back(new bench_kasa(name, addr));
+    }
+    for_each_parallel(devices, [](bench_kasa* d) { d->enable(); });
+
+    int known = 0;
+    while (true) {
+        known = 0;
+        for (bench_kasa* d : devices) {
+            int s = d->get_status();
+            if (s == kasa::ON || s == kasa::OFF) known++;
+        }
+        if (known == count || hc::now() - start > std::chrono::seconds(120))
+            break;
+        usleep(100000);
+    }
+    double startup = std::chrono::duration<double>(hc::now() - start).count();
+
+    // Measure.
+    struct rusage ru_start, ru_end;
+    getrusage(RUSAGE_SELF, &ru_start);
+    std::unique_lock<std::mutex> lck(lat_mtx);
+    start = hc::now();
+    for (bench_kasa* d : devices)
+        d->next = start + std::chrono::milliseconds(
+            (int)(period * (rand() % 1000)));
+    measuring = true;
+    syncs = 0;
+    lck.unlock();
+
+    long toggles = 0, timeouts = 0;
+    hc::time_point end = start + std::chrono::seconds(seconds);
+    std::vector<std::pair<bench_kasa*, int>> due;
+    while (hc::now() < end) {
+        hc::time_point now = hc::now();
+        due.clear();
+        lck.lock();
+        for (bench_kasa* d : devices) {
+            if (d->want != kasa::UNCHANGED) {
+                if (now - d->asked < CONFIRM_TIMEOUT) continue;
+                d->want = kasa::UNCHANGED;
+                timeouts++;
+            }
+            if (now < d->next) continue;
+            d->want = (d->get_status() == kasa::ON) ? kasa::OFF : kasa::ON;
+            d->asked = now;
+            due.push_back({d, d->want});
+        }
+        lck.unlock();
+        for (auto& d : due) d.first->set_target(d.second);
+        toggles += due.size();
+        usleep(1000);
+    }
+
+    lck.lock();
+    measuring = false;
+    double elapsed = std::chrono::duration<double>(hc::now() - start).count();
+    long sync_count = syncs;
+    std::vector<double> sorted = lats;
+    std::vector<double> queue_sorted = queue_lats, wire_sorted = wire_lats;
+    long pending = 0;
+    for (bench_kasa* d : devices) pending += (d->want != kasa::UNCHANGED);
+    lck.unlock();
+    getrusage(RUSAGE_SELF, &ru_end);
+    std::sort(sorted.begin(), sorted.end());
+    std::sort(queue_sorted.begin(), queue_sorted.end());
+    std::sort(wire_sorted.begin(), wire_sorted.end());
+    double cpu = cpu_seconds(ru_end) - cpu_seconds(ru_start);
+
+    printf("\"devices\":%d,\"ready\":%d,\"startup_s\":%.2f,\"seconds\":%.2f,"
+        "\"syncs\":%ld,\"syncs_per_sec\":%.1f,\"toggles\":%ld,"
+        "\"confirmed\":%zu,\"timeouts\":%ld,\"pending\":%ld,"
+        "\"latency_ms\":{\"p50\":%.2f,\"p99\":%.2f,\"p999\":%.2f,\"max\":%.2f},"
+        "\"queue_ms\":{\"p50\":%.2f,\"p99\":%.2f},"
+        "\"wire_ms\":{\"p50\":%.2f,\"p99\":%.2f},"
+        "\"cpu_s\":%.3f,\"cpu_pct\":%.1f,\"rss_kb\":%ld,\"threads\":%ld",
+        count, known, startup, elapsed, sync_count, sync_count / elapsed,
+        toggles, sorted.size(), timeouts, pending, percentile(sorted, 500),
+        percentile(sorted, 990), percentile(sorted, 999),
+        sorted.empty() ? 0 : sorted.back(), percentile(queue_sorted, 500),
+        percentile(queue_sorted, 990), percentile(wire_sorted, 500),
+        percentile(wire_sorted, 990), cpu, 100 * cpu / elapsed,
+        proc_status("VmRSS:"), proc_status("Threads:"));
+    fflush(stdout);
+
+    for_each_parallel(devices, [](bench_kasa* d) { d->disable(); });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Start bin/kasa_sim and wait until it is listening. Its stdout is returned
+// through 'out'.
+////////////////////////////////////////////////////////////////////////////////
+pid_t start_sim(const char* sim, int count, int latency, int jitter, FILE** out) {
+    int fds[2];
+    if (pipe(fds)) return -1;
+    char count_str[16], latency_str[16], jitter_str[16];
+    snprintf(count_str, 16, "%d", count);
+    snprintf(latency_str, 16, "%d", latency);
+    snprintf(jitter_str, 16, "%d", jitter);
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[1], 1);
+        close(fds[0]);
+        close(fds[1]);
+        execl(sim, sim, "-a", base_addr, "-n", count_str, "-L", latency_str,
+            "-J", jitter_str, (char*)nullptr);
+        _exit(1);
+    }
+    close(fds[1]);
+    *out = fdopen(fds[0], "r");
+    char line[256];
+    if (!fgets(line, sizeof(line), *out) || strncmp(line, "Simulating", 10)) {
+        fprintf(stderr, "kasa_sim failed to start: %s", line);
+        kill(pid, SIGINT);
+        waitpid(pid, nullptr, 0);
+        fclose(*out);
+        return -1;
+    }
+    return pid;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char *argv[]) {
+    char sizes[256], out_file[256];
+    strncpy(sizes, "10,100,1000,5000", 256);
+    strncpy(base_addr, "127.1.0.1", 64);
+    strncpy(log_file, "/tmp/kasa_bench.log", 256);
+    out_file[0] = '\0';
+    int latency = 5, jitter = 5, phase = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && (argc > i + 1)) {
+            strncpy(sizes, argv[i+1], 256);
+            sizes[255] = '\0';
+            i++;
+        }
+        else if (!strcmp(argv[i], "-t") && (argc > i + 1)) {
+            seconds = atoi(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-T") && (argc > i + 1)) {
+            period = atof(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-w") && (argc > i + 1)) {
+            workers = atoi(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-L") && (argc > i + 1)) {
+            latency = atoi(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-J") && (argc > i + 1)) {
+            jitter = atoi(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-r") && (argc > i + 1)) {
+            rate = atof(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-R") && (argc > i + 1)) {
+            subnet_rate = atof(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-a") && (argc > i + 1)) {
+            strncpy(base_addr, argv[i+1], 64);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-l") && (argc > i + 1)) {
+            strncpy(log_file, argv[i+1], 256);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-o") && (argc > i + 1)) {
+            strncpy(out_file, argv[i+1], 256);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-P") && (argc > i + 1)) {
+            phase = atoi(argv[i+1]);
+            i++;
+        }
+        else {
+            printf("./bin/kasa_bench measures kasa sync throughput and set_target() latency\n");
+            printf("against simulated devices (bin/kasa_sim). Results are printed as JSON.\n");
+            printf("\n");
+            printf("Options are:\n");
+            printf("\n");
+            printf("  -n <list>   : comma separated fleet sizes (default 10,100,1000,5000).\n");
+            printf("  -t <number> : seconds to measure each size (default 10).\n");
+            printf("  -T <number> : seconds between toggles of a device, on average (default 2).\n");
+            printf("  -w <number> : scheduler worker limit (default 16).\n");
+            printf("  -L <ms>     : simulated device latency (default 5).\n");
+            printf("  -J <ms>     : simulated device jitter (default 5).\n");
+            printf("  -r <number> : pacer requests per second for the process (default 200,\n");
+            printf("                as in production; 0 turns the limit off).\n");
+            printf("  -R <number> : pacer requests per second for each /24 (default 50).\n");
+            printf("  -a <addr>   : first simulated device address (default 127.1.0.1).\n");
+            printf("  -l <file>   : log file (default /tmp/kasa_bench.log).\n");
+            printf("  -o <file>   : write the JSON here instead of stdout.\n");
+            printf("\n");
+            return 1;
+        }
+    }
+
+    if (phase > 0) {
+        run(phase);
+        return 0;
+    }
+
+    char sim[512];
+    strncpy(sim, argv[0], 500);
+    sim[500] = '\0';
+    char* slash = strrchr(sim, '/');
+    strcpy(slash ? slash + 1 : sim, "kasa_sim");
+
+    FILE* out = stdout;
+    if (out_file[0] && !(out = fopen(out_file, "w"))) {
+        fprintf(stderr, "Cannot open %s\n", out_file);
+        return 1;
+    }
+    fprintf(out, "{\"bench\":\"kasa_bench\",\"time\":%ld,\"seconds\":%d,"
+        "\"toggle_period_s\":%.2f,\"workers\":%d,\"sim_latency_ms\":%d,"
+        "\"sim_jitter_ms\":%d,\"pacer_rate\":%.1f,\"pacer_subnet_rate\":%.1f,"
+        "\"runs\":[", (long)time(nullptr), seconds, period, workers, latency,
+        jitter, rate, subnet_rate);
+
+    bool first = true;
+    for (char* tok = strtok(sizes, ","); tok; tok = strtok(nullptr, ",")) {
+        int count = atoi(tok);
+        if (count < 1) continue;
+        fprintf(stderr, "%d devices...\n", count);
+
+        FILE* sim_out;
+        pid_t sim_pid = start_sim(sim, count, latency, jitter, &sim_out);
+        if (sim_pid < 0) break;
+
+        unlink(log_file);
+        char idx_file[272];
+        snprintf(idx_file, sizeof(idx_file), "%s.idx", log_file);
+        unlink(idx_file);
+
+        int fds[2];
+        if (pipe(fds)) break;
+        char phase_str[16], seconds_str[16], period_str[32], workers_str[16],
+            rate_str[32], subnet_rate_str[32];
+        snprintf(phase_str, 16, "%d", count);
+        snprintf(seconds_str, 16, "%d", seconds);
+        snprintf(period_str, 32, "%f", period);
+        snprintf(workers_str, 16, "%d", workers);
+        snprintf(rate_str, 32, "%f", rate);
+        snprintf(subnet_rate_str, 32, "%f", subnet_rate);
+        pid_t pid = fork();
+        if (pid == 0) {
+            dup2(fds[1], 1);
+            close(fds[0]);
+            close(fds[1]);
+            execl(argv[0], argv[0], "-P", phase_str, "-t", seconds_str,
+                "-T", period_str, "-w", workers_str, "-r", rate_str,
+                "-R", subnet_rate_str, "-a", base_addr,
+                "-l", log_file, (char*)nullptr);
+            _exit(1);
+        }
+        close(fds[1]);
+        std::string fields;
+        char buf[1024];
+        int n;
+        while ((n = read(fds[0], buf, sizeof(buf))) > 0) fields.append(buf, n);
+        close(fds[0]);
+        waitpid(pid, nullptr, 0);
+
+        kill(sim_pid, SIGINT);
+        struct rusage sim_ru;
+        wait4(sim_pid, nullptr, 0, &sim_ru);
+        fclose(sim_out);
+
+        if (fields.empty()) {
+            fprintf(stderr, "%d devices: run failed\n", count);
+            continue;
+        }
+        fprintf(out, "%s{%s,\"sim_cpu_s\":%.3f}", first ? "" : ",",
+            fields.c_str(), cpu_seconds(sim_ru));
+        fflush(out);
+        first = false;
+        fprintf(stderr, "%d devices done\n", count);
+    }
+
+    fprintf(out, "]}\n");
+    if (out != stdout) fclose(out);
+    unlink(log_file);
+    return 0;
+}
@@ -0,0 +1,223 @@
+
+#include "../modules/kasa_codec.hpp"
+#include <stdio.h>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+// Compares kasa_codec with copies of the old in-place kasa::encode() and
+// kasa::decode(), and checks that the output is byte-exact.
+//
+// The receive benchmark models the old receive loop, which re-ran decode()
+// over the whole buffer after every partial recv(), against feeding only the
+// new bytes to the streaming decoder.
+////////////////////////////////////////////////////////////////////////////////
+using hc = std::chrono::steady_clock;
+
+////////////////////////////////////////////////////////////////////////////////
+// Copies of the old implementation.
+////////////////////////////////////////////////////////////////////////////////
+int legacy_encode(char* data) {
+    char temp[5];
+    for (int j = 0; j < 5; j++) temp[j] = data[j];
+    data[3] = 171;
+    int len = 0;
+    while (temp[0]) {
+        data[len+4] = data[len+3] ^ temp[0];
+        for (int j = 0; j < 4; j++) temp[j] = temp[j+1];
+        temp[4] = data[4 + ++len];
+    }
+    for (int i = 0; i < 4; i++) data[3-i] = (len >> (8*i)) & 255;
+    return len+4;
+}
+
+bool legacy_decode(char* data, int len) {
+    int msg_len = 0;
+    for (int i = 0; i < 4; i++) msg_len = (msg_len << 8) + data[i];
+    msg_len += 4;
+    if (msg_len > len) return false;
+    len = msg_len;
+    if (len < 4) len = 4;
+    data[3] = 171;
+    for (int i = 0; i < len-4; i++) data[i] = data[i+3] ^ data[i+4];
+    data[len-4] = 0;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Printable JSON-like text with no null bytes (the old encoder stops at the
+// first null).
+////////////////////////////////////////////////////////////////////////////////
+void random_text(char* out, size_t len, unsigned* seed) {
+    for (size_t i = 0; i < len; i++) out[i] = 32 + rand_r(seed) % 95;
+    out[len] = '\0';
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// The old decode() reads the length header as signed chars, so it is only
+// correct when no header byte has its top bit set.
+////////////////////////////////////////////////////////////////////////////////
+bool legacy_length_ok(size_t len) {
+    for (int i = 0; i < 4; i++)
+        if ((len >> (8 * i)) & 0x80) return false;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+int verify(int rounds) {
+    unsigned seed = 1;
+    int failures = 0;
+    for (int r = 0; r < rounds; r++) {
+        size_t len = rand_r(&seed) % 20000;
+        if (r < 200) len = r;
+        std::vector<char> text(len + 1), legacy(len + 8), fresh(len + 8);
+        random_text(text.data(), len, &seed);
+
+        memcpy(legacy.data(), text.data(), len + 1);
+        int legacy_len = legacy_encode(legacy.data());
+        int fresh_len = kasa_codec::encode(text.data(), len, fresh.data());
+        if (legacy_len != fresh_len ||
+                memcmp(legacy.data(), fresh.data(), fresh_len)) {
+            printf("encode mismatch at length %zu (%s)\n", len,
+                kasa_codec::implementation());
+            failures++;
+            continue;
+        }
+
+        // Feed the decoder in random chunk sizes, including single bytes
+        // which split the header.
+        kasa_codec::decoder d;
+        d.reset();
+        size_t pos = 0;
+        while (pos < (size_t)fresh_len) {
+            size_t n = 1 + rand_r(&seed) % 3000;
+            if (n > fresh_len - pos) n = fresh_len - pos;
+            pos += d.feed(fresh.data() + pos, n);
+        }
+        if (!d.complete() || d.size() != len || memcmp(d.c_str(), text.data(),
+                len + 1)) {
+            printf("decode mismatch at length %zu (%s)\n", len,
+                kasa_codec::implementation());
+            failures++;
+        }
+        if (legacy_length_ok(len)) {
+            legacy_decode(legacy.data(), legacy_len);
+            if (memcmp(legacy.data(), d.c_str(), len + 1)) {
+                printf("legacy decode mismatch at length %zu\n", len);
+                failures++;
+            }
+        }
+    }
+    return failures;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Returns nanoseconds per call of 'fn'.
+////////////////////////////////////////////////////////////////////////////////
+template <typename F>
+double time_ns(int iterations, F fn) {
+    auto start = hc::now();
+    for (int i = 0; i < iterations; i++) fn();
+    return std::chrono::duration<double, std::nano>(hc::now() - start).count() /
+        iterations;
+}
+
+void bench(size_t len, size_t segment) {
+    unsigned seed = 7;
+    std::vector<char> text(len + 1), wire(len + 8), buf(len + 8);
+    random_text(text.data(), len, &seed);
+    int wire_len = kasa_codec::encode(text.data(), len, wire.data());
+    int iterations = len > 100000 ? 50 : 2000;
+    volatile char sink = 0;
+
+    double legacy_enc = time_ns(iterations, [&]() {
+        memcpy(buf.data(), text.data(), len + 1);
+        legacy_encode(buf.data());
+        sink = buf[len];
+    });
+    kasa_codec::use_scalar(true);
+    double scalar_enc = time_ns(iterations, [&]() {
+        kasa_codec::encode(text.data(), len, buf.data());
+        sink = buf[len];
+    });
+    kasa_codec::use_scalar(false);
+    double simd_enc = time_ns(iterations, [&]() {
+        kasa_codec::encode(text.data(), len, buf.data());
+        sink = buf[len];
+    });
+
+    // Old receive loop: copy in a segment, then decode() the whole buffer.
+    // decode() only does the work once the length is satisfied, but it still
+    // runs after every segment; a reply split across many segments also paid
+    // for the final full decode.
+    double legacy_recv = time_ns(iterations, [&]() {
+        int recv_len = 0;
+        bool done = false;
+        while (!done) {
+            int n = std::min((int)segment, wire_len - recv_len);
+            memcpy(buf.data() + recv_len, wire.data() + recv_len, n);
+            recv_len += n;
+            done = legacy_decode(buf.data(), recv_len);
+        }
+        sink = buf[0];
+    });
+    kasa_codec::decoder d;
+    double stream_recv = time_ns(iterations, [&]() {
+        d.reset();
+        size_t pos = 0;
+        while (!d.complete()) {
+            size_t n = std::min(segment, wire_len - pos);
+            pos += d.feed(wire.data() + pos, n);
+        }
+        sink = d.c_str()[0];
+    });
+
+    printf("len=%-8zu encode_ns legacy=%-10.0f scalar=%-10.0f %s=%-10.0f "
+        "recv_ns legacy=%-10.0f stream=%-10.0f\n", len, legacy_enc, scalar_enc,
+        kasa_codec::implementation(), simd_enc, legacy_recv, stream_recv);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char *argv[]) {
+    int rounds = 2000;
+    size_t segment = 1448;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-r") && (argc > i + 1)) {
+            rounds = atoi(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-s") && (argc > i + 1)) {
+            segment = atoi(argv[i+1]);
+            i++;
+        }
+        else {
+            printf("./bin/kasa_codec_bench checks and times the kasa codec.\n");
+            printf("\n");
+            printf("Options are:\n");
+            printf("\n");
+            printf("  -r <number> : random round trips to verify (default 2000).\n");
+            printf("  -s <number> : bytes per simulated recv() (default 1448).\n");
+            printf("\n");
+            return 1;
+        }
+    }
+
+    int failures = 0;
+    kasa_codec::use_scalar(true);
+    failures += verify(rounds);
+    kasa_codec::use_scalar(false);
+    failures += verify(rounds);
+    printf("verify: %d round trips per implementation (scalar, %s), %d failures\n",
+        rounds, kasa_codec::implementation(), failures);
+
+    size_t sizes[] = {64, 1024, 4096, 65536, 1 << 20};
+    for (size_t len : sizes) bench(len, segment);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,144 @@
+
+#include "../modules/unit.hpp"
+#include <stdio.h>
+#include <cstring>
+#include <ctime>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Measures the caller-side cost of unit::report() against a copy of the
+// previous implementation, which formatted the time and opened, wrote and
+// closed the log file under a global lock on every call.
+//
+// Each record is written as a state change in kasa::sync() writes it: four
+// log events in a row.
+////////////////////////////////////////////////////////////////////////////////
+using sc = std::chrono::system_clock;
+using hc = std::chrono::steady_clock;
+
+char log_file[256];
+std::mutex legacy_mtx;
+
+////////////////////////////////////////////////////////////////////////////////
+// A stripped down copy of the old unit::report().
+////////////////////////////////////////////////////////////////////////////////
+void legacy_report(const char* name, const char* text, bool log) {
+    std::unique_lock<std::mutex> lck(legacy_mtx);
+    char time_str[64];
+    time_t time = sc::to_time_t(sc::now());
+    strftime(time_str, 64, "%c", std::localtime(&time));
+    if (log) {
+        FILE* f = fopen(log_file, "a");
+        if (f) {
+            fprintf(f, "%s ; %s ; %s\n", time_str, name, text);
+            fflush(f);
+            fclose(f);
+        }
+        printf("%s ; %s ; log <- %s\n", time_str, name, text);
+        fflush(stdout);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+class bench_unit : public unit {
+public:
+    bench_unit(int i) {
+        char name[64];
+        snprintf(name, 64, "BENCH [ %d ]", i);
+        set_name(name);
+    }
+    void state_change(bool legacy) {
+        const char* lines[] =
+            {"state: OFF", "power: 1234", "brightness: 50", "state: ON"};
+        for (int i = 0; i < 4; i++) {
+            if (legacy) legacy_report("BENCH", lines[i], true);
+            else report(lines[i], 2, true);
+        }
+    }
+    void filtered() {
+        report("filtered", 6);
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Returns the mean caller-side cost of one call of 'fn' in nanoseconds.
+////////////////////////////////////////////////////////////////////////////////
+template <typename F>
+double run(int threads, int iterations, F fn) {
+    std::vector<std::thread> t;
+    std::vector<double> ns(threads);
+    for (int i = 0; i < threads; i++) {
+        t.push_back(std::thread([&, i]() {
+            bench_unit u(i);
+            auto start = hc::now();
+            for (int j = 0; j < iterations; j++) fn(u);
+            ns[i] = std::chrono::duration<double, std::nano>(
+                hc::now() - start).count() / iterations;
+        }));
+    }
+    double total = 0;
+    for (int i = 0; i < threads; i++) {
+        t[i].join();
+        total += ns[i];
+    }
+    return total / threads;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char *argv[]) {
+    int threads = 4, iterations = 20000;
+    snprintf(log_file, 256, "/tmp/log_bench.%d.log", getpid());
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-t") && (argc > i + 1)) {
+            threads = atoi(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-n") && (argc > i + 1)) {
+            iterations = atoi(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-l") && (argc > i + 1)) {
+            strncpy(log_file, argv[i+1], 256);
+            i++;
+        }
+        else {
+            printf("./bin/log_bench measures the caller-side cost of unit::report().\n");
+            printf("\n");
+            printf("Options are:\n");
+            printf("\n");
+            printf("  -t <number> : reporting threads (default 4).\n");
+            printf("  -n <number> : state changes per thread (default 20000).\n");
+            printf("  -l <file>   : log file (default /tmp/log_bench.<pid>.log).\n");
+            printf("\n");
+            return 1;
+        }
+    }
+
+    // Console output would dominate both measurements.
+    if (!freopen("/dev/null", "w", stdout)) return 1;
+    unit::set_log_file(log_file);
+    unit::set_verbosity(2);
+
+    double filtered = run(threads, iterations * 4,
+        [](bench_unit& u) { u.filtered(); });
+    double ring = run(threads, iterations,
+        [](bench_unit& u) { u.state_change(false); });
+    auto start = hc::now();
+    unit::flush_log();
+    double flush_ms = std::chrono::duration<double, std::milli>(
+        hc::now() - start).count();
+    double legacy = run(threads, iterations / 10,
+        [](bench_unit& u) { u.state_change(true); });
+
+    fprintf(stderr, "threads=%d filtered_ns=%.1f ring_state_change_ns=%.1f "
+        "legacy_state_change_ns=%.1f final_flush_ms=%.2f\n",
+        threads, filtered, ring, legacy, flush_ms);
+    unlink(log_file);
+    return 0;
+}
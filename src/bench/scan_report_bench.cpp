@@ -0,0 +1,229 @@
+
+#include "../modules/unit.hpp"
+#include <stdio.h>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Measures startup time of the "last time X was logged" lookups made by the
+// kasa and presence constructors, against a synthetic log of the requested
+// size. Three cases are measured, each in a fresh process (the bench runs
+// itself again with -P) so that no index is carried over in memory:
+//   legacy - a copy of the old scan_report(), which read the whole log per call
+//   cold   - the log index with no sidecar (first start after upgrading)
+//   warm   - the log index with a sidecar and some new lines since it was saved
+////////////////////////////////////////////////////////////////////////////////
+using sc = std::chrono::system_clock;
+using hc = std::chrono::steady_clock;
+
+char log_file[256];
+int devices = 25;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void device_name(int i, char* name) {
+    snprintf(name, 64, "KASA [ plug_%d @ 10.0.%d.%d ]", i, i / 250, i % 250 + 2);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Appends roughly 'bytes' of log lines, one record per second starting at
+// 'start'. Returns the time of the last line.
+////////////////////////////////////////////////////////////////////////////////
+time_t generate(uint64_t bytes, time_t start) {
+    FILE* f = fopen(log_file, "a");
+    if (!f) return start;
+    setvbuf(f, nullptr, _IOFBF, 1 << 20);
+    const char* texts[] = {"state: ON", "state: OFF", "power: %d"};
+    char name[64], text[64], time_str[64];
+    uint64_t written = 0;
+    time_t t = start;
+    unsigned seed = start;
+    while (written < bytes) {
+        struct tm tm;
+        localtime_r(&t, &tm);
+        strftime(time_str, 64, "%c", &tm);
+        for (int i = 0; i < 8; i++) {
+            int d = rand_r(&seed) % devices;
+            int k = rand_r(&seed) % 3;
+            device_name(d, name);
+            snprintf(text, 64, texts[k], rand_r(&seed) % 5000);
+            written += fprintf(f, "%s ; %s ; %s\n", time_str, name, text);
+        }
+        t++;
+    }
+    fclose(f);
+    return t;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// A stripped down copy of the old unit::scan_report().
+////////////////////////////////////////////////////////////////////////////////
+time_t legacy_scan(const char* name, const char* text) {
+    char looking_for[512], input_time_str[512], input_line[512];
+    snprintf(looking_for, 512, "%s ; %s", name, text);
+    time_t found = 0;
+    FILE* f = fopen(log_file, "r");
+    if (!f) return found;
+    while (true) {
+        if (fscanf(f, "%512[^;]", input_time_str) == EOF) break;
+        if (fscanf(f, "%512[^\n] ", input_line) == EOF) break;
+        if (nullptr != strstr(input_line, looking_for)) {
+            struct tm time;
+            strptime(input_time_str, "%c", &time);
+            found = mktime(&time);
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Stands in for a device module: the constructor does the same lookups as a
+// kasa constructor.
+////////////////////////////////////////////////////////////////////////////////
+class bench_unit : public unit {
+public:
+    time_t on, off;
+    bench_unit(int i) {
+        char name[64];
+        device_name(i, name);
+        set_name(name);
+        index_report("state: ON");
+        index_report("state: OFF");
+        on = sc::to_time_t(scan_report("state: ON"));
+        off = sc::to_time_t(scan_report("state: OFF"));
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+double seconds_since(hc::time_point start) {
+    return std::chrono::duration<double>(hc::now() - start).count();
+}
+
+void run_legacy(int lookups) {
+    char name[64];
+    auto start = hc::now();
+    for (int i = 0; i < lookups; i++) {
+        device_name(i % devices, name);
+        legacy_scan(name, (i & 1) ? "state: OFF" : "state: ON");
+    }
+    double s = seconds_since(start);
+    printf("legacy  lookups=%-4d seconds=%-10.3f per_lookup=%.3f "
+        "projected_startup=%.1f\n", lookups, s, s / lookups,
+        s / lookups * devices * 2);
+}
+
+void run_index(const char* mode) {
+    unit::set_log_file(log_file);
+    auto start = hc::now();
+    std::vector<bench_unit*> units;
+    for (int i = 0; i < devices; i++) units.push_back(new bench_unit(i));
+    double s = seconds_since(start);
+    printf("%-7s lookups=%-4d seconds=%-10.3f per_lookup=%.6f\n",
+        mode, devices * 2, s, s / (devices * 2));
+
+    // Spot check against the legacy scan.
+    char name[64];
+    device_name(0, name);
+    if (units[0]->on != legacy_scan(name, "state: ON"))
+        printf("MISMATCH for %s state: ON\n", name);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char *argv[]) {
+    uint64_t size_mb = 2048, tail_mb = 16;
+    int lookups = 1, phase = -1;
+    bool keep = false;
+    strncpy(log_file, "/tmp/scan_report_bench.log", 256);
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-s") && (argc > i + 1)) {
+            size_mb = atoll(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-t") && (argc > i + 1)) {
+            tail_mb = atoll(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-d") && (argc > i + 1)) {
+            devices = atoi(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-L") && (argc > i + 1)) {
+            lookups = atoi(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-l") && (argc > i + 1)) {
+            strncpy(log_file, argv[i+1], 256);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-P") && (argc > i + 1)) {
+            phase = atoi(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-k")) {
+            keep = true;
+        }
+        else {
+            printf("./bin/scan_report_bench measures startup lookups against a synthetic log.\n");
+            printf("\n");
+            printf("Options are:\n");
+            printf("\n");
+            printf("  -s <number> : log size in MB (default 2048).\n");
+            printf("  -t <number> : MB appended after the sidecar is saved (default 16).\n");
+            printf("  -d <number> : number of devices (default 25).\n");
+            printf("  -L <number> : legacy lookups to time, 0 to skip (default 1).\n");
+            printf("  -l <file>   : log file (default /tmp/scan_report_bench.log).\n");
+            printf("  -k          : keep the log and sidecar afterwards.\n");
+            printf("\n");
+            return 1;
+        }
+    }
+
+    unit::set_verbosity(0);
+    if (phase == 0) run_legacy(lookups);
+    if (phase == 1) run_index("cold");
+    if (phase == 2) run_index("warm");
+    if (phase != -1) return 0;
+
+    char idx_file[272];
+    snprintf(idx_file, sizeof(idx_file), "%s.idx", log_file);
+    unlink(log_file);
+    unlink(idx_file);
+
+    auto start = hc::now();
+    time_t end = generate(size_mb << 20, sc::to_time_t(sc::now()) - 365 * 86400);
+    printf("generated %llu MB in %.1f seconds\n",
+        (unsigned long long)size_mb, seconds_since(start));
+    fflush(stdout);
+
+    for (phase = 0; phase < 3; phase++) {
+        if (phase == 0 && !lookups) continue;
+        if (phase == 2) generate(tail_mb << 20, end);
+        char phase_str[16], devices_str[16], lookups_str[16];
+        snprintf(phase_str, 16, "%d", phase);
+        snprintf(devices_str, 16, "%d", devices);
+        snprintf(lookups_str, 16, "%d", lookups);
+        pid_t pid = fork();
+        if (pid == 0) {
+            execl(argv[0], argv[0], "-P", phase_str, "-d", devices_str,
+                "-L", lookups_str, "-l", log_file, (char*)nullptr);
+            _exit(1);
+        }
+        waitpid(pid, nullptr, 0);
+    }
+
+    if (!keep) {
+        unlink(log_file);
+        unlink(idx_file);
+    }
+    return 0;
+}
@@ -0,0 +1,192 @@
+
+#include "../modules/module.hpp"
+#include <stdio.h>
+#include <cstring>
+#include <algorithm>
+#include <sys/wait.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Compares the shared scheduler against the previous model, where every module
+// owned a std::thread which slept on a condition variable between syncs.
+// Each mode runs in a forked child so that thread count and RSS are measured
+// independently.
+////////////////////////////////////////////////////////////////////////////////
+using sc = std::chrono::system_clock;
+
+std::mutex lag_mtx;
+std::vector<double> lags;
+
+////////////////////////////////////////////////////////////////////////////////
+// All syncs are due on a whole second, so the lag is the time past the second.
+////////////////////////////////////////////////////////////////////////////////
+void record_lag() {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        sc::now().time_since_epoch()).count();
+    std::unique_lock<std::mutex> lck(lag_mtx);
+    lags.push_back((ns % 1000000000) / 1e6);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// A module which does nothing except measure when it was called.
+////////////////////////////////////////////////////////////////////////////////
+class bench_module : public module {
+public:
+    bool armed = false;
+protected:
+    void sync(bool last) {
+        if (armed && !last) record_lag();
+    }
+public:
+    bench_module() : module(true, 1) {}
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// A stripped down copy of the old management_thread() wait loop.
+////////////////////////////////////////////////////////////////////////////////
+class legacy_module {
+private:
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool done = false;
+    std::thread thread;
+
+    static void management_thread(legacy_module* m) {
+        std::unique_lock<std::mutex> lck(m->mtx);
+        while (!m->done) {
+            auto next = std::chrono::ceil<std::chrono::seconds>(sc::now());
+            do {
+                m->cv.wait_until(lck, next);
+            } while (!m->done && sc::now() < next);
+            if (!m->done) record_lag();
+        }
+    }
+
+public:
+    void enable() { thread = std::thread(&management_thread, this); }
+    void disable() {
+        std::unique_lock<std::mutex> lck(mtx);
+        done = true;
+        cv.notify_all();
+        lck.unlock();
+        thread.join();
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+long proc_status(const char* key) {
+    char line[256];
+    long value = -1;
+    FILE* f = fopen("/proc/self/status", "r");
+    if (!f) return -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (!strncmp(line, key, strlen(key))) {
+            value = atol(line + strlen(key));
+            break;
+        }
+    }
+    fclose(f);
+    return value;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void report_results(const char* mode, int count) {
+    long threads = proc_status("Threads:");
+    long rss = proc_status("VmRSS:");
+    std::unique_lock<std::mutex> lck(lag_mtx);
+    std::sort(lags.begin(), lags.end());
+    size_t n = lags.size();
+    double p50 = n ? lags[n / 2] : 0;
+    double p99 = n ? lags[(n * 99) / 100] : 0;
+    double max = n ? lags[n - 1] : 0;
+    printf("%-9s modules=%-6d threads=%-6ld rss_kb=%-8ld syncs=%-8zu "
+        "lag_ms p50=%.2f p99=%.2f max=%.2f\n",
+        mode, count, threads, rss, n, p50, p99, max);
+    fflush(stdout);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void run_scheduler(int count, int seconds) {
+    std::vector<bench_module*> modules;
+    for (int i = 0; i < count; i++) {
+        modules.push_back(new bench_module());
+        modules.back()->enable();
+        modules.back()->armed = true;
+    }
+    sleep(seconds);
+    report_results("scheduler", count);
+    for (int i = 0; i < count; i++) modules[i]->disable();
+}
+
+void run_thread(int count, int seconds) {
+    std::vector<legacy_module*> modules;
+    for (int i = 0; i < count; i++) {
+        modules.push_back(new legacy_module());
+        modules.back()->enable();
+    }
+    sleep(seconds);
+    report_results("thread", count);
+    for (int i = 0; i < count; i++) modules[i]->disable();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char *argv[]) {
+    int count = 1000, seconds = 10, workers = 16;
+    char mode[64];
+    strncpy(mode, "both", 64);
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && (argc > i + 1)) {
+            count = atoi(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-t") && (argc > i + 1)) {
+            seconds = atoi(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-w") && (argc > i + 1)) {
+            workers = atoi(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-m") && (argc > i + 1)) {
+            strncpy(mode, argv[i+1], 64);
+            i++;
+        }
+        else {
+            printf("./bin/scheduler_bench compares the shared scheduler with one thread per module.\n");
+            printf("\n");
+            printf("Options are:\n");
+            printf("\n");
+            printf("  -n <number> : number of modules (default 1000).\n");
+            printf("  -t <number> : seconds to run each mode (default 10).\n");
+            printf("  -w <number> : scheduler worker limit (default 16).\n");
+            printf("  -m <mode>   : 'scheduler', 'thread' or 'both' (default).\n");
+            printf("\n");
+            return 1;
+        }
+    }
+
+    module::set_verbosity(0);
+    scheduler::set_worker_count(workers);
+
+    const char* modes[] = {"thread", "scheduler"};
+    for (int i = 0; i < 2; i++) {
+        if (strcmp(mode, "both") && strcmp(mode, modes[i])) continue;
+        pid_t pid = fork();
+        if (pid == 0) {
+            if (i == 0) run_thread(count, seconds);
+            else run_scheduler(count, seconds);
+            _exit(0);
+        }
+        waitpid(pid, nullptr, 0);
+    }
+
+    return 0;
+}
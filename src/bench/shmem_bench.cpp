@@ -0,0 +1,275 @@
+#include "../modules/shmem.hpp"
+#include <stdio.h>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Compares the seqlock protocol of shmem against a copy of the previous one,
+// which took an fcntl() record lock around every access and signalled peers
+// with SIGIO after every write.
+//
+// The update rate is measured in a single process. Reader latency is measured
+// while a forked writer updates the value as fast as it can. Wake latency is
+// the time from a write to a blocked reader in another process holding the
+// new value: SIGIO and a signal handler before, a futex wait now.
+////////////////////////////////////////////////////////////////////////////////
+using hc = std::chrono::steady_clock;
+
+////////////////////////////////////////////////////////////////////////////////
+// A stripped down copy of the old shmem::sync().
+////////////////////////////////////////////////////////////////////////////////
+struct legacy_shmem {
+    int fd, size;
+    void* mem;
+
+    legacy_shmem(const char* file, int size) : size(size) {
+        fd = open(file, O_RDWR | O_CREAT, S_IRWXU);
+        if (ftruncate(fd, size)) perror("ftruncate");
+        mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ~legacy_shmem() {
+        munmap(mem, size);
+        close(fd);
+    }
+    void access(void* value, bool write) {
+        uint8_t buf[size];
+        if (write) memcpy(buf, value, size);
+        struct flock flock = {
+            .l_type = F_RDLCK,
+            .l_whence = SEEK_SET,
+            .l_start = 0,
+            .l_len = size,
+            .l_pid = 0};
+        if (write) flock.l_type = F_WRLCK;
+        fcntl(fd, F_SETLKW, &flock);
+        if (write) memcpy(mem, buf, size);
+        memcpy(buf, mem, size);
+        flock.l_type = F_UNLCK;
+        fcntl(fd, F_SETLK, &flock);
+        if (write) kill(getpid(), SIGIO);
+        else memcpy(value, buf, size);
+    }
+};
+
+void on_sigio(int) {}
+
+////////////////////////////////////////////////////////////////////////////////
+// Children are stopped through a shared flag rather than killed, so they
+// never die in the middle of a write.
+////////////////////////////////////////////////////////////////////////////////
+std::atomic<bool>* stop;
+
+void stop_child(pid_t child) {
+    stop->store(true);
+    waitpid(child, nullptr, 0);
+    stop->store(false);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Returns the mean cost of one call of 'fn' in nanoseconds.
+////////////////////////////////////////////////////////////////////////////////
+template <typename F>
+double rate(int iterations, F fn) {
+    auto start = hc::now();
+    for (int i = 0; i < iterations; i++) fn(i);
+    return std::chrono::duration<double, std::nano>(hc::now() - start).count()
+        / iterations;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Times every read while a child process writes. Prints mean, p50, p99 and
+// max in nanoseconds.
+////////////////////////////////////////////////////////////////////////////////
+template <typename R, typename W>
+void latency(const char* label, int iterations, R read_fn, W write_fn) {
+    pid_t child = fork();
+    if (child == 0) {
+        signal(SIGIO, SIG_IGN);
+        for (uint64_t i = 0; !stop->load(); i++) write_fn(i);
+        _exit(0);
+    }
+    usleep(10000);
+    std::vector<double> ns(iterations);
+    for (int i = 0; i < iterations; i++) {
+        auto start = hc::now();
+        read_fn();
+        ns[i] = std::chrono::duration<double, std::nano>(hc::now() - start).count();
+    }
+    stop_child(child);
+
+    double total = 0;
+    for (double n : ns) total += n;
+    std::sort(ns.begin(), ns.end());
+    fprintf(stderr, "%s_read_ns mean=%.0f p50=%.0f p99=%.0f max=%.0f\n", label,
+        total / iterations, ns[iterations / 2], ns[iterations * 99 / 100],
+        ns.back());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// A forked reader blocks in 'wait_fn' and then reads the steady clock time
+// the parent wrote into the value. The parent writes every 'gap_us'.
+// Latencies go back through a shared array.
+////////////////////////////////////////////////////////////////////////////////
+template <typename W, typename R, typename N>
+void wake_latency(const char* label, int samples, int gap_us, W wait_fn,
+        R read_fn, N write_fn) {
+    double* ns = (double*)mmap(NULL, samples * sizeof(double),
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    std::atomic<int>* count = new (mmap(NULL, sizeof(std::atomic<int>),
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) std::atomic<int>(0);
+    pid_t child = fork();
+    if (child == 0) {
+        int64_t last = 0;
+        while (count->load() < samples && !stop->load()) {
+            wait_fn();
+            int64_t sent = read_fn();
+            if (sent == last) continue;
+            last = sent;
+            ns[count->load()] = hc::now().time_since_epoch().count() - sent;
+            count->fetch_add(1);
+        }
+        _exit(0);
+    }
+    usleep(10000);
+    for (int i = 0; i < samples * 2 && count->load() < samples; i++) {
+        write_fn(child, (int64_t)hc::now().time_since_epoch().count());
+        usleep(gap_us);
+    }
+    stop_child(child);
+
+    int n = count->load();
+    std::sort(ns, ns + n);
+    if (n) fprintf(stderr, "%s_wake_us p50=%.1f p99=%.1f max=%.1f (%d samples)\n",
+        label, ns[n / 2] / 1000, ns[n * 99 / 100] / 1000, ns[n - 1] / 1000, n);
+    munmap(ns, samples * sizeof(double));
+    munmap(count, sizeof(std::atomic<int>));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char *argv[]) {
+    int size = 8, iterations = 200000;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-s") && (argc > i + 1)) {
+            size = std::max(8, atoi(argv[i+1]));
+            i++;
+        }
+        else if (!strcmp(argv[i], "-n") && (argc > i + 1)) {
+            iterations = atoi(argv[i+1]);
+            i++;
+        }
+        else {
+            printf("./bin/shmem_bench compares the seqlock shmem against fcntl locks and SIGIO.\n");
+            printf("\n");
+            printf("Options are:\n");
+            printf("\n");
+            printf("  -s <bytes>  : size of the shared value (default 8).\n");
+            printf("  -n <number> : updates and reads per measurement (default 200000).\n");
+            printf("\n");
+            return 1;
+        }
+    }
+
+    char legacy_file[64], seqlock_file[64];
+    snprintf(legacy_file, 64, "/tmp/shmem_bench.%d.legacy", getpid());
+    snprintf(seqlock_file, 64, "/tmp/shmem_bench.%d.seqlock", getpid());
+    signal(SIGIO, on_sigio);
+    module::set_verbosity(0);
+    stop = new (mmap(NULL, sizeof(*stop), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0)) std::atomic<bool>(false);
+
+    std::vector<uint8_t> value(size), out(size);
+    {
+        legacy_shmem legacy(legacy_file, size);
+        double legacy_write = rate(iterations, [&](int i) {
+            memcpy(value.data(), &i, sizeof(i));
+            legacy.access(value.data(), true);
+        });
+        double legacy_read = rate(iterations, [&](int) {
+            legacy.access(out.data(), false);
+        });
+        fprintf(stderr, "legacy_update_ns=%.0f legacy_updates_per_s=%.0f "
+            "legacy_idle_read_ns=%.0f\n", legacy_write, 1e9 / legacy_write, legacy_read);
+        latency("legacy", iterations,
+            [&]() { legacy.access(out.data(), false); },
+            [&](uint64_t i) {
+                memcpy(value.data(), &i, sizeof(i));
+                legacy.access(value.data(), true);
+            });
+
+        sigset_t sigio, old;
+        sigemptyset(&sigio);
+        sigaddset(&sigio, SIGIO);
+        sigprocmask(SIG_BLOCK, &sigio, &old);
+        wake_latency("legacy", 2000, 500,
+            [&]() { sigsuspend(&old); },
+            [&]() {
+                int64_t t;
+                legacy.access(out.data(), false);
+                memcpy(&t, out.data(), sizeof(t));
+                return t;
+            },
+            [&](pid_t reader, int64_t t) {
+                memcpy(value.data(), &t, sizeof(t));
+                legacy.access(value.data(), true);
+                kill(reader, SIGIO);
+            });
+        sigprocmask(SIG_SETMASK, &old, nullptr);
+    }
+    {
+        shmem sm(seqlock_file, size);
+        double seqlock_write = rate(iterations, [&](int i) {
+            memcpy(value.data(), &i, sizeof(i));
+            sm.write(value.data());
+        });
+        double seqlock_read = rate(iterations, [&](int) { sm.read(out.data()); });
+        fprintf(stderr, "seqlock_update_ns=%.0f seqlock_updates_per_s=%.0f "
+            "seqlock_idle_read_ns=%.0f\n", seqlock_write, 1e9 / seqlock_write,
+            seqlock_read);
+
+        latency("seqlock", iterations,
+            [&]() { sm.read(out.data()); },
+            [&](uint64_t i) {
+                memcpy(value.data(), &i, sizeof(i));
+                sm.write(value.data());
+            });
+
+        // With a waiter registered, every update also costs a futex wake.
+        pid_t child = fork();
+        if (child == 0) {
+            while (!stop->load()) sm.wait(sm.read(out.data()), 10);
+            _exit(0);
+        }
+        usleep(10000);
+        double woken_write = rate(iterations, [&](int i) {
+            memcpy(value.data(), &i, sizeof(i));
+            sm.write(value.data());
+        });
+        stop_child(child);
+        fprintf(stderr, "seqlock_update_with_waiter_ns=%.0f\n", woken_write);
+
+        uint32_t seq = sm.read(out.data());
+        wake_latency("futex", 2000, 500,
+            [&]() { while (!sm.wait(seq, 1000) && !stop->load()); },
+            [&]() {
+                int64_t t;
+                seq = sm.read(out.data());
+                memcpy(&t, out.data(), sizeof(t));
+                return t;
+            },
+            [&](pid_t, int64_t t) {
+                memcpy(value.data(), &t, sizeof(t));
+                sm.write(value.data());
+            });
+    }
+    unlink(legacy_file);
+    unlink(seqlock_file);
+    return 0;
+}
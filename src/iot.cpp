@@ -1,6 +1,7 @@
 
-#include "modules/signal_handler.hpp"
+#include "modules/lifecycle.hpp"
 #include "modules/presence_icmp.hpp"
+#include "modules/signal_handler.hpp"
 #include "automations/kasa_alarm.hpp"
 #include "automations/kasa_timer.hpp"
 #include "automations/kasa_dimmer.hpp"
@@ -33,102 +34,107 @@ bool done = false;
 void iot() {
     std::unique_lock<std::mutex> lck(mtx);
     char name[64], addr[64];
+    lifecycle lc = lifecycle();
 
     automation_module am = automation_module();
-    am.enable();
     sun_time_fetcher sstf = sun_time_fetcher(true);
-    sstf.enable();
+    lc.add(&sstf, "sstf");
     sun_time_fetcher srtf = sun_time_fetcher(false);
-    srtf.enable();
+    lc.add(&srtf, "srtf");
+    sstf.listen(&am);
+    srtf.listen(&am);
 
     // Modules actively monitor and control physical devices.
     // They provide a simple abstraction for automations to interact with.
 
-    signal_handler sigio_handler = signal_handler(SIGIO);
-
     // Monitor only
     kasa shed_lights = kasa("light_shed", "10.4.1.8", 5);
-    shed_lights.enable();
+    lc.add(&shed_lights, "shed_lights");
     kasa garage_lights = kasa("light_garage", "10.4.3.1", 5);
-    garage_lights.enable();
+    lc.add(&garage_lights, "garage_lights");
     kasa freezer_plug = kasa("freezer", "10.4.2.2", 5);
-    freezer_plug.enable();
+    lc.add(&freezer_plug, "freezer_plug");
     kasa car_plug = kasa("car", "10.4.2.3", 5);
-    car_plug.enable();
+    lc.add(&car_plug, "car_plug");
     kasa dehumidifier_plug = kasa("dehumidifier", "10.4.2.5", 5);
-    dehumidifier_plug.enable();
+    lc.add(&dehumidifier_plug, "dehumidifier_plug");
     kasa attic_fan = kasa("attic_fan", "10.4.1.10", 5);
-    attic_fan.enable();
+    lc.add(&attic_fan, "attic_fan");
 
     // vegetable light
     kasa vegetable_light = kasa("vegetable_light", "10.4.2.6", 5);
-    vegetable_light.enable();
+    lc.add(&vegetable_light, "vegetable_light");
     vegetable_light.listen(&am);
 
     // Bose system on a smart plug
     kasa bose_plug = kasa("bose", "10.4.2.1", 5);
-    bose_plug.enable();
+    lc.add(&bose_plug, "bose_plug");
     bose_plug.listen(&am);
 
     // Subwoofer control
     kasa subwoofer_plug = kasa("subwoofer", "10.4.0.1", 5);
-    subwoofer_plug.enable();
+    lc.add(&subwoofer_plug, "subwoofer_plug");
     subwoofer_plug.listen(&am);
     presence_icmp tv_presence = presence_icmp("TV", "10.7.0.3", 300);
-    tv_presence.enable();
+    lc.add(&tv_presence, "tv_presence");
     tv_presence.listen(&am);
 
     // Air filter control
     kasa air_filter_plug = kasa("air_filter", "10.4.2.8", 5);
-    air_filter_plug.enable();
+    lc.add(&air_filter_plug, "air_filter_plug");
     air_filter_plug.listen(&am);
 
     // Switch+plug
     kasa kasa_bed_switch = kasa("bed_switch", "10.4.1.9", 1);
-    kasa_bed_switch.enable();
+    lc.add(&kasa_bed_switch, "kasa_bed_switch");
     kasa_bed_switch.listen(&am);
     kasa kasa_bed_plug_low = kasa("bed_plug_low", "10.4.2.7", 5);
-    kasa_bed_plug_low.enable();
+    lc.add(&kasa_bed_plug_low, "kasa_bed_plug_low");
     kasa_bed_plug_low.listen(&am);
     //kasa kasa_bed_plug_high = kasa("bed_plug_high", "10.4.5.1", 5);
     kasa kasa_bed_plug_high = kasa("bed_plug_high", "10.4.2.12", 5);
-    kasa_bed_plug_high.enable();
+    lc.add(&kasa_bed_plug_high, "kasa_bed_plug_high");
     kasa_bed_plug_high.listen(&am);
     kasa kasa_office_switch = kasa("office_switch", "10.4.1.2", 1);
-    kasa_office_switch.enable();
+    lc.add(&kasa_office_switch, "kasa_office_switch");
     kasa_office_switch.listen(&am);
     kasa kasa_office_plug = kasa("office_plug", "10.4.0.2", 5);
-    kasa_office_plug.enable();
+    lc.add(&kasa_office_plug, "kasa_office_plug");
     kasa_office_plug.listen(&am);
 
     // Outside lights - Front
     kasa light_tree_xmas     = kasa("light_tree_xmas    ", "10.4.2.4", 5);
-    light_tree_xmas.enable();
+    lc.add(&light_tree_xmas, "light_tree_xmas");
     light_tree_xmas.listen(&am);
     kasa light_front_porch   = kasa("light_front_porch  ", "10.4.1.1", 5);
-    light_front_porch.enable();
+    lc.add(&light_front_porch, "light_front_porch");
     light_front_porch.listen(&am);
     kasa light_front_garage  = kasa("light_front_garage ", "10.4.1.3", 5);
-    light_front_garage.enable();
+    lc.add(&light_front_garage, "light_front_garage");
     light_front_garage.listen(&am);
 
     // Outside lights - Rear
     kasa light_rear_garage   = kasa("light_rear_garage  ", "10.4.1.4", 5);
-    light_rear_garage.enable();
+    lc.add(&light_rear_garage, "light_rear_garage");
     light_rear_garage.listen(&am);
     kasa light_rear_deck     = kasa("light_rear_deck    ", "10.4.1.5", 5);
-    light_rear_deck.enable();
+    lc.add(&light_rear_deck, "light_rear_deck");
     light_rear_deck.listen(&am);
     kasa light_rear_flood    = kasa("light_rear_flood   ", "10.4.1.6", 5);
-    light_rear_flood.enable();
+    lc.add(&light_rear_flood, "light_rear_flood");
     light_rear_flood.listen(&am);
     kasa light_rear_basement = kasa("light_rear_basement", "10.4.1.7", 5);
-    light_rear_basement.enable();
+    lc.add(&light_rear_basement, "light_rear_basement");
     light_rear_basement.listen(&am);
     kasa light_front_pole    = kasa("light_front_pole   ", "10.4.3.2", 5);
-    light_front_pole.enable();
+    lc.add(&light_front_pole, "light_front_pole");
     light_front_pole.listen(&am);
 
+    // The automation module drives every other module, so it starts last and
+    // stops first. Everything else starts and stops in parallel.
+    lc.add(&am, "automations", lc.modules());
+    lc.start();
+
     // Automations use modules to acheive high-level objectives.
 
     switch_plug spl = switch_plug("bed low ", &kasa_bed_switch   , &kasa_bed_plug_low );
@@ -233,61 +239,30 @@ void iot() {
 
     while (!done) cv.wait(lck);
 
-    // Automations
-    am.disable();
-    sstf.disable();
-    srtf.disable();
-
-    // Outside lights
-    light_tree_xmas.disable();
-    light_front_porch.disable();
-    light_front_garage.disable();
-    light_rear_garage.disable();
-    light_rear_deck.disable();
-    light_rear_flood.disable();
-    light_rear_basement.disable();
-    light_front_pole.disable();
-
-    // Switch+plug
-    kasa_bed_plug_high.disable();
-    kasa_bed_plug_low.disable();
-    kasa_bed_switch.disable();
-    kasa_office_switch.disable();
-    kasa_office_plug.disable();
-
-    // Air filter control
-    air_filter_plug.disable();
-
-    // Subwoofer control
-    subwoofer_plug.disable();
-    tv_presence.disable();
-
-    // Monitor only
-    shed_lights.disable();
-    garage_lights.disable();
-    freezer_plug.disable();
-    car_plug.disable();
-    dehumidifier_plug.disable();
-    bose_plug.disable();
-    vegetable_light.disable();
+    lc.stop();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// Terminate the "iot()" thread on interrupt.
+// Print a backtrace on a crash.
 ////////////////////////////////////////////////////////////////////////////////
 void signalHandler(int signum) {
-    if (signum == SIGSEGV) {
-        void *array[50];
-        size_t size;
+    void *array[50];
+    size_t size;
 
-        // get void*'s for all entries on the stack
-        size = backtrace(array, 50);
+    // get void*'s for all entries on the stack
+    size = backtrace(array, 50);
 
-        // print out all the frames to stderr
-        fprintf(stderr, "Error: signal %d:\n", signum);
-        backtrace_symbols_fd(array, size, STDOUT_FILENO);
-        exit(-1);
-    }
+    // print out all the frames to stderr
+    fprintf(stderr, "Error: signal %d:\n", signum);
+    backtrace_symbols_fd(array, size, STDOUT_FILENO);
+    exit(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Terminate the "iot()" thread on SIGTERM or SIGINT. Called from
+// signal_handler::sync(), not in signal context.
+////////////////////////////////////////////////////////////////////////////////
+void stop_iot() {
     std::unique_lock<std::mutex> lck(mtx);
     done = true;
     cv.notify_all();
@@ -326,9 +301,13 @@ int main(int argc, char *argv[]) {
 
     module::set_log_file(log_file);
 
+    // Before any thread is started, see signal_handler.
     signal(SIGSEGV, signalHandler);
-    signal(SIGTERM, signalHandler);
-    signal(SIGINT , signalHandler);
+    signal_handler::block({SIGTERM, SIGINT});
+    signal_handler sigterm_handler = signal_handler(SIGTERM, stop_iot);
+    signal_handler sigint_handler = signal_handler(SIGINT, stop_iot);
+    sigterm_handler.enable();
+    sigint_handler.enable();
 
     std::thread thread = std::thread(iot);
     thread.join();
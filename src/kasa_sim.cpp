@@ -0,0 +1,531 @@
+
+#include "modules/kasa_codec.hpp"
+#include <stdio.h>
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include <cerrno>
+#include <chrono>
+#include <vector>
+#include <queue>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Simulates a fleet of kasa devices on loopback. Every device has its own
+// address (127.0.0.0/8 is routed to lo on Linux), listens on the kasa port and
+// speaks the framed XOR protocol using kasa_codec. Devices are HS103 plugs,
+// HS110 plugs (with emeter) or HS220 dimmers, and keep their relay state and
+// brightness across requests.
+//
+// Everything runs on one epoll thread. Replies are queued with a due time so
+// that latency and jitter do not block other devices. Requests may be dropped
+// (no reply) or answered with a connection reset. Like real devices, the
+// simulator may close connections which stay idle.
+////////////////////////////////////////////////////////////////////////////////
+using hc = std::chrono::steady_clock;
+
+static volatile sig_atomic_t done = 0;
+
+void signalHandler(int) {
+    done = 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Device models
+////////////////////////////////////////////////////////////////////////////////
+static const int HS103 = 0;
+static const int HS110 = 1;
+static const int HS220 = 2;
+static const char* MODELS[] = {"HS103(US)", "HS110(US)", "HS220(US)"};
+
+struct device {
+    char addr[16];
+    int model;
+    int relay_state = 0;
+    int brightness = 100;
+    hc::time_point on_since;
+    double total_wh = 0;
+    hc::time_point total_since;
+    int load_mw;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// A client connection. Connections are indexed by fd; 'gen' tells a queued
+// reply whether the connection it was meant for is still the one on that fd.
+////////////////////////////////////////////////////////////////////////////////
+struct connection {
+    bool open = false;
+    unsigned gen = 0;
+    int dev = -1;
+    kasa_codec::decoder request;
+    std::vector<char> out;
+    size_t out_sent = 0;
+    hc::time_point last_active;
+};
+
+struct pending {
+    hc::time_point due;
+    int fd;
+    unsigned gen;
+    bool reset;
+    std::vector<char> reply;
+    bool operator<(const pending& other) const { return due > other.due; }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Settings and counters
+////////////////////////////////////////////////////////////////////////////////
+static int latency_ms = 5, jitter_ms = 0, idle_s = 0;
+static double drop_pct = 0, reset_pct = 0;
+static unsigned seed = 1;
+static bool verbose = false;
+
+static long accepted = 0, requests = 0, replies = 0, drops = 0, resets = 0,
+    errors = 0, idle_closes = 0;
+
+static int epoll_fd;
+static std::vector<device> devices;
+static std::vector<int> listeners;
+static std::vector<connection> conns;
+static std::priority_queue<pending> queue;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+bool chance(double pct) {
+    return pct > 0 && (rand_r(&seed) % 1000000) < pct * 10000;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Build the reply to a decoded request. Only the modules named in the request
+// are answered, as the real devices do.
+////////////////////////////////////////////////////////////////////////////////
+int build_reply(device* d, const char* req, char* out, int out_len) {
+    hc::time_point now = hc::now();
+
+    // Accumulate energy at the current draw.
+    int power_mw = d->relay_state ? d->load_mw : 0;
+    if (d->model == HS220) power_mw = power_mw * d->brightness / 100;
+    d->total_wh += power_mw / 1000.0 *
+        std::chrono::duration<double>(now - d->total_since).count() / 3600;
+    d->total_since = now;
+
+    const char* set_state = strstr(req, "\"set_relay_state\"");
+    if (set_state) {
+        const char* s = strstr(set_state, "\"state\":");
+        int state = s ? atoi(s + 8) : d->relay_state;
+        if (state != d->relay_state) {
+            d->relay_state = state ? 1 : 0;
+            d->on_since = now;
+        }
+    }
+    const char* set_brightness = strstr(req, "\"set_brightness\"");
+    if (set_brightness && d->model == HS220) {
+        const char* s = strstr(set_brightness, "\"brightness\":");
+        if (s) d->brightness = std::max(1, std::min(100, atoi(s + 13)));
+    }
+
+    int len = snprintf(out, out_len, "{");
+    if (strstr(req, "\"emeter\"")) {
+        if (d->model == HS110) {
+            power_mw = d->relay_state ? d->load_mw + rand_r(&seed) % 200 : 0;
+            len += snprintf(out + len, out_len - len,
+                "\"emeter\":{\"get_realtime\":{\"voltage_mv\":%d,"
+                "\"current_ma\":%d,\"power_mw\":%d,\"total_wh\":%d,"
+                "\"err_code\":0}},", 120000 + rand_r(&seed) % 1000,
+                power_mw / 120, power_mw, (int)d->total_wh);
+        } else {
+            len += snprintf(out + len, out_len - len,
+                "\"emeter\":{\"err_code\":-1,\"err_msg\":\"module not support\"},");
+        }
+    }
+    if (set_brightness) {
+        if (d->model == HS220) {
+            len += snprintf(out + len, out_len - len,
+                "\"smartlife.iot.dimmer\":{\"set_brightness\":{\"err_code\":0}},");
+        } else {
+            len += snprintf(out + len, out_len - len,
+                "\"smartlife.iot.dimmer\":{\"err_code\":-1,"
+                "\"err_msg\":\"module not support\"},");
+        }
+    }
+    if (strstr(req, "\"system\"")) {
+        len += snprintf(out + len, out_len - len, "\"system\":{");
+        if (set_state)
+            len += snprintf(out + len, out_len - len,
+                "\"set_relay_state\":{\"err_code\":0},");
+        if (strstr(req, "\"get_sysinfo\"")) {
+            int on_time = d->relay_state ? std::chrono::duration_cast<
+                std::chrono::seconds>(now - d->on_since).count() : 0;
+            len += snprintf(out + len, out_len - len,
+                "\"get_sysinfo\":{\"sw_ver\":\"1.0.0 Build 000000 Rel.000000\","
+                "\"hw_ver\":\"1.0\",\"model\":\"%s\",\"alias\":\"sim %s\","
+                "\"dev_name\":\"Simulated device\",\"relay_state\":%d,"
+                "\"on_time\":%d,", MODELS[d->model], d->addr, d->relay_state,
+                on_time);
+            if (d->model == HS220)
+                len += snprintf(out + len, out_len - len,
+                    "\"brightness\":%d,\"preferred_state\":[{\"index\":0,"
+                    "\"brightness\":100},{\"index\":1,\"brightness\":50}],",
+                    d->brightness);
+            len += snprintf(out + len, out_len - len,
+                "\"led_off\":0,\"rssi\":%d,\"err_code\":0},",
+                -40 - (int)(rand_r(&seed) % 30));
+        }
+        if (out[len-1] == ',') len--;
+        len += snprintf(out + len, out_len - len, "},");
+    }
+    if (len > 1 && out[len-1] == ',') len--;
+    len += snprintf(out + len, out_len - len, "}");
+    return std::min(len, out_len - 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void close_conn(int fd, bool reset) {
+    if (reset) {
+        struct linger l = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+    }
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    conns[fd].open = false;
+    conns[fd].gen++;
+    conns[fd].out.clear();
+    conns[fd].out_sent = 0;
+}
+
+void flush_conn(int fd) {
+    connection& c = conns[fd];
+    while (c.out_sent < c.out.size()) {
+        int n = send(fd, c.out.data() + c.out_sent, c.out.size() - c.out_sent,
+            MSG_NOSIGNAL);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT, .data = {.u64 = (uint64_t)fd}};
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+            return;
+        }
+        if (n <= 0) {
+            errors++;
+            close_conn(fd, false);
+            return;
+        }
+        c.out_sent += n;
+    }
+    c.out.clear();
+    c.out_sent = 0;
+    struct epoll_event ev = {.events = EPOLLIN, .data = {.u64 = (uint64_t)fd}};
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// A complete request has arrived on 'fd'.
+////////////////////////////////////////////////////////////////////////////////
+void on_request(int fd) {
+    connection& c = conns[fd];
+    c.last_active = hc::now();
+    requests++;
+    if (verbose)
+        printf("%s <- %s\n", devices[c.dev].addr, c.request.c_str());
+
+    if (chance(drop_pct)) {
+        drops++;
+        return;
+    }
+
+    pending p;
+    p.fd = fd;
+    p.gen = c.gen;
+    p.reset = chance(reset_pct);
+    int delay_us = latency_ms * 1000;
+    if (jitter_ms > 0) delay_us += rand_r(&seed) % (jitter_ms * 1000);
+    p.due = hc::now() + std::chrono::microseconds(delay_us);
+    if (!p.reset) {
+        char text[4096];
+        int len = build_reply(&devices[c.dev], c.request.c_str(), text,
+            sizeof(text));
+        if (verbose) printf("%s -> %s\n", devices[c.dev].addr, text);
+        p.reply.resize(kasa_codec::encoded_size(len));
+        kasa_codec::encode(text, len, p.reply.data());
+    }
+    queue.push(std::move(p));
+}
+
+void on_readable(int fd) {
+    connection& c = conns[fd];
+    char buf[4096];
+    while (c.open) {
+        int n = recv(fd, buf, sizeof(buf), 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n <= 0) {
+            close_conn(fd, false);
+            return;
+        }
+        // More than one request may arrive in a single read.
+        int pos = 0;
+        while (pos < n) {
+            pos += c.request.feed(buf + pos, n - pos);
+            if (c.request.error()) {
+                errors++;
+                close_conn(fd, true);
+                return;
+            }
+            if (c.request.complete()) {
+                on_request(fd);
+                c.request.reset();
+            }
+        }
+    }
+}
+
+void on_accept(int listener, int dev) {
+    while (true) {
+        int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) errors++;
+            return;
+        }
+        accepted++;
+        if ((size_t)fd >= conns.size()) conns.resize(fd + 1024);
+        connection& c = conns[fd];
+        c.open = true;
+        c.dev = dev;
+        c.last_active = hc::now();
+        c.request.reset();
+        struct epoll_event ev = {.events = EPOLLIN, .data = {.u64 = (uint64_t)fd}};
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Send every reply which is due. Returns the epoll timeout until the next.
+////////////////////////////////////////////////////////////////////////////////
+int send_due() {
+    hc::time_point now = hc::now();
+    while (!queue.empty() && queue.top().due <= now) {
+        const pending& p = queue.top();
+        connection& c = conns[p.fd];
+        if (c.open && c.gen == p.gen) {
+            if (p.reset) {
+                resets++;
+                close_conn(p.fd, true);
+            } else {
+                replies++;
+                c.last_active = now;
+                c.out.insert(c.out.end(), p.reply.begin(), p.reply.end());
+                flush_conn(p.fd);
+            }
+        }
+        queue.pop();
+    }
+    if (queue.empty()) return 1000;
+    return std::chrono::ceil<std::chrono::milliseconds>(queue.top().due - now).count();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Close connections which have been idle for idle_s, with nothing queued.
+////////////////////////////////////////////////////////////////////////////////
+void close_idle() {
+    hc::time_point limit = hc::now() - std::chrono::seconds(idle_s);
+    for (size_t fd = 0; fd < conns.size(); fd++) {
+        connection& c = conns[fd];
+        if (c.open && c.out.empty() && c.last_active < limit) {
+            idle_closes++;
+            close_conn(fd, false);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void print_stats() {
+    printf("devices=%zu accepted=%ld requests=%ld replies=%ld drops=%ld "
+        "resets=%ld idle_closes=%ld errors=%ld\n", devices.size(), accepted,
+        requests, replies, drops, resets, idle_closes, errors);
+    fflush(stdout);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char *argv[]) {
+    char first_addr[64], mix[16];
+    strncpy(first_addr, "127.0.1.1", 64);
+    strncpy(mix, "mix", 16);
+    int count = 1, port = 9999, stats_interval = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-a") && (argc > i + 1)) {
+            strncpy(first_addr, argv[i+1], 64);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-n") && (argc > i + 1)) {
+            count = atoi(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-p") && (argc > i + 1)) {
+            port = atoi(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-m") && (argc > i + 1)) {
+            strncpy(mix, argv[i+1], 16);
+            mix[15] = '\0';
+            i++;
+        }
+        else if (!strcmp(argv[i], "-L") && (argc > i + 1)) {
+            latency_ms = atoi(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-J") && (argc > i + 1)) {
+            jitter_ms = atoi(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-D") && (argc > i + 1)) {
+            drop_pct = atof(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-R") && (argc > i + 1)) {
+            reset_pct = atof(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-I") && (argc > i + 1)) {
+            idle_s = atoi(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-s") && (argc > i + 1)) {
+            seed = atoi(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-i") && (argc > i + 1)) {
+            stats_interval = atoi(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-v")) {
+            verbose = true;
+        }
+        else {
+            printf("./bin/kasa_sim simulates kasa devices on loopback addresses.\n");
+            printf("Device n listens on <addr>+n. Stop with SIGINT or SIGTERM.\n");
+            printf("\n");
+            printf("Options are:\n");
+            printf("\n");
+            printf("  -a <addr> : first device address (default 127.0.1.1).\n");
+            printf("  -n <number> : number of devices (default 1).\n");
+            printf("  -p <port> : port (default 9999).\n");
+            printf("  -m <model> : plug (HS103), emeter (HS110), dimmer (HS220) or\n");
+            printf("    mix (default), which cycles through all three.\n");
+            printf("  -L <ms> : reply latency (default 5).\n");
+            printf("  -J <ms> : extra random latency, up to this (default 0).\n");
+            printf("  -D <percent> : requests dropped without a reply (default 0).\n");
+            printf("  -R <percent> : requests answered with a connection reset\n");
+            printf("    (default 0).\n");
+            printf("  -I <seconds> : close connections idle this long (default 0,\n");
+            printf("    never).\n");
+            printf("  -s <number> : random seed (default 1).\n");
+            printf("  -i <seconds> : print counters at this interval (default 0, off).\n");
+            printf("    Counters are always printed on exit.\n");
+            printf("  -v : print every request and reply.\n");
+            printf("\n");
+            return 1;
+        }
+    }
+
+    struct in_addr base;
+    if (!inet_pton(AF_INET, first_addr, &base) || count < 1) {
+        printf("Invalid address or count.\n");
+        return 1;
+    }
+    int model = -1;
+    if (!strcmp(mix, "plug")) model = HS103;
+    else if (!strcmp(mix, "emeter")) model = HS110;
+    else if (!strcmp(mix, "dimmer")) model = HS220;
+    else if (strcmp(mix, "mix")) {
+        printf("Unknown model '%s'.\n", mix);
+        return 1;
+    }
+
+    // One listener per device plus its client connections.
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    hc::time_point now = hc::now();
+    devices.resize(count);
+    for (int i = 0; i < count; i++) {
+        device& d = devices[i];
+        struct sockaddr_in sock_addr = {};
+        sock_addr.sin_family = AF_INET;
+        sock_addr.sin_port = htons(port);
+        sock_addr.sin_addr.s_addr = htonl(ntohl(base.s_addr) + i);
+        inet_ntop(AF_INET, &sock_addr.sin_addr, d.addr, sizeof(d.addr));
+        d.model = (model == -1) ? i % 3 : model;
+        d.on_since = d.total_since = now;
+        d.load_mw = 5000 + rand_r(&seed) % 100000;
+        d.total_wh = rand_r(&seed) % 10000;
+
+        int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int one = 1;
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (sock < 0 || bind(sock, (struct sockaddr*)&sock_addr, sizeof(sock_addr)) ||
+                listen(sock, 128)) {
+            printf("Failed to listen on %s:%d (%s).\n", d.addr, port,
+                strerror(errno));
+            return 1;
+        }
+        listeners.push_back(sock);
+        // Listener events carry the device index, offset past any fd.
+        struct epoll_event ev = {.events = EPOLLIN, .data = {.u64 = (1ull << 32) | i}};
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &ev);
+    }
+    printf("Simulating %d device(s) on %s-%s port %d.\n", count,
+        devices.front().addr, devices.back().addr, port);
+    fflush(stdout);
+
+    signal(SIGTERM, signalHandler);
+    signal(SIGINT , signalHandler);
+
+    hc::time_point next_stats = hc::now() + std::chrono::seconds(stats_interval);
+    hc::time_point next_idle_check = hc::now();
+    struct epoll_event events[256];
+    while (!done) {
+        int timeout = send_due();
+        if (stats_interval > 0) {
+            if (hc::now() >= next_stats) {
+                print_stats();
+                next_stats += std::chrono::seconds(stats_interval);
+            }
+            timeout = std::min(timeout, (int)std::chrono::ceil<
+                std::chrono::milliseconds>(next_stats - hc::now()).count());
+        }
+        if (idle_s > 0) {
+            if (hc::now() >= next_idle_check) {
+                close_idle();
+                next_idle_check = hc::now() + std::chrono::milliseconds(100);
+            }
+            timeout = std::min(timeout, 100);
+        }
+        int n = epoll_wait(epoll_fd, events, 256, std::max(timeout, 0));
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.u64 >> 32) {
+                int dev = events[i].data.u64 & 0xffffffff;
+                on_accept(listeners[dev], dev);
+                continue;
+            }
+            int fd = events[i].data.u64;
+            if (!conns[fd].open) continue;
+            if (events[i].events & EPOLLOUT) flush_conn(fd);
+            if (conns[fd].open && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+                on_readable(fd);
+        }
+    }
+
+    print_stats();
+    return 0;
+}
@@ -0,0 +1,166 @@
+
+#include "checkpoint.hpp"
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// File layout (native byte order, it never leaves the machine):
+//   magic[8], record count, FNV-1a of everything after the header
+//   records: uint32 name length, uint32 value count, name bytes, int64 values
+////////////////////////////////////////////////////////////////////////////////
+static const char MAGIC[8] = {'I', 'O', 'T', 'S', 'T', 'A', '0', '1'};
+static const int SAVE_INTERVAL = 60;
+static const int MAX_VALUES = 64;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+static uint64_t fnv1a(const char* data, size_t len) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+checkpoint& checkpoint::get() {
+    static checkpoint* c = new checkpoint();
+    return *c;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// The whole file is read at once and only parsed if the checksum matches.
+////////////////////////////////////////////////////////////////////////////////
+void checkpoint::load() {
+    loaded = true;
+    records.clear();
+    char path[272];
+    snprintf(path, sizeof(path), "%s.state", log_file);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return;
+    struct stat st;
+    std::vector<char> buf;
+    if (!fstat(fd, &st)) {
+        buf.resize(st.st_size);
+        if (pread(fd, buf.data(), buf.size(), 0) != (ssize_t)buf.size())
+            buf.clear();
+    }
+    close(fd);
+
+    uint64_t header[2];
+    size_t hsize = sizeof(MAGIC) + sizeof(header);
+    if (buf.size() < hsize || memcmp(buf.data(), MAGIC, 8)) return;
+    memcpy(header, buf.data() + 8, sizeof(header));
+    if (fnv1a(buf.data() + hsize, buf.size() - hsize) != header[1]) return;
+
+    const char* p = buf.data() + hsize;
+    const char* end = buf.data() + buf.size();
+    for (uint64_t i = 0; i < header[0]; i++) {
+        uint32_t len[2];
+        if (end - p < (ptrdiff_t)sizeof(len)) break;
+        memcpy(len, p, sizeof(len));
+        p += sizeof(len);
+        if (len[1] > MAX_VALUES ||
+                end - p < (ptrdiff_t)(len[0] + len[1] * sizeof(int64_t))) break;
+        std::vector<int64_t>& values = records[std::string(p, len[0])];
+        p += len[0];
+        values.resize(len[1]);
+        if (len[1]) memcpy(values.data(), p, len[1] * sizeof(int64_t));
+        p += len[1] * sizeof(int64_t);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Write, sync, then rename so that a crash never leaves a partial snapshot.
+////////////////////////////////////////////////////////////////////////////////
+void checkpoint::write() {
+    char path[272], tmp_path[280];
+    snprintf(path, sizeof(path), "%s.state", log_file);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.state.tmp", log_file);
+
+    uint64_t header[2] = {records.size(), 0};
+    std::vector<char> buf(sizeof(MAGIC) + sizeof(header));
+    for (auto it = records.begin(); it != records.end(); it++) {
+        uint32_t len[2] = {(uint32_t)it->first.size(),
+            (uint32_t)it->second.size()};
+        buf.insert(buf.end(), (char*)len, (char*)len + sizeof(len));
+        buf.insert(buf.end(), it->first.begin(), it->first.end());
+        buf.insert(buf.end(), (char*)it->second.data(),
+            (char*)(it->second.data() + it->second.size()));
+    }
+    size_t hsize = sizeof(MAGIC) + sizeof(header);
+    header[1] = fnv1a(buf.data() + hsize, buf.size() - hsize);
+    memcpy(buf.data(), MAGIC, 8);
+    memcpy(buf.data() + 8, header, sizeof(header));
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) return;
+    bool ok = ::write(fd, buf.data(), buf.size()) == (ssize_t)buf.size() &&
+        !fsync(fd);
+    ok = (close(fd) == 0) && ok;
+    if (ok && !rename(tmp_path, path)) {
+        dirty = false;
+        last_save = ::time(nullptr);
+    } else {
+        unlink(tmp_path);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void checkpoint::set_log_file(const char* log_file) {
+    std::unique_lock<std::mutex> lck(mtx);
+    if (loaded && dirty && this->log_file[0]) write();
+    records.clear();
+    loaded = dirty = false;
+    strncpy(this->log_file, log_file, 256);
+    this->log_file[255] = '\0';
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+bool checkpoint::lookup(const char* name, int64_t* values, int count) {
+    std::unique_lock<std::mutex> lck(mtx);
+    if (!log_file[0]) return false;
+    if (!loaded) load();
+    auto it = records.find(name);
+    if (it == records.end() || (int)it->second.size() != count) return false;
+    memcpy(values, it->second.data(), count * sizeof(int64_t));
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void checkpoint::store(const char* name, const int64_t* values, int count) {
+    if (count > MAX_VALUES) return;
+    std::unique_lock<std::mutex> lck(mtx);
+    if (!log_file[0]) return;
+    if (!loaded) load();
+    std::vector<int64_t>& v = records[name];
+    if ((int)v.size() == count && !memcmp(v.data(), values, count * sizeof(int64_t)))
+        return;
+    v.assign(values, values + count);
+    dirty = true;
+    lck.unlock();
+    save(false);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void checkpoint::save(bool force) {
+    std::unique_lock<std::mutex> lck(mtx);
+    if (!loaded || !dirty) return;
+    if (!force && ::time(nullptr) - last_save < SAVE_INTERVAL) return;
+    write();
+}
@@ -0,0 +1,72 @@
+
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <ctime>
+#include <cstdint>
+
+////////////////////////////////////////////////////////////////////////////////
+// Keeps a small binary snapshot of module state, so that a restart does not
+// have to rebuild it from the log. Each unit stores a few integers under its
+// name. The snapshot is held in memory and persisted next to the log as
+// "<log file>.state".
+//
+// The file is loaded in one read on first use. Saving writes the whole
+// snapshot to a temporary file, syncs it and renames it over the old one, so
+// a crash leaves either the old or the new snapshot. A checksum guards against
+// anything else; a damaged file is ignored and callers fall back to the log.
+////////////////////////////////////////////////////////////////////////////////
+class checkpoint {
+private:
+    ////////////////////////////////////////////////////////////////////////////
+    // All state is protected by mtx.
+    ////////////////////////////////////////////////////////////////////////////
+    std::mutex mtx;
+    char log_file[256] = "";
+    bool loaded = false, dirty = false;
+    std::unordered_map<std::string, std::vector<int64_t>> records;
+    time_t last_save = 0;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Helpers - all require mtx to be held.
+    ////////////////////////////////////////////////////////////////////////////
+    void load();
+    void write();
+
+    checkpoint() {}
+
+public:
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    static checkpoint& get();
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Switch to another log file. The snapshot for the old one is saved.
+    ////////////////////////////////////////////////////////////////////////////
+    void set_log_file(const char* log_file);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // lookup() copies the values stored under 'name'. Returns false if there
+    // are none, or if they were stored with a different count (for example
+    // by an older build).
+    ////////////////////////////////////////////////////////////////////////////
+    bool lookup(const char* name, int64_t* values, int count);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Replaces the values stored under 'name' in memory and calls save(false).
+    ////////////////////////////////////////////////////////////////////////////
+    void store(const char* name, const int64_t* values, int count);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Writes the snapshot if it changed. With 'force' false, this is rate
+    // limited so that modules can call it after every sync().
+    ////////////////////////////////////////////////////////////////////////////
+    void save(bool force);
+};
+
+#endif
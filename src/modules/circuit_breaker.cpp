@@ -0,0 +1,108 @@
+
+#include "circuit_breaker.hpp"
+#include <algorithm>
+#include <cstring>
+
+////////////////////////////////////////////////////////////////////////////////
+// Subnet breakers back off less than a device does, since a probe costs the
+// same but a gateway coming back brings every device behind it back.
+////////////////////////////////////////////////////////////////////////////////
+static const int SUBNET_MIN_BACKOFF = 10;
+static const int SUBNET_MAX_BACKOFF = 60;
+
+std::mutex circuit_breaker::subnets_mtx;
+std::map<std::string, circuit_breaker*> circuit_breaker::subnets;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+circuit_breaker::circuit_breaker(int threshold, int min_backoff, int max_backoff) :
+        threshold(threshold), min_backoff(min_backoff), max_backoff(max_backoff) {
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void circuit_breaker::open(time_point now) {
+    backoff = (state == CLOSED) ? min_backoff : std::min(2 * backoff, max_backoff);
+    state = OPEN;
+    retry_at = now + backoff;
+    failed.clear();
+    probed.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+bool circuit_breaker::allow(time_point now, const void* member) {
+    std::unique_lock<std::mutex> lck(mtx);
+    if (state == OPEN) {
+        if (now < retry_at) return false;
+        state = HALF_OPEN;
+    }
+    if (state == HALF_OPEN && !members.empty())
+        return probed.insert(member).second;
+    return true;
+}
+
+void circuit_breaker::success(const void*) {
+    std::unique_lock<std::mutex> lck(mtx);
+    state = CLOSED;
+    failures = 0;
+    failed.clear();
+    probed.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// A half open subnet breaker only opens again once every member's probe
+// failed.
+////////////////////////////////////////////////////////////////////////////////
+void circuit_breaker::failure(time_point now, const void* member) {
+    std::unique_lock<std::mutex> lck(mtx);
+    if (members.empty()) {
+        failures++;
+        if (state == HALF_OPEN || (state == CLOSED && failures >= threshold))
+            open(now);
+        return;
+    }
+    if (state == OPEN) return;
+    failed.insert(member);
+    if (members.size() >= 2 && failed.size() >= members.size())
+        open(now);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+int circuit_breaker::get_state() {
+    std::unique_lock<std::mutex> lck(mtx);
+    return state;
+}
+
+circuit_breaker::time_point circuit_breaker::get_retry_at() {
+    std::unique_lock<std::mutex> lck(mtx);
+    return retry_at;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+circuit_breaker* circuit_breaker::subnet(const char* addr, const void* member) {
+    std::string key(addr);
+    size_t dot = key.rfind('.');
+    if (dot != std::string::npos) key.erase(dot);
+    std::unique_lock<std::mutex> lck(subnets_mtx);
+    circuit_breaker*& cb = subnets[key];
+    if (!cb) cb = new circuit_breaker(1, SUBNET_MIN_BACKOFF, SUBNET_MAX_BACKOFF);
+    lck.unlock();
+    std::unique_lock<std::mutex> cb_lck(cb->mtx);
+    cb->members.insert(member);
+    return cb;
+}
+
+void circuit_breaker::leave(const void* member) {
+    std::unique_lock<std::mutex> lck(mtx);
+    members.erase(member);
+    failed.erase(member);
+    probed.erase(member);
+}
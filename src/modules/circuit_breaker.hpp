@@ -0,0 +1,101 @@
+
+#ifndef _CIRCUIT_BREAKER_H_
+#define _CIRCUIT_BREAKER_H_
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+
+////////////////////////////////////////////////////////////////////////////////
+// Stops a module from probing something which does not answer.
+//
+// CLOSED: every request goes out. After 'threshold' failures in a row the
+// breaker opens.
+// OPEN: nothing goes out until the backoff has passed. The backoff starts at
+// 'min_backoff' and doubles every time the breaker opens again, up to
+// 'max_backoff'.
+// HALF_OPEN: requests go out again as probes. A success closes the breaker
+// and resets the backoff, a failure opens it again.
+//
+// A subnet breaker is shared by every module probing addresses in the same
+// /24, and counts each member once. It opens when every member failed since
+// the last success from any of them, which is what an unreachable gateway
+// looks like, and every member gets one probe when it is half open. A single
+// dead device never opens it while its neighbours answer.
+////////////////////////////////////////////////////////////////////////////////
+class circuit_breaker {
+public:
+    using sc = std::chrono::system_clock;
+    using duration = std::chrono::seconds;
+    using time_point = std::chrono::time_point<sc, duration>;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Constants - Breaker States
+    ////////////////////////////////////////////////////////////////////////////
+    static inline const int CLOSED = 0;
+    static inline const int OPEN = 1;
+    static inline const int HALF_OPEN = 2;
+    static inline const char* const STATES[] = {"CLOSED", "OPEN", "HALF_OPEN"};
+
+private:
+    ////////////////////////////////////////////////////////////////////////////
+    // Configuration - only written by the constructor.
+    ////////////////////////////////////////////////////////////////////////////
+    int threshold;
+    duration min_backoff, max_backoff;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // State - protected by mtx.
+    ////////////////////////////////////////////////////////////////////////////
+    std::mutex mtx;
+    int state = CLOSED;
+    int failures = 0;
+    duration backoff{0};
+    time_point retry_at;
+    std::set<const void*> members, failed, probed;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Requires mtx to be held.
+    ////////////////////////////////////////////////////////////////////////////
+    void open(time_point now);
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    static std::mutex subnets_mtx;
+    static std::map<std::string, circuit_breaker*> subnets;
+
+public:
+    ////////////////////////////////////////////////////////////////////////////
+    // Backoffs are in seconds.
+    ////////////////////////////////////////////////////////////////////////////
+    circuit_breaker(int threshold = 3, int min_backoff = 10, int max_backoff = 300);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // allow() returns whether a request may go out now, and moves an OPEN
+    // breaker whose backoff has passed to HALF_OPEN. Every allowed request
+    // must be followed by success() or failure(). 'member' is only used by
+    // subnet breakers.
+    ////////////////////////////////////////////////////////////////////////////
+    bool allow(time_point now, const void* member = nullptr);
+    void success(const void* member = nullptr);
+    void failure(time_point now, const void* member = nullptr);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // The state, and when an OPEN breaker lets the next probe out.
+    ////////////////////////////////////////////////////////////////////////////
+    int get_state();
+    time_point get_retry_at();
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Returns the breaker shared by the /24 of the IPv4 address 'addr' and
+    // adds 'member' to it. Members leave before they are destroyed. The
+    // breakers themselves live as long as the process.
+    ////////////////////////////////////////////////////////////////////////////
+    static circuit_breaker* subnet(const char* addr, const void* member);
+    void leave(const void* member);
+};
+
+#endif
@@ -0,0 +1,355 @@
+
+#include "dhcp_leases.hpp"
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+static const int BUF_SIZE = 1 << 16;
+static const int MAX_FIELDS = 32;
+
+static uint64_t fnv1a(const char* data, int len) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (int i = 0; i < len; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Hardware addresses and host names are lower case, host names without the
+// trailing dot, addresses as inet_ntop() prints them.
+////////////////////////////////////////////////////////////////////////////////
+static std::string normalize(const char* key, int len) {
+    char str[64];
+    len = std::min(len, 63);
+    for (int i = 0; i < len; i++) str[i] = tolower((unsigned char)key[i]);
+    if (len && str[len - 1] == '.') len--;
+    str[len] = '\0';
+    unsigned char addr[16];
+    char ip[INET6_ADDRSTRLEN];
+    if (inet_pton(AF_INET, str, addr) == 1)
+        return inet_ntop(AF_INET, addr, ip, sizeof(ip));
+    if (inet_pton(AF_INET6, str, addr) == 1)
+        return inet_ntop(AF_INET6, addr, ip, sizeof(ip));
+    return str;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+dhcp_leases::dhcp_leases(const char* name, const char* lease_file,
+        int update_frequency) : module(true, update_frequency) {
+    char name_full[64];
+    snprintf(name_full, 64, "DHCP LEASES [ %s ]", name);
+    set_name(name_full);
+    strncpy(this->lease_file, lease_file, 256);
+    this->lease_file[255] = '\0';
+    // inotify watches the directory, since the file itself gets replaced.
+    strncpy(dir, this->lease_file, 256);
+    char* slash = strrchr(dir, '/');
+    if (slash) {
+        strncpy(base, slash + 1, 256);
+        if (slash == dir) slash++;
+        *slash = '\0';
+    } else {
+        strncpy(base, dir, 256);
+        strncpy(dir, ".", 256);
+    }
+    handler.leases = this;
+    report("constructor done", 3);
+}
+
+dhcp_leases::~dhcp_leases() {
+    io_loop::get().remove(&handler);
+    if (inotify_fd != -1) close(inotify_fd);
+    if (fd != -1) close(fd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// The header names the columns, which differ between Kea versions and
+// between the DHCPv4 and DHCPv6 files, and which the lease file cleanup may
+// write in another order. Returns false if it has no address column.
+////////////////////////////////////////////////////////////////////////////////
+bool dhcp_leases::parse_header(const char** field, const int* field_len, int n) {
+    int address = -1, hwaddr = 1, valid = 3, expire = 4, hostname = 8, state = -1;
+    for (int i = 0; i < n; i++) {
+        std::string name(field[i], field_len[i]);
+        if (name == "address") address = i;
+        else if (name == "hwaddr") hwaddr = i;
+        else if (name == "valid_lifetime") valid = i;
+        else if (name == "expire") expire = i;
+        else if (name == "hostname") hostname = i;
+        else if (name == "state") state = i;
+    }
+    if (address < 0) return false;
+
+    // The same line means something else with other columns.
+    if (address != col_address || hwaddr != col_hwaddr || valid != col_valid ||
+            expire != col_expire || hostname != col_hostname || state != col_state) {
+        std::unique_lock<std::mutex> lck(mtx);
+        by_line_hash.clear();
+    }
+    col_address = address;
+    col_hwaddr = hwaddr;
+    col_valid = valid;
+    col_expire = expire;
+    col_hostname = hostname;
+    col_state = state;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// 'first' is set for the first line of the file, which is the header. A line
+// which a current lease was built from is only hashed, so rereading a
+// replaced file costs little.
+////////////////////////////////////////////////////////////////////////////////
+void dhcp_leases::parse_line(const char* line, int len, bool first,
+        std::vector<std::string>* changed) {
+    uint64_t hash = fnv1a(line, len);
+    if (!first) {
+        std::unique_lock<std::mutex> lck(mtx);
+        if (by_line_hash.count(hash)) return;
+    }
+
+    const char* field[MAX_FIELDS];
+    int field_len[MAX_FIELDS], n = 0;
+    for (const char* p = line, *end = line + len; n < MAX_FIELDS; n++) {
+        const char* comma = (const char*)memchr(p, ',', end - p);
+        field[n] = p;
+        field_len[n] = (comma ? comma : end) - p;
+        if (!comma) {
+            n++;
+            break;
+        }
+        p = comma + 1;
+    }
+
+    if (first && parse_header(field, field_len, n)) return;
+    if (n <= std::max({col_address, col_hwaddr, col_valid, col_expire, col_hostname}))
+        return;
+
+    std::string address = normalize(field[col_address], field_len[col_address]);
+    std::unique_lock<std::mutex> lck(mtx);
+    // A file without a header.
+    if (first && by_line_hash.count(hash)) return;
+    auto it = by_address.find(address);
+
+    lease l;
+    l.line_hash = hash;
+    strncpy(l.address, address.c_str(), sizeof(l.address));
+    l.address[sizeof(l.address) - 1] = '\0';
+    std::string hwaddr = normalize(field[col_hwaddr], std::min(field_len[col_hwaddr], 17));
+    strcpy(l.hwaddr, hwaddr.c_str());
+    std::string hostname = normalize(field[col_hostname], field_len[col_hostname]);
+    strcpy(l.hostname, hostname.c_str());
+    l.valid_lifetime = strtoll(std::string(field[col_valid], field_len[col_valid]).c_str(),
+        nullptr, 10);
+    l.expire = strtoll(std::string(field[col_expire], field_len[col_expire]).c_str(),
+        nullptr, 10);
+    l.cltt = l.expire - l.valid_lifetime;
+    if (col_state >= 0 && col_state < n)
+        l.state = atoi(std::string(field[col_state], field_len[col_state]).c_str());
+
+    bool added = it == by_address.end();
+    if (!added) {
+        lease& old = it->second;
+        if (strcmp(old.hwaddr, l.hwaddr)) {
+            auto h = by_hwaddr.find(old.hwaddr);
+            if (h != by_hwaddr.end() && h->second == address) by_hwaddr.erase(h);
+        }
+        if (strcmp(old.hostname, l.hostname)) {
+            auto h = by_hostname.find(old.hostname);
+            if (h != by_hostname.end() && h->second == address) by_hostname.erase(h);
+        }
+        auto h = by_line_hash.find(old.line_hash);
+        if (h != by_line_hash.end() && h->second == address) by_line_hash.erase(h);
+        changed->push_back(old.hwaddr);
+        changed->push_back(old.hostname);
+    }
+    by_line_hash[hash] = address;
+    if (l.hwaddr[0]) by_hwaddr[l.hwaddr] = address;
+    if (l.hostname[0]) by_hostname[l.hostname] = address;
+    by_address[address] = l;
+    lck.unlock();
+
+    changed->push_back(address);
+    changed->push_back(hwaddr);
+    changed->push_back(hostname);
+    char report_str[256];
+    snprintf(report_str, 256, "%s lease %s %s %s state %d expire %lld",
+        added ? "new" : "updated", l.address, l.hwaddr, l.hostname, l.state,
+        (long long)l.expire);
+    report(report_str, 5);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void dhcp_leases::notify(const std::vector<std::string>& changed) {
+    std::unique_lock<std::mutex> lck(subs_mtx);
+    for (const std::string& key : changed) {
+        if (key.empty()) continue;
+        auto range = subs.equal_range(key);
+        for (auto it = range.first; it != range.second; it++)
+            it->second->sync_now();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Called by sync() with file_mtx held. Reads whatever was appended since the
+// last call. A
+// different inode means the file was replaced, a shorter file that it was
+// truncated: both are read from the start.
+////////////////////////////////////////////////////////////////////////////////
+void dhcp_leases::read_new() {
+    if (inotify_fd == -1) {
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd == -1 || inotify_add_watch(inotify_fd, dir, IN_MODIFY |
+                IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO | IN_DELETE) == -1) {
+            report("Error: can not watch the lease file directory.", 0);
+        } else {
+            io_loop::get().watch(&handler, inotify_fd, EPOLLIN);
+        }
+    }
+
+    struct stat st;
+    if (stat(lease_file, &st)) return;  // between a move and a create
+    if (fd == -1 || st.st_ino != inode) {
+        if (fd != -1) close(fd);
+        fd = open(lease_file, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) return;
+        report(inode ? "lease file replaced" : "lease file opened", 3);
+        inode = st.st_ino;
+        offset = 0;
+        partial.clear();
+        header_due = true;
+    } else if (st.st_size < offset) {
+        report("lease file truncated", 3);
+        offset = 0;
+        partial.clear();
+        header_due = true;
+    }
+
+    std::vector<std::string> changed;
+    std::vector<char> buf(BUF_SIZE);
+    int lines = 0;
+    while (true) {
+        ssize_t n = pread(fd, buf.data(), buf.size(), offset);
+        if (n <= 0) break;
+        offset += n;
+        partial.append(buf.data(), n);
+        size_t start = 0;
+        while (true) {
+            size_t eol = partial.find('\n', start);
+            if (eol == std::string::npos) break;
+            size_t len = eol - start;
+            if (len && partial[eol - 1] == '\r') len--;
+            if (len) {
+                parse_line(partial.data() + start, len, header_due, &changed);
+                header_due = false;
+            }
+            lines++;
+            start = eol + 1;
+        }
+        partial.erase(0, start);
+    }
+
+    char report_str[128];
+    snprintf(report_str, 128, "read %d lines up to offset %lld", lines, (long long)offset);
+    report(report_str, 5);
+    notify(changed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Runs on the loop, so it only drains the events. The file is read by sync(),
+// on a worker.
+////////////////////////////////////////////////////////////////////////////////
+void dhcp_leases::on_readable() {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool relevant = false;
+    while (true) {
+        ssize_t n = read(inotify_fd, buf, sizeof(buf));
+        if (n <= 0) break;
+        for (char* p = buf; p < buf + n; ) {
+            const struct inotify_event* ev = (const struct inotify_event*)p;
+            if ((ev->mask & IN_Q_OVERFLOW) || (ev->len && !strcmp(ev->name, base)))
+                relevant = true;
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    if (relevant) sync_now();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void dhcp_leases::sync(bool last) {
+    if (last) {
+        io_loop::get().remove(&handler);
+        std::unique_lock<std::mutex> lck(file_mtx);
+        if (inotify_fd != -1) close(inotify_fd);
+        if (fd != -1) close(fd);
+        inotify_fd = fd = -1;
+        inode = 0;
+        return;
+    }
+    std::unique_lock<std::mutex> lck(file_mtx);
+    read_new();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+bool dhcp_leases::get_lease(const char* key, lease* l) {
+    std::string k = normalize(key, strlen(key));
+    std::unique_lock<std::mutex> lck(mtx);
+    auto it = by_address.find(k);
+    if (it == by_address.end()) {
+        auto h = by_hwaddr.find(k);
+        if (h != by_hwaddr.end()) {
+            it = by_address.find(h->second);
+        } else {
+            h = by_hostname.find(k);
+            if (h == by_hostname.end()) return false;
+            it = by_address.find(h->second);
+        }
+        if (it == by_address.end()) return false;
+    }
+    *l = it->second;
+    return true;
+}
+
+int dhcp_leases::lease_count() {
+    std::unique_lock<std::mutex> lck(mtx);
+    return by_address.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void dhcp_leases::subscribe(const char* key, module* m) {
+    std::unique_lock<std::mutex> lck(subs_mtx);
+    subs.insert({normalize(key, strlen(key)), m});
+}
+
+void dhcp_leases::unsubscribe(const char* key, module* m) {
+    std::string k = normalize(key, strlen(key));
+    std::unique_lock<std::mutex> lck(subs_mtx);
+    auto range = subs.equal_range(k);
+    for (auto it = range.first; it != range.second; it++) {
+        if (it->second == m) {
+            subs.erase(it);
+            return;
+        }
+    }
+}
@@ -0,0 +1,128 @@
+
+#ifndef _DHCP_LEASES_H_
+#define _DHCP_LEASES_H_
+
+#include "module.hpp"
+#include "io_loop.hpp"
+#include <string>
+#include <unordered_map>
+#include <sys/types.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Follows the CSV lease file of a Kea DHCP server (memfile backend). Kea only
+// ever appends to the file, so the file is tailed with inotify and only the
+// lines appended since the last read are parsed.
+//
+// Kea's lease file cleanup moves the file away and starts a new, small one.
+// When the file is replaced, the new one is read from the start, but a line
+// which is identical to the one a lease was last built from only costs a
+// hash and a lookup: the lease is not rebuilt and nobody is notified.
+//
+// Leases are keyed by address, with indexes from hardware address and from
+// host name. Modules subscribe to a single key and are synced when that lease
+// changes.
+////////////////////////////////////////////////////////////////////////////////
+class dhcp_leases : public module {
+public:
+    ////////////////////////////////////////////////////////////////////////////
+    // Times are unix times from the lease file. A lease in the default state
+    // (0) is active until 'expire'. Released, declined and reclaimed leases,
+    // and removed ones (valid lifetime 0), ended at 'cltt'.
+    ////////////////////////////////////////////////////////////////////////////
+    struct lease {
+        char address[46];
+        char hwaddr[18];
+        char hostname[64];
+        int64_t cltt = 0, expire = 0, valid_lifetime = 0;
+        int state = 0;
+        uint64_t line_hash = 0;
+    };
+
+private:
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    class file_handler : public io_loop::handler {
+    public:
+        dhcp_leases* leases;
+        void on_event(uint32_t) { leases->on_readable(); }
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Configuration - only written by the constructor.
+    ////////////////////////////////////////////////////////////////////////////
+    char lease_file[256], dir[256], base[256];
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Leases - protected by mtx.
+    ////////////////////////////////////////////////////////////////////////////
+    std::mutex mtx;
+    std::unordered_map<std::string, lease> by_address;
+    std::unordered_map<std::string, std::string> by_hwaddr, by_hostname;
+    // The hash of the line each lease was built from, so that a line which
+    // was seen before is found without splitting it.
+    std::unordered_map<uint64_t, std::string> by_line_hash;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // File state - protected by file_mtx. The file is read in sync(), off the
+    // loop: the loop only watches the directory.
+    ////////////////////////////////////////////////////////////////////////////
+    std::mutex file_mtx;
+    file_handler handler;
+    int inotify_fd = -1, fd = -1;
+    ino_t inode = 0;
+    off_t offset = 0;
+    std::string partial;
+    bool header_due = true;
+    int col_address = 0, col_hwaddr = 1, col_valid = 3, col_expire = 4,
+        col_hostname = 8, col_state = 9;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Subscriptions - protected by subs_mtx, which is held while notifying.
+    ////////////////////////////////////////////////////////////////////////////
+    std::mutex subs_mtx;
+    std::unordered_multimap<std::string, module*> subs;
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    void on_readable();
+    void read_new();
+    bool parse_header(const char** field, const int* field_len, int n);
+    void parse_line(const char* line, int len, bool first,
+        std::vector<std::string>* changed);
+    void notify(const std::vector<std::string>& changed);
+
+protected:
+    ////////////////////////////////////////////////////////////////////////////
+    // Reads what was appended to the file. Runs after inotify events, and on
+    // the timer in case some were lost.
+    ////////////////////////////////////////////////////////////////////////////
+    void sync(bool last = false);
+
+public:
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    dhcp_leases(const char* name, const char* lease_file, int update_frequency = 60);
+    ~dhcp_leases();
+
+    ////////////////////////////////////////////////////////////////////////////
+    // 'key' is an address, a hardware address ("aa:bb:cc:dd:ee:ff") or a host
+    // name. Returns false if no lease matches.
+    ////////////////////////////////////////////////////////////////////////////
+    bool get_lease(const char* key, lease* l);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Number of leases known, active or not.
+    ////////////////////////////////////////////////////////////////////////////
+    int lease_count();
+
+    ////////////////////////////////////////////////////////////////////////////
+    // 'm' is synced whenever the lease matching 'key' changes.
+    ////////////////////////////////////////////////////////////////////////////
+    void subscribe(const char* key, module* m);
+    void unsubscribe(const char* key, module* m);
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef _FUTEX_H_
+#define _FUTEX_H_
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Futex words in mapped files, shared between processes (so no
+// FUTEX_PRIVATE_FLAG).
+//
+// The writer stores the word and then loads the waiter count, the waiter
+// increments the count and then has the kernel compare the word. Both sides
+// use seq_cst, so either the writer sees the waiter or the waiter sees the
+// new word: no wake up is lost.
+////////////////////////////////////////////////////////////////////////////////
+class futex {
+public:
+    ////////////////////////////////////////////////////////////////////////////
+    // Blocks if '*word' equals 'val', until a wake() or for at most
+    // 'timeout_ms'. Returns whether '*word' differs from 'val'. Callers loop,
+    // since a wake() may be meant for somebody else.
+    ////////////////////////////////////////////////////////////////////////////
+    static bool wait(std::atomic<uint32_t>* word, std::atomic<uint32_t>* waiters,
+            uint32_t val, int timeout_ms) {
+        struct timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+        waiters->fetch_add(1, std::memory_order_seq_cst);
+        if (word->load(std::memory_order_seq_cst) == val)
+            syscall(SYS_futex, (uint32_t*)word, FUTEX_WAIT, val, &ts, nullptr, 0);
+        waiters->fetch_sub(1, std::memory_order_seq_cst);
+        return word->load(std::memory_order_seq_cst) != val;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Call after storing '*word' with seq_cst. Costs no system call while
+    // nobody waits.
+    ////////////////////////////////////////////////////////////////////////////
+    static void wake(std::atomic<uint32_t>* word, std::atomic<uint32_t>* waiters) {
+        if (waiters->load(std::memory_order_seq_cst))
+            syscall(SYS_futex, (uint32_t*)word, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+};
+
+#endif
@@ -2,73 +2,42 @@
 #include "icmp_helper.hpp"
 
 #include <arpa/inet.h>
-#include <netinet/in.h>
-#include <netinet/ip_icmp.h>
-#include <sys/socket.h>
-#include <poll.h>
-#include <fcntl.h>
-#include <errno.h>
-
-#include <unistd.h>
-
-#include <stdio.h>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <cstring>
-#include <cstdio>
-#include <cstdlib>
-#include <stdint.h>
-#include <time.h>
 
-#include <sys/types.h>
-#include <netdb.h>
-#include <stdlib.h>
-#include <string.h>
-
-uint16_t checksum(void *b, int len) {
-    uint16_t *buf = (uint16_t*)b;
-    uint32_t sum = 0;
+////////////////////////////////////////////////////////////////////////////////
+// Only the calling thread waits. The probe itself is in flight on the loop.
+////////////////////////////////////////////////////////////////////////////////
+bool icmp_helper::ping() {
+    struct waiter {
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool done = false, ok = false;
+    };
+    std::shared_ptr<waiter> w = std::make_shared<waiter>();
+    ping_async([w](bool ok, std::chrono::microseconds) {
+        std::unique_lock<std::mutex> lck(w->mtx);
+        w->done = true;
+        w->ok = ok;
+        w->cv.notify_all();
+    });
+    std::unique_lock<std::mutex> lck(w->mtx);
+    while (!w->done) w->cv.wait(lck);
+    return w->ok;
+}
 
-    for (; len > 1; len -= 2) sum += *buf++;
-    if ( len == 1 ) sum += *(uint8_t*)buf;
-    while (sum > 0xFFFF) sum = (sum >> 16) + (sum & 0xFFFF);
-    return (uint16_t)(~sum);
+void icmp_helper::ping_async(icmp_service::callback done) {
+    icmp_service::get().ping(in_addr, std::chrono::microseconds(time_limit),
+        std::move(done));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 ////////////////////////////////////////////////////////////////////////////////
-bool icmp_helper::ping() {
-
-    // SOCK_RAW may be needed on other systems.
-    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_ICMP);
-    if (sock <= 0) {
-        printf("ICMP Sock Error. sock: %d, errno: %d\n", sock, errno);
-    }
-
-    struct timeval tv_out = {.tv_usec = time_limit};
-    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv_out, sizeof tv_out);
-    int ttl_val = 8;
-    setsockopt(sock, SOL_IP, IP_TTL, &ttl_val, sizeof(ttl_val));
-
-    struct icmphdr pkt = {.type = ICMP_ECHO};
-    pkt.un.echo.id = htons(getpid() & 0xFFFF);
-    pkt.un.echo.sequence = seq_num++;
-    pkt.checksum = checksum(&pkt, sizeof(pkt));
-
-    struct sockaddr_in send_addr = {.sin_family = AF_INET}, recv_addr;
-    inet_pton(AF_INET, addr, &send_addr.sin_addr);
-
-    int res = sendto(sock, &pkt, sizeof(pkt), 0, (struct sockaddr*)&send_addr, sizeof(send_addr));
-
-    int addr_len = sizeof(recv_addr);
-    res = recvfrom(sock, &pkt, sizeof(pkt), 0,(struct sockaddr*)&recv_addr, (socklen_t *)&addr_len);
-
-    close(sock);
-
-    if (pkt.type == ICMP_ECHOREPLY) {
-        // The device was seen.
-        return true;
-    }
-    return false;
+bool icmp_helper::get_stats(icmp_service::stats* s) {
+    return icmp_service::get().get_stats(in_addr, s);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -76,10 +45,14 @@ bool icmp_helper::ping() {
 ////////////////////////////////////////////////////////////////////////////////
 icmp_helper::icmp_helper(char* addr, int time_limit) {
     strncpy(this->addr, addr, 64);
+    this->addr[63] = '\0';
+    inet_pton(AF_INET, this->addr, &in_addr);
     this->time_limit = time_limit;
 }
 
 icmp_helper::icmp_helper(const char* addr, int time_limit) {
     strncpy(this->addr, addr, 64);
+    this->addr[63] = '\0';
+    inet_pton(AF_INET, this->addr, &in_addr);
     this->time_limit = time_limit;
 }
@@ -2,9 +2,13 @@
 #ifndef _ICMP_HELPER_H_
 #define _ICMP_HELPER_H_
 
+#include "icmp_service.hpp"
+#include <cstdint>
+
 ////////////////////////////////////////////////////////////////////////////////
 // this module detects the presence of a device on the network using Internet
-// Control Message Protocol (ICMP) Echo requests and Responses (ping).
+// Control Message Protocol (ICMP) Echo requests and Responses (ping). Probes
+// are sent through the process-wide icmp_service.
 ////////////////////////////////////////////////////////////////////////////////
 class icmp_helper {
 private:
@@ -12,20 +16,27 @@ private:
     // Configuration - only written by the constructor.
     ////////////////////////////////////////////////////////////////////////////
     char addr[64];
-
-    ////////////////////////////////////////////////////////////////////////////
-    // IO context - A single connection is used multiple times.
-    ////////////////////////////////////////////////////////////////////////////
-    int seq_num = 1;
+    uint32_t in_addr = 0;
     int time_limit = 300;
 
 public:
     ////////////////////////////////////////////////////////////////////////////
-    //
+    // 'time_limit' is in microseconds.
     ////////////////////////////////////////////////////////////////////////////
     icmp_helper(char* addr, int time_limit = 100000);
     icmp_helper(const char* addr, int time_limit = 100000);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // ping() blocks until the reply or the time limit. ping_async() returns at
+    // once; see icmp_service::ping().
+    ////////////////////////////////////////////////////////////////////////////
     bool ping();
+    void ping_async(icmp_service::callback done);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Round trip statistics for this address. Returns false if never probed.
+    ////////////////////////////////////////////////////////////////////////////
+    bool get_stats(icmp_service::stats* s);
 };
 
 #endif
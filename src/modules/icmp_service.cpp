@@ -0,0 +1,217 @@
+
+#include "icmp_service.hpp"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip_icmp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+static uint16_t checksum(void *b, int len) {
+    uint16_t *buf = (uint16_t*)b;
+    uint32_t sum = 0;
+
+    for (; len > 1; len -= 2) sum += *buf++;
+    if ( len == 1 ) sum += *(uint8_t*)buf;
+    while (sum > 0xFFFF) sum = (sum >> 16) + (sum & 0xFFFF);
+    return (uint16_t)(~sum);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+icmp_service& icmp_service::get() {
+    static icmp_service* s = new icmp_service();
+    return *s;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// With SOCK_DGRAM the kernel owns the echo id: it is the port the socket is
+// bound to, and only replies carrying it are delivered to us.
+////////////////////////////////////////////////////////////////////////////////
+bool icmp_service::open_socket() {
+    sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_ICMP);
+    if (sock == -1) {
+        if (!sock_failed) printf("ICMP Sock Error. errno: %d\n", errno);
+        sock_failed = true;
+        return false;
+    }
+    int ttl_val = 8;
+    setsockopt(sock, SOL_IP, IP_TTL, &ttl_val, sizeof(ttl_val));
+    // Room for a burst of replies to hundreds of concurrent probes.
+    int rcvbuf = 1 << 20;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    struct sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    socklen_t len = sizeof(local);
+    if (bind(sock, (struct sockaddr*)&local, sizeof(local)) ||
+            getsockname(sock, (struct sockaddr*)&local, &len)) {
+        close(sock);
+        sock = -1;
+        return false;
+    }
+    ident = ntohs(local.sin_port);
+    sock_failed = false;
+    io_loop::get().watch(this, sock, EPOLLIN);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Entries for probes which already completed are dropped here rather than
+// searched for when the reply arrives.
+////////////////////////////////////////////////////////////////////////////////
+void icmp_service::arm_timer() {
+    while (!deadlines.empty()) {
+        auto it = pending.find(deadlines.top().seq);
+        if (it != pending.end() && it->second.id == deadlines.top().id) break;
+        deadlines.pop();
+    }
+    if (deadlines.empty()) io_loop::get().cancel_timer(this);
+    else io_loop::get().set_timer(this, deadlines.top().when);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Called from the requesting thread with the loop lock held. Sends every
+// queued request.
+////////////////////////////////////////////////////////////////////////////////
+void icmp_service::on_invoke() {
+    std::vector<callback> failed;
+    std::unique_lock<std::mutex> lck(mtx);
+    std::vector<request> batch;
+    batch.swap(queued);
+    if (sock == -1) open_socket();
+
+    for (request& r : batch) {
+        stats& s = targets[r.addr];
+        s.sent++;
+        if (sock == -1 || pending.size() >= 0xFFFF) {
+            failed.push_back(std::move(r.done));
+            continue;
+        }
+        uint16_t seq = next_seq++;
+        while (pending.count(seq)) seq = next_seq++;
+
+        struct icmphdr pkt = {};
+        pkt.type = ICMP_ECHO;
+        pkt.un.echo.id = htons(ident);
+        pkt.un.echo.sequence = htons(seq);
+        pkt.checksum = checksum(&pkt, sizeof(pkt));
+        struct sockaddr_in send_addr = {};
+        send_addr.sin_family = AF_INET;
+        send_addr.sin_addr.s_addr = r.addr;
+        clock::time_point now = clock::now();
+        if (sendto(sock, &pkt, sizeof(pkt), 0, (struct sockaddr*)&send_addr,
+                sizeof(send_addr)) != sizeof(pkt)) {
+            failed.push_back(std::move(r.done));
+            continue;
+        }
+        uint64_t id = next_id++;
+        pending[seq] = probe {id, r.addr, now, std::move(r.done)};
+        deadlines.push(deadline {now + r.timeout, id, seq});
+    }
+    arm_timer();
+    lck.unlock();
+
+    for (callback& c : failed) c(false, std::chrono::microseconds(0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void icmp_service::on_event(uint32_t) {
+    std::vector<std::pair<callback, std::chrono::microseconds>> replied;
+    std::unique_lock<std::mutex> lck(mtx);
+    clock::time_point now = clock::now();
+    char buf[1500];
+    while (true) {
+        struct sockaddr_in recv_addr;
+        socklen_t addr_len = sizeof(recv_addr);
+        ssize_t n = recvfrom(sock, buf, sizeof(buf), 0,
+            (struct sockaddr*)&recv_addr, &addr_len);
+        if (n < 0) break;
+        struct icmphdr pkt;
+        if (n < (ssize_t)sizeof(pkt)) continue;
+        memcpy(&pkt, buf, sizeof(pkt));
+        if (pkt.type != ICMP_ECHOREPLY || ntohs(pkt.un.echo.id) != ident)
+            continue;
+        auto it = pending.find(ntohs(pkt.un.echo.sequence));
+        if (it == pending.end() || it->second.addr != recv_addr.sin_addr.s_addr)
+            continue;
+
+        std::chrono::microseconds rtt =
+            std::chrono::duration_cast<std::chrono::microseconds>(now - it->second.sent);
+        stats& s = targets[it->second.addr];
+        if (!s.received) {
+            s.srtt = rtt;
+            s.rttvar = rtt / 2;
+        } else {
+            s.rttvar = (3 * s.rttvar + std::chrono::abs(s.srtt - rtt)) / 4;
+            s.srtt = (7 * s.srtt + rtt) / 8;
+        }
+        s.received++;
+        s.last_rtt = rtt;
+        replied.push_back({std::move(it->second.done), rtt});
+        pending.erase(it);
+    }
+    arm_timer();
+    lck.unlock();
+
+    for (auto& r : replied) r.first(true, r.second);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void icmp_service::on_timer() {
+    std::vector<callback> expired;
+    std::unique_lock<std::mutex> lck(mtx);
+    clock::time_point now = clock::now();
+    while (!deadlines.empty() && deadlines.top().when <= now) {
+        deadline d = deadlines.top();
+        deadlines.pop();
+        auto it = pending.find(d.seq);
+        if (it == pending.end() || it->second.id != d.id) continue;
+        targets[it->second.addr].timeouts++;
+        expired.push_back(std::move(it->second.done));
+        pending.erase(it);
+    }
+    arm_timer();
+    lck.unlock();
+
+    for (callback& c : expired) c(false, std::chrono::microseconds(0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void icmp_service::ping(uint32_t addr, std::chrono::microseconds timeout,
+        callback done) {
+    std::unique_lock<std::mutex> lck(mtx);
+    queued.push_back(request {addr, timeout, std::move(done)});
+    lck.unlock();
+    io_loop::get().invoke(this);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+bool icmp_service::get_stats(uint32_t addr, stats* s) {
+    std::unique_lock<std::mutex> lck(mtx);
+    auto it = targets.find(addr);
+    if (it == targets.end()) return false;
+    *s = it->second;
+    return true;
+}
+
+int icmp_service::in_flight() {
+    std::unique_lock<std::mutex> lck(mtx);
+    return pending.size();
+}
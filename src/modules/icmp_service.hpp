@@ -0,0 +1,120 @@
+
+#ifndef _ICMP_SERVICE_H_
+#define _ICMP_SERVICE_H_
+
+#include "io_loop.hpp"
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+////////////////////////////////////////////////////////////////////////////////
+// Every ICMP echo request in the process goes through one socket, driven from
+// the shared io_loop. Requests are tagged with the socket's echo id and a
+// sequence number; a reply only completes the probe whose id, sequence and
+// target address it matches. Timeouts are kept in a heap and the io_loop
+// timer is armed for the earliest one, so any number of probes can be in
+// flight without a thread or a socket each.
+//
+// Lock order: the io_loop lock, then mtx. Callbacks run with neither held
+// by this class, but on the loop thread, so they must not block.
+////////////////////////////////////////////////////////////////////////////////
+class icmp_service : public io_loop::handler {
+public:
+    using clock = io_loop::clock;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // 'ok' is true if a matching reply arrived before the timeout. 'rtt' is
+    // only meaningful if 'ok' is true.
+    ////////////////////////////////////////////////////////////////////////////
+    using callback = std::function<void(bool ok, std::chrono::microseconds rtt)>;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Per-target round trip statistics. srtt and rttvar are smoothed as in
+    // RFC 6298 (gains of 1/8 and 1/4).
+    ////////////////////////////////////////////////////////////////////////////
+    struct stats {
+        uint64_t sent = 0, received = 0, timeouts = 0;
+        std::chrono::microseconds last_rtt{0}, srtt{0}, rttvar{0};
+    };
+
+private:
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    struct request {
+        uint32_t addr;
+        std::chrono::microseconds timeout;
+        callback done;
+    };
+
+    struct probe {
+        uint64_t id;
+        uint32_t addr;
+        clock::time_point sent;
+        callback done;
+    };
+
+    struct deadline {
+        clock::time_point when;
+        uint64_t id;
+        uint16_t seq;
+        bool operator>(const deadline& d) const { return when > d.when; }
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Protected by mtx. The socket is only touched on the loop.
+    ////////////////////////////////////////////////////////////////////////////
+    std::mutex mtx;
+    int sock = -1;
+    bool sock_failed = false;
+    uint16_t ident = 0, next_seq = 1;
+    uint64_t next_id = 1;
+    std::vector<request> queued;
+    std::unordered_map<uint16_t, probe> pending;
+    std::priority_queue<deadline, std::vector<deadline>,
+        std::greater<deadline>> deadlines;
+    std::unordered_map<uint32_t, stats> targets;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Loop callbacks
+    ////////////////////////////////////////////////////////////////////////////
+    void on_event(uint32_t events);
+    void on_timer();
+    void on_invoke();
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Helpers - all require mtx to be held.
+    ////////////////////////////////////////////////////////////////////////////
+    bool open_socket();
+    void arm_timer();
+
+    icmp_service() {}
+
+public:
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    static icmp_service& get();
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Sends one echo request to 'addr' (network byte order) and returns at
+    // once. 'done' is called exactly once: on the reply, on the timeout, or
+    // straight away if the request could not be sent.
+    ////////////////////////////////////////////////////////////////////////////
+    void ping(uint32_t addr, std::chrono::microseconds timeout, callback done);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Copies the statistics for 'addr'. Returns false if it was never probed.
+    ////////////////////////////////////////////////////////////////////////////
+    bool get_stats(uint32_t addr, stats* s);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Number of probes waiting for a reply.
+    ////////////////////////////////////////////////////////////////////////////
+    int in_flight();
+};
+
+#endif
@@ -0,0 +1,230 @@
+
+#include "icmp_sweep.hpp"
+#include <arpa/inet.h>
+#include <algorithm>
+#include <cstring>
+
+////////////////////////////////////////////////////////////////////////////////
+// Probes are sent in batches every TICK, which keeps the rate smooth without
+// a timer per probe. No more than MAX_HOSTS are swept (a /8).
+////////////////////////////////////////////////////////////////////////////////
+static const std::chrono::milliseconds TICK(10);
+static const uint32_t MAX_HOSTS = 1 << 24;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+icmp_sweep::icmp_sweep(const char* name, int update_frequency, int rate,
+        int timeout_ms) : module(true, update_frequency) {
+    char name_full[64];
+    snprintf(name_full, 64, "ICMP SWEEP [ %s ]", name);
+    set_name(name_full);
+    this->rate = std::max(1, rate);
+    this->timeout_ms = timeout_ms;
+    p.sweep = this;
+    report("constructor done", 3);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+bool icmp_sweep::add_range(const char* cidr) {
+    char addr[64];
+    strncpy(addr, cidr, 64);
+    addr[63] = '\0';
+    int prefix = 32;
+    char* slash = strchr(addr, '/');
+    if (slash) {
+        *slash = '\0';
+        prefix = atoi(slash + 1);
+    }
+    uint32_t ip;
+    if (prefix < 0 || prefix > 32 || inet_pton(AF_INET, addr, &ip) != 1)
+        return false;
+
+    ip = ntohl(ip);
+    uint32_t mask = prefix ? ~0u << (32 - prefix) : 0;
+    uint64_t size = 1ull << (32 - prefix);
+    range r;
+    r.first = ip & mask;
+    r.count = size;
+    if (prefix < 31) {
+        r.first++;
+        r.count -= 2;
+    }
+    if (host_total + (uint64_t)r.count > MAX_HOSTS) return false;
+    r.index = host_total;
+    ranges.push_back(r);
+    host_total += r.count;
+
+    std::unique_lock<std::mutex> lck(mtx);
+    seen.resize((host_total + 63) / 64);
+    present_bits.resize((host_total + 63) / 64);
+    first_seen.resize(host_total);
+    last_seen.resize(host_total);
+    lck.unlock();
+
+    char report_str[128];
+    snprintf(report_str, 128, "add_range(%s): %u hosts", cidr, r.count);
+    report(report_str, 3);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Returns the index of 'addr' in the host tables, or -1.
+////////////////////////////////////////////////////////////////////////////////
+int icmp_sweep::find(const char* addr) {
+    uint32_t ip;
+    if (inet_pton(AF_INET, addr, &ip) != 1) return -1;
+    ip = ntohl(ip);
+    for (range& r : ranges)
+        if (ip >= r.first && ip - r.first < r.count)
+            return r.index + (ip - r.first);
+    return -1;
+}
+
+uint32_t icmp_sweep::host_addr(uint32_t index) {
+    for (range& r : ranges)
+        if (index - r.index < r.count)
+            return r.first + (index - r.index);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Runs on the loop thread. The probes are sent with mtx released, since a
+// probe which can not be sent completes (and locks mtx) straight away.
+////////////////////////////////////////////////////////////////////////////////
+void icmp_sweep::send_batch() {
+    std::vector<std::pair<uint32_t, uint32_t>> batch;
+    std::unique_lock<std::mutex> lck(mtx);
+    if (stopping) return;
+    uint32_t n = std::max(1L, rate * TICK.count() / 1000);
+    while (cursor < host_total && batch.size() < n) {
+        batch.push_back({cursor, htonl(host_addr(cursor))});
+        cursor++;
+    }
+    outstanding += batch.size();
+    bool more = cursor < host_total;
+    lck.unlock();
+
+    for (auto& b : batch) {
+        uint32_t index = b.first;
+        icmp_service::get().ping(b.second, std::chrono::milliseconds(timeout_ms),
+            [this, index](bool ok, std::chrono::microseconds) {
+                on_reply(index, ok);
+            });
+    }
+    if (more) io_loop::get().set_timer(&p, io_loop::clock::now() + TICK);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// The sweep is complete once every host was probed and every probe has
+// replied or timed out.
+////////////////////////////////////////////////////////////////////////////////
+void icmp_sweep::on_reply(uint32_t index, bool ok) {
+    std::unique_lock<std::mutex> lck(mtx);
+    if (ok) {
+        seen[index / 64] |= 1ull << (index % 64);
+        uint32_t now = sc::to_time_t(now_floor());
+        if (!first_seen[index]) first_seen[index] = now;
+        last_seen[index] = now;
+    }
+    outstanding--;
+    if (stopping) {
+        if (!outstanding) cv.notify_all();
+        return;
+    }
+    if (cursor < host_total || outstanding) return;
+
+    sweeping = false;
+    present_bits.swap(seen);
+    std::fill(seen.begin(), seen.end(), 0);
+    int count = 0;
+    for (uint64_t bits : present_bits) count += __builtin_popcountll(bits);
+    double ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - sweep_start).count();
+    lck.unlock();
+
+    char report_str[128];
+    snprintf(report_str, 128, "sweep done: %d of %u hosts up in %.0fms",
+        count, host_total, ms);
+    report(report_str, 4);
+    notify_listeners();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void icmp_sweep::sync(bool last) {
+    std::unique_lock<std::mutex> lck(mtx);
+    if (last) {
+        stopping = true;
+        lck.unlock();
+        // No batch is sent once remove() returns. Wait for the probes in
+        // flight, since their callbacks point at this module.
+        io_loop::get().remove(&p);
+        lck.lock();
+        while (outstanding) cv.wait(lck);
+        // Drop the unfinished sweep, so that the module can be enabled again.
+        stopping = false;
+        sweeping = false;
+        cursor = 0;
+        std::fill(seen.begin(), seen.end(), 0);
+        return;
+    }
+    if (!host_total || sweeping) {
+        if (sweeping) report("sweep still in progress", 4);
+        return;
+    }
+    sweeping = true;
+    cursor = 0;
+    sweep_start = std::chrono::steady_clock::now();
+    lck.unlock();
+    io_loop::get().invoke(&p);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+int icmp_sweep::host_count() {
+    return host_total;
+}
+
+int icmp_sweep::present_count() {
+    std::unique_lock<std::mutex> lck(mtx);
+    int count = 0;
+    for (uint64_t bits : present_bits) count += __builtin_popcountll(bits);
+    return count;
+}
+
+bool icmp_sweep::present(const char* addr) {
+    int i = find(addr);
+    if (i < 0) return false;
+    std::unique_lock<std::mutex> lck(mtx);
+    return present_bits[i / 64] & (1ull << (i % 64));
+}
+
+bool icmp_sweep::get_host(const char* addr, time_point* first_seen,
+        time_point* last_seen) {
+    int i = find(addr);
+    if (i < 0) return false;
+    std::unique_lock<std::mutex> lck(mtx);
+    if (!this->last_seen[i]) return false;
+    *first_seen = time_point(duration(this->first_seen[i]));
+    *last_seen = time_point(duration(this->last_seen[i]));
+    return true;
+}
+
+std::vector<std::string> icmp_sweep::present_hosts() {
+    std::vector<std::string> hosts;
+    std::unique_lock<std::mutex> lck(mtx);
+    for (uint32_t w = 0; w < present_bits.size(); w++) {
+        for (uint64_t bits = present_bits[w]; bits; bits &= bits - 1) {
+            uint32_t ip = htonl(host_addr(w * 64 + __builtin_ctzll(bits)));
+            char str[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &ip, str, sizeof(str));
+            hosts.push_back(str);
+        }
+    }
+    return hosts;
+}
@@ -0,0 +1,106 @@
+
+#ifndef _ICMP_SWEEP_H_
+#define _ICMP_SWEEP_H_
+
+#include "module.hpp"
+#include "icmp_service.hpp"
+#include <string>
+
+////////////////////////////////////////////////////////////////////////////////
+// Sweeps whole subnets with ICMP echo requests, every 'update_frequency'
+// seconds. Probes go through the shared icmp_service and are paced from the
+// io_loop, so a sweep costs no thread and no socket of its own.
+//
+// Per host, the sweep keeps one bit (replied during the last complete sweep)
+// and the first and last time it was seen. Listeners are notified after every
+// sweep; presence_sweep uses this to follow a single host.
+////////////////////////////////////////////////////////////////////////////////
+class icmp_sweep : public module {
+private:
+    ////////////////////////////////////////////////////////////////////////////
+    // Sends the next batch of probes every tick until the sweep is sent.
+    ////////////////////////////////////////////////////////////////////////////
+    class pacer : public io_loop::handler {
+    public:
+        icmp_sweep* sweep;
+        void on_invoke() { sweep->send_batch(); }
+        void on_timer() { sweep->send_batch(); }
+    };
+
+    struct range {
+        uint32_t first;  // host byte order
+        uint32_t count;
+        uint32_t index;  // of the first host in the host tables
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Configuration - only written before enable().
+    ////////////////////////////////////////////////////////////////////////////
+    std::vector<range> ranges;
+    uint32_t host_total = 0;
+    int rate, timeout_ms;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Sweep state - protected by mtx.
+    ////////////////////////////////////////////////////////////////////////////
+    std::mutex mtx;
+    std::condition_variable cv;
+    pacer p;
+    bool stopping = false, sweeping = false;
+    uint32_t cursor = 0, outstanding = 0;
+    std::vector<uint64_t> seen, present_bits;
+    std::vector<uint32_t> first_seen, last_seen;
+    std::chrono::steady_clock::time_point sweep_start;
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    void send_batch();
+    void on_reply(uint32_t index, bool ok);
+    int find(const char* addr);
+    uint32_t host_addr(uint32_t index);
+
+protected:
+    ////////////////////////////////////////////////////////////////////////////
+    // Starts a sweep unless one is still in progress.
+    ////////////////////////////////////////////////////////////////////////////
+    void sync(bool last = false);
+
+public:
+    ////////////////////////////////////////////////////////////////////////////
+    // 'rate' is in probes per second, 'timeout_ms' is per probe.
+    ////////////////////////////////////////////////////////////////////////////
+    icmp_sweep(const char* name, int update_frequency = 5, int rate = 1000,
+        int timeout_ms = 1000);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Adds a CIDR range such as "10.4.0.0/16". The network and broadcast
+    // addresses are skipped for prefixes shorter than /31. Must be called
+    // before enable(). Returns false if the range can not be parsed.
+    ////////////////////////////////////////////////////////////////////////////
+    bool add_range(const char* cidr);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Number of hosts covered, and of hosts which replied to the last sweep.
+    ////////////////////////////////////////////////////////////////////////////
+    int host_count();
+    int present_count();
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Whether 'addr' replied to the last complete sweep.
+    ////////////////////////////////////////////////////////////////////////////
+    bool present(const char* addr);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // When 'addr' was first and last seen. Returns false if it is outside the
+    // swept ranges or has never replied.
+    ////////////////////////////////////////////////////////////////////////////
+    bool get_host(const char* addr, time_point* first_seen, time_point* last_seen);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Addresses of every host which replied to the last complete sweep.
+    ////////////////////////////////////////////////////////////////////////////
+    std::vector<std::string> present_hosts();
+};
+
+#endif
@@ -0,0 +1,168 @@
+
+#include "io_loop.hpp"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+io_loop& io_loop::get() {
+    static io_loop l;
+    return l;
+}
+
+io_loop::io_loop() {
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u64 = 0;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, wake_fd, &ev);
+    thread = std::thread(&loop_thread, this);
+}
+
+io_loop::~io_loop() {
+    std::unique_lock<std::recursive_mutex> lck(mtx);
+    exiting = true;
+    wake();
+    lck.unlock();
+    thread.join();
+    close(wake_fd);
+    close(epfd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Interrupt epoll_wait() so that a new, earlier deadline is noticed.
+////////////////////////////////////////////////////////////////////////////////
+void io_loop::wake() {
+    uint64_t one = 1;
+    write(wake_fd, &one, sizeof(one));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void io_loop::loop_thread(io_loop* l) {
+    struct epoll_event events[64];
+    std::unique_lock<std::recursive_mutex> lck(l->mtx);
+    while (!l->exiting) {
+        // Drop cancelled timers and work out how long to sleep.
+        int timeout = -1;
+        while (!l->timers.empty()) {
+            const timer& t = l->timers.top();
+            auto it = l->handlers.find(t.id);
+            if (it == l->handlers.end() || !it->second->timer_armed ||
+                    it->second->timer_gen != t.gen) {
+                l->timers.pop();
+                continue;
+            }
+            auto ms = std::chrono::ceil<std::chrono::milliseconds>(
+                t.when - clock::now()).count();
+            timeout = ms < 0 ? 0 : ms;
+            break;
+        }
+        l->wait_until = (timeout < 0) ? clock::time_point::max() :
+            clock::now() + std::chrono::milliseconds(timeout);
+        lck.unlock();
+
+        int n = epoll_wait(l->epfd, events, 64, timeout);
+
+        lck.lock();
+        l->wait_until = clock::time_point::min();
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.u64 == 0) {
+                uint64_t count;
+                read(l->wake_fd, &count, sizeof(count));
+                continue;
+            }
+            // The handler may have been removed since epoll_wait() returned.
+            auto it = l->handlers.find(events[i].data.u64);
+            if (it == l->handlers.end()) continue;
+            it->second->on_event(events[i].events);
+        }
+
+        clock::time_point now = clock::now();
+        while (!l->timers.empty() && l->timers.top().when <= now) {
+            timer t = l->timers.top();
+            l->timers.pop();
+            auto it = l->handlers.find(t.id);
+            if (it == l->handlers.end()) continue;
+            handler* h = it->second;
+            if (!h->timer_armed || h->timer_gen != t.gen) continue;
+            h->timer_armed = false;
+            h->on_timer();
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void io_loop::add(handler* h) {
+    std::unique_lock<std::recursive_mutex> lck(mtx);
+    if (h->id) return;
+    h->id = next_id++;
+    handlers[h->id] = h;
+}
+
+void io_loop::remove(handler* h) {
+    std::unique_lock<std::recursive_mutex> lck(mtx);
+    if (!h->id) return;
+    unwatch(h);
+    cancel_timer(h);
+    handlers.erase(h->id);
+    h->id = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void io_loop::watch(handler* h, int fd, uint32_t events) {
+    std::unique_lock<std::recursive_mutex> lck(mtx);
+    if (!h->id) add(h);
+    struct epoll_event ev = {};
+    ev.events = events;
+    ev.data.u64 = h->id;
+    if (h->fd == fd) {
+        epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+        return;
+    }
+    if (h->fd != -1) epoll_ctl(epfd, EPOLL_CTL_DEL, h->fd, nullptr);
+    h->fd = fd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+void io_loop::unwatch(handler* h) {
+    std::unique_lock<std::recursive_mutex> lck(mtx);
+    if (h->fd == -1) return;
+    epoll_ctl(epfd, EPOLL_CTL_DEL, h->fd, nullptr);
+    h->fd = -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void io_loop::set_timer(handler* h, clock::time_point when) {
+    std::unique_lock<std::recursive_mutex> lck(mtx);
+    if (!h->id) add(h);
+    h->timer_gen++;
+    h->timer_armed = true;
+    timers.push({when, h->id, h->timer_gen});
+    if (when < wait_until) wake();
+}
+
+void io_loop::cancel_timer(handler* h) {
+    std::unique_lock<std::recursive_mutex> lck(mtx);
+    h->timer_gen++;
+    h->timer_armed = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void io_loop::invoke(handler* h) {
+    std::unique_lock<std::recursive_mutex> lck(mtx);
+    if (!h->id) add(h);
+    h->on_invoke();
+}
@@ -0,0 +1,108 @@
+
+#ifndef _IO_LOOP_H_
+#define _IO_LOOP_H_
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include <cstdint>
+
+////////////////////////////////////////////////////////////////////////////////
+// A single epoll thread shared by the whole process. Handlers register one
+// file descriptor and at most one timer each. Callbacks run on the loop thread
+// with the loop lock held, so they must never block.
+//
+// Any thread may call the methods below. The loop lock is recursive so that
+// callbacks can re-arm themselves.
+////////////////////////////////////////////////////////////////////////////////
+class io_loop {
+public:
+    using clock = std::chrono::steady_clock;
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    class handler {
+        friend class io_loop;
+    private:
+        uint64_t id = 0, timer_gen = 0;
+        bool timer_armed = false;
+        int fd = -1;
+    public:
+        virtual void on_event(uint32_t) {}
+        virtual void on_timer() {}
+        virtual void on_invoke() {}
+        virtual ~handler() {}
+    };
+
+private:
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    struct timer {
+        clock::time_point when;
+        uint64_t id, gen;
+        bool operator>(const timer& t) const { return when > t.when; }
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    // All state is protected by mtx.
+    ////////////////////////////////////////////////////////////////////////////
+    std::recursive_mutex mtx;
+    int epfd = -1, wake_fd = -1;
+    uint64_t next_id = 1;
+    std::unordered_map<uint64_t, handler*> handlers;
+    std::priority_queue<timer, std::vector<timer>, std::greater<timer>> timers;
+    clock::time_point wait_until = clock::time_point::max();
+    bool exiting = false;
+    std::thread thread;
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    static void loop_thread(io_loop* l);
+    void wake();
+
+    io_loop();
+    ~io_loop();
+
+public:
+    ////////////////////////////////////////////////////////////////////////////
+    // Returns the process-wide loop. The thread is started on first use.
+    ////////////////////////////////////////////////////////////////////////////
+    static io_loop& get();
+
+    ////////////////////////////////////////////////////////////////////////////
+    // add() registers a handler. remove() unregisters it, removes its file
+    // descriptor from epoll and cancels its timer. Once remove() returns, no
+    // callback is running or will run for that handler.
+    ////////////////////////////////////////////////////////////////////////////
+    void add(handler* h);
+    void remove(handler* h);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // watch() sets the file descriptor and event mask (EPOLLIN, EPOLLOUT, ...)
+    // for a handler, replacing any previous one. unwatch() must be called
+    // before the descriptor is closed.
+    ////////////////////////////////////////////////////////////////////////////
+    void watch(handler* h, int fd, uint32_t events);
+    void unwatch(handler* h);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Each handler has a single timer. set_timer() replaces any previous
+    // deadline.
+    ////////////////////////////////////////////////////////////////////////////
+    void set_timer(handler* h, clock::time_point when);
+    void cancel_timer(handler* h);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Calls h->on_invoke() on the calling thread with the loop lock held.
+    // This is how other threads start work on a handler.
+    ////////////////////////////////////////////////////////////////////////////
+    void invoke(handler* h);
+};
+
+#endif
@@ -3,181 +3,50 @@
 #include <stdio.h>
 #include <cstring>
 #include <ctime>
-#include <arpa/inet.h>
-#include <sys/socket.h>
 #include <unistd.h>
-#include <poll.h>
-#include <fcntl.h>
-
-////////////////////////////////////////////////////////////////////////////////
-// Encode a command to a KASA device. Requires an extra 4 bytes in the
-// input buffer to store the longer result. Returns the length of the
-// encoded command. The operation is done in-place in the data buffer.
-// - This version was written by John Greth.
-// - This was created by reverse-engineering the decode() function in
-//   https://github.com/ggeorgovassilis/linuxscripts/tree/master/tp-link-hs100-smartplug/hs100.sh
-//   by George Georgovassilis. George credits Thomas Baust for providing
-//   the KASA device encoding scheme.
-////////////////////////////////////////////////////////////////////////////////
-int kasa::encode(char* data) {
-    char temp[5];
-    for (int j = 0; j < 5; j++) temp[j] = data[j];
-    data[3] = 171;
-    int len = 0;
-    while (temp[0]) {
-        data[len+4] = data[len+3] ^ temp[0];
-        for (int j = 0; j < 4; j++) temp[j] = temp[j+1];
-        temp[4] = data[4 + ++len];
-    }
-    for (int i = 0; i < 4; i++) data[3-i] = (len >> (8*i)) & 255;
-    return len+4;
-}
-
-////////////////////////////////////////////////////////////////////////////////
-// Decode a response from a KASA device. The operation is done in-place in the
-// data buffer.
-// - This version was written by John Greth.
-// - This was created by reverse-engineering the decode() function in
-//   https://github.com/ggeorgovassilis/linuxscripts/tree/master/tp-link-hs100-smartplug/hs100.sh
-//   by George Georgovassilis. George credits Thomas Baust for providing
-//   the KASA device encoding scheme.
-////////////////////////////////////////////////////////////////////////////////
-bool kasa::decode(char* data, int len) {
-    int msg_len = 0;
-    bool ret = true;
-    for (int i = 0; i < 4; i++) msg_len = (msg_len << 8) + data[i];
-    msg_len += 4;
-    if (msg_len > len) return false;
-    len = msg_len;
-    if (len < 4) len = 4; // For safety in error cases.
-    data[3] = 171;
-    for (int i = 0; i < len-4; i++) data[i] = data[i+3] ^ data[i+4];
-    data[len-4] = 0;
-    return true;
-}
+#include <vector>
 
 ////////////////////////////////////////////////////////////////////////////////
 // The c_str in 'data' is sent to the kasa device. The response is written into
-// 'data'.
+// 'data'. Blocks; sync() itself uses send_async().
 ////////////////////////////////////////////////////////////////////////////////
 void kasa::send_recv(char* data, int data_len, bool last) {
     char report_str[1024];
 
     if (last) {
-        close(sock);
+        kasa_fleet::disconnect(&conn);
+        reply.reset();
         data[0] = '\0';
         return;
     }
 
-    // Wait a random amount, up to 200ms, to avoid bursts.
-    usleep(1000 * (rand() % 250));
-
-    bool error_detected = false;
-
-    // Clear the read buffer.
-    while (true) {
-        struct pollfd pfd = {.fd = sock, .events = POLLIN};
-        poll(&pfd, 1, 0);
-        if (pfd.revents != POLLIN) break;
-        char temp;
-        recv(sock, &temp, 1, 0);
-    }
-
-    // Send the encoded command.
-    sprintf(report_str, "Message sent: %s", data);
+    // Send the encoded command. The request is kept in case it must be resent.
+    snprintf(report_str, 1024, "Message sent: %s", data);
     report(report_str, 6);
-    int encode_len = encode(data);
+    size_t data_str_len = strlen(data);
+    request.resize(kasa_codec::encoded_size(data_str_len));
+    int encode_len = kasa_codec::encode(data, data_str_len, request.data());
 
-    if (sock == -1) {
-        error_detected = true;
-    } else if (encode_len != write(sock, data, encode_len)) {
-        error_detected = true;
-    } else {
-        // Wait for a response.
-        // Timeout after 400ms. State checks take <100ms, but compound
-        // commands (set and check) may take a bit longer.
-        int poll_time = 400;
-
-        int recv_len = 0;
-        bool decode_res = false;
-        do {
-            struct pollfd pfd = {.fd = sock, .events = POLLIN};
-            poll(&pfd, 1, poll_time);
-            if (pfd.revents != POLLIN || (data_len == recv_len))
-                error_detected = true;
-            else {
-                recv_len += recv(sock, data+recv_len, data_len-recv_len, 0);
-                decode_res = decode(data, recv_len);
-            }
-            poll_time = 100;
-        } while (!error_detected && !decode_res && (recv_len < data_len));
-        if (!decode_res) error_detected = true;
-    }
+    bool unreachable = false;
+    bool error_detected = !kasa_fleet::transact(&conn, request.data(),
+        encode_len, &reply, false, &unreachable);
 
-    if (error_detected) {
-        if (ping.ping()) {
-
-            error_detected = false;
-
-            report("Connection error. Retrying...", 3);
-
-            close(sock);
-
-            sock = socket(AF_INET, SOCK_STREAM, 0);
-            // Set non-blocking so that timeouts can be enforced.
-            fcntl(sock, F_SETFL, O_NONBLOCK);
-
-            // Attempt a connection to the device.
-            struct sockaddr_in sock_addr =
-                {.sin_family = AF_INET, .sin_port = htons(9999)};
-            inet_pton(AF_INET, addr, &sock_addr.sin_addr);
-            connect(sock, (struct sockaddr*)&sock_addr, sizeof(sock_addr));
-
-            // Wait for the connection to be established.
-            // Timeout after 100ms.
-            struct pollfd pfd = {.fd = sock, .events = POLLOUT};
-            poll(&pfd, 1, 100);
-            if (pfd.revents != POLLOUT)
-                error_detected = true;
-
-            if (encode_len != write(sock, data, encode_len)) {
-                error_detected = true;
-            } else {
-                // Wait for a response.
-                // Timeout after 400ms. State checks take <100ms, but compound
-                // commands (set and check) may take a bit longer.
-                int poll_time = 400;
-
-                int recv_len = 0;
-                bool decode_res = false;
-                do {
-                    struct pollfd pfd = {.fd = sock, .events = POLLIN};
-                    poll(&pfd, 1, poll_time);
-                    if (pfd.revents != POLLIN || (data_len == recv_len))
-                        error_detected = true;
-                    else {
-                        recv_len += recv(sock, data+recv_len, data_len-recv_len, 0);
-                        decode_res = decode(data, recv_len);
-                    }
-                    poll_time = 100;
-                } while (!error_detected && !decode_res && (recv_len < data_len));
-                if (!decode_res) error_detected = true;
-            }
-
-            connect_time = now_floor();
-
-            if (error_detected) {
-                report("Connection error was not resolved. Returning error.", 3);
-            }
+    // The request is sent once more on a new connection, unless the device
+    // could not be reached at all.
+    if (error_detected && !unreachable) {
+        report("Connection error. Retrying...", 3);
 
-        } else {
-            report("Connection error. Waiting...", 4);
-        }
+        error_detected = !kasa_fleet::transact(&conn, request.data(),
+            encode_len, &reply, true);
+
+        connect_time = now_floor();
     }
 
+    log_reply(!error_detected);
     if (!error_detected) {
-        sprintf(report_str, "Message received: %s", data);
-        report(report_str, 6);
+        // Replies longer than the caller's buffer are truncated.
+        strncpy(data, reply.c_str(), data_len - 1);
+        data[data_len - 1] = '\0';
     }
     else {
         data[0] = '\0';
@@ -185,67 +54,63 @@ void kasa::send_recv(char* data, int data_len, bool last) {
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// Attempt to switch a device on or off.
-// Returns the post-switch state.
-//
-// If the target state is something other than ON or OFF, the state is
-// not changed but the current state is still queried and returned.
-//
-// If an attempt is made to update the device state (successful or not),
-// toggle_time is updated. Subsequent state changes are suppressed until the
-// cooldown period has completed. This ensures that the device is not damaged by
-// excessive/quick toggling on and off.
-////////////////////////////////////////////////////////////////////////////////
-void kasa::sync_device(int tgt, int tgt_brightness, int* res, int* res_brightness,
-        int* res_power_mw, int* res_total_wh, bool last) {
-    *res_brightness = 100;
-    report("sync_device() called.", 5);
-    char data[4096];
-
-    if (tgt_brightness) {
-        snprintf(data, 4096, "{\"smartlife.iot.dimmer\":{\"set_brightness\":{\"brightness\":%d}}}", tgt_brightness);
-        send_recv(data, 4096, false);
-    }
-
-    if (now_floor() - toggle_time < cooldown)
-        tgt = UNCHANGED;
-    if (tgt == ON) {
-        strncpy(data, "{\"emeter\":{\"get_realtime\":null},\"system\":{\"set_relay_state\":{\"state\":1},\"get_sysinfo\":null}}", 4096);
-        toggle_time = now_floor();
-    } else if (tgt == OFF) {
-        strncpy(data, "{\"emeter\":{\"get_realtime\":null},\"system\":{\"set_relay_state\":{\"state\":0},\"get_sysinfo\":null}}", 4096);
-        toggle_time = now_floor();
-    } else
-        strncpy(data, "{\"emeter\":{\"get_realtime\":null},\"system\":{\"get_sysinfo\":null}}", 4096);
-
-    send_recv(data, 4096, last);
-
-    if (NULL != strstr(data, "\"relay_state\":1")) *res = ON;
-    else if (NULL != strstr(data, "\"relay_state\":0")) *res = OFF;
-    else *res = ERROR;
-
-    char* res_str = strstr(data, "\"brightness\":");
-    if (res_str) {
-        res_str += 13;
-        *res_brightness = atoi(res_str);
-    }
-    else *res_brightness = 0;
+// Like send_recv(), without waiting. 'done' is called with the reply in
+// 'reply', from the loop thread (or this one, if the request failed at once).
+// The request and its retry each go out once the pacer lets them.
+////////////////////////////////////////////////////////////////////////////////
+void kasa::send_async(const char* data, std::function<void(bool ok)> done) {
+    char report_str[1024];
+    snprintf(report_str, 1024, "Message sent: %s", data);
+    report(report_str, 6);
+    size_t data_str_len = strlen(data);
+    request.resize(kasa_codec::encoded_size(data_str_len));
+    int encode_len = kasa_codec::encode(data, data_str_len, request.data());
+
+    send_paced(encode_len, false, [this, encode_len, done](bool ok, bool unreachable) {
+        if (ok || unreachable) {
+            log_reply(ok);
+            done(ok);
+            return;
+        }
+        report("Connection error. Retrying...", 3);
+        connect_time = now_floor();
+        send_paced(encode_len, true, [this, done](bool ok, bool) {
+            log_reply(ok);
+            done(ok);
+        });
+    });
+}
 
-    res_str = strstr(data, "\"power_mw\":");
-    if (res_str) {
-        res_str += 11;
-        *res_power_mw = atoi(res_str);
+void kasa::send_paced(int len, bool reconnect, kasa_fleet::callback done) {
+    if (pass_reserved) {
+        pass_reserved = false;
+        kasa_fleet::transact_async(&conn, request.data(), len, &reply, reconnect,
+            std::move(done));
+        return;
     }
-    else *res_power_mw = -1;
+    pace.wait_until(pacer::get().reserve(addr, pass_priority),
+            [this, len, reconnect, done]() {
+        kasa_fleet::transact_async(&conn, request.data(), len, &reply, reconnect,
+            done);
+    });
+}
 
-    res_str = strstr(data, "\"total_wh\":");
-    if (res_str) {
-        res_str += 11;
-        *res_total_wh = atoi(res_str);
+////////////////////////////////////////////////////////////////////////////////
+// A failed request leaves an empty reply.
+////////////////////////////////////////////////////////////////////////////////
+void kasa::log_reply(bool ok) {
+    char report_str[1024];
+    if (ok) {
+        snprintf(report_str, 1024, "Message received: %s", reply.c_str());
+        report(report_str, 6);
+        return;
     }
-    else *res_total_wh = -1;
-
-    report("sync_device() complete.", 5);
+    int srtt_ms, rto_ms, idle_close_ms;
+    kasa_fleet::timing(&conn, &srtt_ms, &rto_ms, &idle_close_ms);
+    snprintf(report_str, 1024, "Connection error (srtt %dms, rto %dms). "
+        "Returning error.", srtt_ms, rto_ms);
+    report(report_str, 3);
+    reply.reset();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -253,6 +118,11 @@ void kasa::sync_device(int tgt, int tgt_brightness, int* res, int* res_brightnes
 // If the device state has changed, note the change in the log.
 // Once a new target state is successfully applied, the target state becomes
 // UNCHANGED.
+//
+// sync() decides what to send and leaves the requests to send_brightness(),
+// send_relay() and send_query(), which start each other from the callbacks
+// of the request before. apply_reply() is the end of the sync. The final
+// sync only closes the connection.
 ////////////////////////////////////////////////////////////////////////////////
 void kasa::sync(bool last) {
     std::unique_lock<std::mutex> lck(mtx);
@@ -275,11 +145,136 @@ void kasa::sync(bool last) {
         if (res == ON ) last_time_on  = now_floor();
         if (res == OFF) last_time_off = now_floor();
     }
+    pass_tgt = tgt;
+    pass_brightness = tgt_brightness;
+    pass_time = current_time;
+
+    if (last) {
+        lck.unlock();
+        kasa_fleet::disconnect(&conn);
+        reply.reset();
+        apply_reply(true);
+        return;
+    }
+
+    // Commands go out at once. A poll waits for its turn, and the sync is
+    // not over until it went out. The pacer is asked before the breakers: a
+    // half open breaker lets one probe out, which must then be sent.
+    pass_priority = tgt != UNCHANGED || tgt_brightness;
+    pacer::clock::time_point start = pacer::get().reserve(addr, pass_priority);
+    lck.unlock();
+
+    if (!(breaker.allow(now_floor()) && subnet->allow(now_floor(), this))) {
+        suspend();
+        return;
+    }
+
+    sync_pending();
+    pass_reserved = true;
+    pace.wait_until(start, [this]() { send_brightness(); });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// The first request of a sync, once the pacer lets it out. A command which
+// arrived while the poll waited goes out with it.
+////////////////////////////////////////////////////////////////////////////////
+void kasa::send_brightness() {
+    std::unique_lock<std::mutex> lck(mtx);
+    pass_tgt = tgt;
+    // Its other requests are a command's too.
+    if (pass_tgt != UNCHANGED) pass_priority = true;
+    lck.unlock();
+
+    if (!pass_brightness) {
+        send_relay();
+        return;
+    }
+    char data[128];
+    snprintf(data, 128, "{\"smartlife.iot.dimmer\":{\"set_brightness\":{\"brightness\":%d}}}",
+        pass_brightness);
+    send_async(data, [this](bool) { send_relay(); });
+}
+
+void kasa::send_relay() {
+    int tgt = pass_tgt;
+    std::unique_lock<std::mutex> lck(mtx);
+    if (now_floor() - toggle_time < cooldown)
+        tgt = UNCHANGED;
+    if (tgt != ON && tgt != OFF) {
+        lck.unlock();
+        send_query();
+        return;
+    }
+    toggle_time = now_floor();
     lck.unlock();
-    int res, res_brightness;
-    int res_power_mw, res_total_wh;
-    sync_device(tgt, tgt_brightness, &res, &res_brightness,
-        &res_power_mw, &res_total_wh, last);
+
+    char data[128];
+    snprintf(data, 128, "{\"system\":{\"set_relay_state\":{\"state\":%d}}}",
+        tgt == ON ? 1 : 0);
+    pass_sent = std::chrono::steady_clock::now();
+    send_async(data, [this, tgt](bool) {
+        std::chrono::steady_clock::time_point received = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lck(mtx);
+        cmd_queue = std::chrono::duration_cast<std::chrono::microseconds>(pass_sent - cmd_asked);
+        cmd_wire = std::chrono::duration_cast<std::chrono::microseconds>(received - pass_sent);
+        char report_str[128];
+        snprintf(report_str, 128, "command %s: queued %.1fms, wire %.1fms",
+            STATES[tgt], cmd_queue.count() / 1000.0, cmd_wire.count() / 1000.0);
+        lck.unlock();
+        report(report_str, 3);
+        send_query();
+    });
+}
+
+void kasa::send_query() {
+    send_async("{\"emeter\":{\"get_realtime\":null},\"system\":{\"get_sysinfo\":null}}",
+            [this](bool ok) {
+        apply_reply(false);
+        if (ok) queried();
+        sync_complete();
+    });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Takes the state from the reply to the query, which is empty if it failed.
+////////////////////////////////////////////////////////////////////////////////
+void kasa::apply_reply(bool last) {
+    time_point current_time = pass_time;
+
+    // Parse the full reply, whatever its length.
+    kasa_reply parsed;
+    parsed.parse(reply.c_str(), reply.size());
+
+    int res;
+    if (parsed.relay_state == 1) res = ON;
+    else if (parsed.relay_state == 0) res = OFF;
+    else res = ERROR;
+
+    int res_brightness = (parsed.brightness != -1) ? parsed.brightness : 0;
+    int res_power_mw = parsed.power_mw;
+    int res_total_wh = parsed.total_wh;
+
+    std::unique_lock<std::mutex> lck(mtx);
+    if (parsed.has_rssi) this->res_rssi = parsed.rssi;
+    if (parsed.voltage_mv != -1) this->res_voltage_mv = parsed.voltage_mv;
+    if (parsed.current_ma != -1) this->res_current_ma = parsed.current_ma;
+    lck.unlock();
+
+    if (!last) {
+        if (res == ERROR) {
+            breaker.failure(now_floor());
+            subnet->failure(now_floor(), this);
+        } else {
+            breaker.success();
+            subnet->success(this);
+        }
+        // A failed probe of a half open subnet is as good as an open one.
+        if (res == ERROR && (breaker.get_state() == circuit_breaker::OPEN ||
+                subnet->get_state() != circuit_breaker::CLOSED)) {
+            res = UNREACHABLE;
+            defer_sync(std::max(breaker.get_retry_at(), subnet->get_retry_at()));
+        }
+    }
     if (recent_error && ((res == ON) || (res == OFF)))
         notify_listeners();
     lck.lock();
@@ -291,7 +286,7 @@ void kasa::sync(bool last) {
         last_time_off = now_floor();
         recent_error = false;
     }
-    if (res == ERROR) recent_error = true;
+    if (res == ERROR || res == UNREACHABLE) recent_error = true;
 
     if (last) res = UNKNOWN;
 
@@ -333,6 +328,26 @@ void kasa::sync(bool last) {
     notify_listeners();
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Called instead of a device query while a breaker is open.
+////////////////////////////////////////////////////////////////////////////////
+void kasa::suspend() {
+    defer_sync(std::max(breaker.get_retry_at(), subnet->get_retry_at()));
+    sync_skipped();
+    std::unique_lock<std::mutex> lck(mtx);
+    if (res == UNREACHABLE) return;
+    int res_prev = res;
+    res = UNREACHABLE;
+    recent_error = true;
+    lck.unlock();
+    char report_str[256];
+    sprintf(report_str, "state: %s", STATES[res_prev]);
+    report(report_str, 2, true);
+    sprintf(report_str, "state: %s", STATES[UNREACHABLE]);
+    report(report_str, 2, true);
+    notify_listeners();
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // When was the device last in the 'ON' state
 // If the device is currently in the 'ON' state, returns now_floor().
@@ -387,6 +402,33 @@ int kasa::get_power_mw() {
     return res;
 }
 
+int kasa::get_rssi() {
+    report("get_rssi()", 5);
+    std::unique_lock<std::mutex> lck(mtx);
+    int res = this->res_rssi;
+    lck.unlock();
+    report("get_rssi() done", 5);
+    return res;
+}
+
+int kasa::get_voltage_mv() {
+    report("get_voltage_mv()", 5);
+    std::unique_lock<std::mutex> lck(mtx);
+    int res = this->res_voltage_mv;
+    lck.unlock();
+    report("get_voltage_mv() done", 5);
+    return res;
+}
+
+int kasa::get_current_ma() {
+    report("get_current_ma()", 5);
+    std::unique_lock<std::mutex> lck(mtx);
+    int res = this->res_current_ma;
+    lck.unlock();
+    report("get_current_ma() done", 5);
+    return res;
+}
+
 int kasa::get_total_wh() {
     report("get_total_wh()", 5);
     std::unique_lock<std::mutex> lck(mtx);
@@ -409,7 +451,17 @@ int kasa::get_target() {
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// Sets the target device state which will be applied promptly.
+// Timing of the most recent command, in microseconds.
+////////////////////////////////////////////////////////////////////////////////
+void kasa::get_command_timing(int* queue_us, int* wire_us) {
+    std::unique_lock<std::mutex> lck(mtx);
+    *queue_us = cmd_queue.count();
+    *wire_us = cmd_wire.count();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Sets the target device state which will be applied promptly. The sync which
+// applies it runs ahead of routine polls.
 ////////////////////////////////////////////////////////////////////////////////
 void kasa::set_target(int tgt) {
     char report_str[256];
@@ -417,8 +469,11 @@ void kasa::set_target(int tgt) {
     report(report_str, 3);
     std::unique_lock<std::mutex> lck(mtx);
     this->tgt = tgt;
+    cmd_asked = std::chrono::steady_clock::now();
     lck.unlock();
-    sync_now();
+    // A poll waiting for the pacer goes out now and takes the command.
+    pace.fire();
+    sync_now(true);
     sprintf(report_str, "set_target(%s) done", STATES[tgt]);
     report(report_str, 4);
 }
@@ -455,23 +510,47 @@ void kasa::set_brightness_target(int start_brightness, int end_brightness,
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// Start the KASA runtime.
+// Checkpoint layout: last_time_on, last_time_off, toggle_time, tgt,
+// start_brightness, end_brightness, start_time, end_time, res_power_mw,
+// res_total_wh. The device state itself is always queried again.
 ////////////////////////////////////////////////////////////////////////////////
-kasa::kasa(char* name, char* addr, int update_frequency,
-        int cooldown, int error_cooldown) : module(true, update_frequency), ping{addr} {
-    char name_full[64];
-    snprintf(name_full, 64, "KASA [ %s @ %s ]", name, addr);
-    set_name(name_full);
-    strncpy(this->addr, addr, 64);
-    this->cooldown = duration(cooldown);
-    this->error_cooldown = duration(error_cooldown);
-    connect_time = now_floor() - this->error_cooldown;
+void kasa::checkpoint_state() {
+    std::unique_lock<std::mutex> lck(mtx);
+    int64_t v[CHECKPOINT_VALUES] = {
+        last_time_on.time_since_epoch().count(),
+        last_time_off.time_since_epoch().count(),
+        toggle_time.time_since_epoch().count(), tgt,
+        start_brightness, end_brightness,
+        start_time.time_since_epoch().count(),
+        end_time.time_since_epoch().count(), res_power_mw, res_total_wh};
+    lck.unlock();
+    save_checkpoint(v, CHECKPOINT_VALUES);
+}
 
+void kasa::init_state() {
     char report_str[256], time_str[64];
-    sprintf(report_str, "state: %s", STATES[ON]);
-    last_time_on = scan_report(report_str);
-    sprintf(report_str, "state: %s", STATES[OFF]);
-    last_time_off = scan_report(report_str);
+    int64_t v[CHECKPOINT_VALUES];
+    if (load_checkpoint(v, CHECKPOINT_VALUES)) {
+        last_time_on = time_point(duration(v[0]));
+        last_time_off = time_point(duration(v[1]));
+        toggle_time = time_point(duration(v[2]));
+        tgt = v[3];
+        start_brightness = v[4];
+        end_brightness = v[5];
+        start_time = time_point(duration(v[6]));
+        end_time = time_point(duration(v[7]));
+        res_power_mw = v[8];
+        res_total_wh = v[9];
+        report("init from checkpoint", 3);
+    } else {
+        sprintf(report_str, "state: %s", STATES[OFF]);
+        index_report(report_str);
+        sprintf(report_str, "state: %s", STATES[ON]);
+        index_report(report_str);
+        last_time_on = scan_report(report_str);
+        sprintf(report_str, "state: %s", STATES[OFF]);
+        last_time_off = scan_report(report_str);
+    }
 
     time_t time = sc::to_time_t(last_time_on);
     strftime(time_str, 64, "%c", std::localtime(&time));
@@ -482,12 +561,28 @@ kasa::kasa(char* name, char* addr, int update_frequency,
     strftime(time_str, 64, "%c", std::localtime(&time));
     sprintf(report_str, "init last_time_off: %s", time_str);
     report(report_str, 3);
+}
 
+////////////////////////////////////////////////////////////////////////////////
+// Start the KASA runtime.
+////////////////////////////////////////////////////////////////////////////////
+kasa::kasa(char* name, char* addr, int update_frequency,
+        int cooldown, int error_cooldown) : module(true, update_frequency), conn{addr} {
+    subnet = circuit_breaker::subnet(addr, this);
+    char name_full[64];
+    snprintf(name_full, 64, "KASA [ %s @ %s ]", name, addr);
+    set_name(name_full);
+    strncpy(this->addr, addr, 64);
+    this->cooldown = duration(cooldown);
+    this->error_cooldown = duration(error_cooldown);
+    connect_time = now_floor() - this->error_cooldown;
+    init_state();
     report("constructor done", 3);
 }
 
 kasa::kasa(const char* name, const char* addr, int update_frequency,
-        int cooldown, int error_cooldown) : module(true, update_frequency), ping{addr} {
+        int cooldown, int error_cooldown) : module(true, update_frequency), conn{addr} {
+    subnet = circuit_breaker::subnet(addr, this);
     char name_full[64];
     snprintf(name_full, 64, "KASA [ %s @ %s ]", name, addr);
     set_name(name_full);
@@ -495,22 +590,10 @@ kasa::kasa(const char* name, const char* addr, int update_frequency,
     this->cooldown = duration(cooldown);
     this->error_cooldown = duration(error_cooldown);
     connect_time = now_floor() - this->error_cooldown;
-
-    char report_str[256], time_str[64];
-    sprintf(report_str, "state: %s", STATES[ON]);
-    last_time_on = scan_report(report_str);
-    sprintf(report_str, "state: %s", STATES[OFF]);
-    last_time_off = scan_report(report_str);
-
-    time_t time = sc::to_time_t(last_time_on);
-    strftime(time_str, 64, "%c", std::localtime(&time));
-    sprintf(report_str, "init last_time_on: %s", time_str);
-    report(report_str, 3);
-
-    time = sc::to_time_t(last_time_off);
-    strftime(time_str, 64, "%c", std::localtime(&time));
-    sprintf(report_str, "init last_time_off: %s", time_str);
-    report(report_str, 3);
-
+    init_state();
     report("constructor done", 3);
 }
+
+kasa::~kasa() {
+    subnet->leave(this);
+}
@@ -3,13 +3,17 @@
 #define _KASA_H_
 
 #include "module.hpp"
-#include "icmp_helper.hpp"
+#include "circuit_breaker.hpp"
+#include "pacer.hpp"
+#include "kasa_fleet.hpp"
+#include "kasa_reply.hpp"
 #include <thread>
 #include <string>
 #include <chrono>
 #include <mutex>
 #include <map>
-#include <condition_variable>
+#include <vector>
+#include <functional>
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -24,15 +28,15 @@ public:
     static inline const int OFF = 2;
     static inline const int ERROR = 3;
     static inline const int UNKNOWN = 4;
+    static inline const int UNREACHABLE = 5;
     static inline const char* const STATES[] =
-        {"UNCHANGED", "ON", "OFF", "ERROR", "UNKNOWN"};
+        {"UNCHANGED", "ON", "OFF", "ERROR", "UNKNOWN", "UNREACHABLE"};
 
 private:
     ////////////////////////////////////////////////////////////////////////////
     // Configuration - only written by the constructor.
     ////////////////////////////////////////////////////////////////////////////
     char addr[64];
-    icmp_helper ping;
     duration cooldown, error_cooldown;
 
     ////////////////////////////////////////////////////////////////////////////
@@ -47,26 +51,67 @@ private:
     int res_brightness = 0;
     int start_brightness = 0, end_brightness = 0;
     int res_power_mw = -1, res_total_wh = -1;
+    int res_rssi = 0, res_voltage_mv = -1, res_current_ma = -1;
     time_point start_time = now_floor(), end_time = now_floor();
     std::mutex mtx;
 
     ////////////////////////////////////////////////////////////////////////////
-    // IO context - A single connection is used multiple times.
+    // Commands - set_target() starts a poll which is waiting for the pacer at
+    // once, and the command goes out in its place. The time from set_target()
+    // until the relay-set request went out, and its round trip, are kept for
+    // the most recent command. Access must be protected by mutex.
     ////////////////////////////////////////////////////////////////////////////
-    int sock = -1;
+    std::chrono::steady_clock::time_point cmd_asked;
+    std::chrono::microseconds cmd_queue{0}, cmd_wire{0};
 
     ////////////////////////////////////////////////////////////////////////////
-    // Encode a command to a KASA device. Requires an extra 4 bytes in the
-    // input buffer to store the longer result. Returns the length of the
-    // encoded command. The operation is done in-place in the data buffer.
+    // IO context - A single connection is used multiple times. The socket
+    // itself is owned and driven by the kasa_fleet. The decoder holds the
+    // most recent reply, whatever its length.
     ////////////////////////////////////////////////////////////////////////////
-    int encode(char* data);
+    kasa_fleet::conn conn;
+    kasa_codec::decoder reply;
+    std::vector<char> request;
 
     ////////////////////////////////////////////////////////////////////////////
-    // Decode a response from a KASA device. The operation is done in-place in
-    // the data buffer.
+    // The sync in progress. sync() only works out what to send and returns
+    // (see module::sync_pending()). The requests then go out one after the
+    // other from the pacer and kasa_fleet callbacks, so that no scheduler
+    // worker waits for the device. Only touched by sync() and those
+    // callbacks, which never overlap.
+    //
+    // Every request takes a pacer token. The first one of a sync goes out on
+    // the token sync() reserved ('pass_reserved'), the others and any retry
+    // reserve their own.
+    ////////////////////////////////////////////////////////////////////////////
+    int pass_tgt = UNCHANGED, pass_brightness = 0;
+    bool pass_priority = false, pass_reserved = false;
+    time_point pass_time;
+    std::chrono::steady_clock::time_point pass_sent;
+    pacer::waiter pace;
+    void send_async(const char* data, std::function<void(bool ok)> done);
+    void send_paced(int len, bool reconnect, kasa_fleet::callback done);
+    void log_reply(bool ok);
+    void send_brightness();
+    void send_relay();
+    void send_query();
+    void apply_reply(bool last);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Backoff - 'breaker' opens after a few errors in a row, 'subnet' when
+    // every device in the /24 fails. While either is open the device is not
+    // contacted, the next sync is deferred and the state is UNREACHABLE.
     ////////////////////////////////////////////////////////////////////////////
-    bool decode(char* data, int len);
+    circuit_breaker breaker;
+    circuit_breaker* subnet;
+    void suspend();
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Restores the status information from the checkpoint, or rebuilds
+    // last_time_on/off from the log if there is none. Constructor only.
+    ////////////////////////////////////////////////////////////////////////////
+    static inline const int CHECKPOINT_VALUES = 10;
+    void init_state();
 
 protected:
     ////////////////////////////////////////////////////////////////////////////
@@ -76,43 +121,63 @@ protected:
     void send_recv(char* data, int data_len, bool last);
 
     ////////////////////////////////////////////////////////////////////////////
-    // Attempt to switch a device on or off.
-    // Returns the post-switch state.
+    // Write the target state to the device and query the current state.
+    // If the device state has changed, note the change in the log.
+    // Once a new target state is successfully applied, the target state becomes
+    // UNCHANGED.
     //
-    // If the target state is something other than ON or OFF, the state is
-    // not changed but the current state is still queried and returned.
+    // The switch is a relay-set request on its own, which the device answers
+    // fastest, followed by the query which confirms it. If the target state is
+    // something other than ON or OFF, only the query goes out.
     //
     // If an attempt is made to update the device state (successful or not),
     // toggle_time is updated. Subsequent state changes are suppressed until the
     // cooldown period has completed. This ensures that the device is not
     // damaged by excessive/quick toggling on and off.
     ////////////////////////////////////////////////////////////////////////////
-    void sync_device(int tgt, int tgt_brightness, int* res, int* res_brightness,
-        int* res_power_mw, int* res_total_wh, bool last);
+    void sync(bool last = false);
 
     ////////////////////////////////////////////////////////////////////////////
-    // Write the target state to the device and query the current state.
-    // If the device state has changed, note the change in the log.
-    // Once a new target state is successfully applied, the target state becomes
-    // UNCHANGED.
+    // Called once a sync() got a reply to its query and applied it, on the
+    // loop thread. It must not block.
     ////////////////////////////////////////////////////////////////////////////
-    void sync(bool last = false);
+    virtual void queried() {}
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    void checkpoint_state();
 
 public:
     ////////////////////////////////////////////////////////////////////////////
     // Returns the state from the most recent device query.
     // Call sync_wait() before this to ensure that the returned value is
-    // up-to-date.
+    // up-to-date. UNREACHABLE means the device is not being queried until
+    // its backoff has passed.
     ////////////////////////////////////////////////////////////////////////////
     int get_status();
     int get_power_mw();
     int get_total_wh();
 
+    ////////////////////////////////////////////////////////////////////////////
+    // Extra readings from the most recent reply, where the device reports
+    // them. Voltage and current are -1 if unknown; RSSI is 0 if unknown.
+    ////////////////////////////////////////////////////////////////////////////
+    int get_rssi();
+    int get_voltage_mv();
+    int get_current_ma();
+
     ////////////////////////////////////////////////////////////////////////////
     // Gets the target device state which will be applied on the next sync.
     ////////////////////////////////////////////////////////////////////////////
     int get_target();
 
+    ////////////////////////////////////////////////////////////////////////////
+    // Timing of the most recent command, in microseconds: from set_target()
+    // until its relay-set request went out, and the round trip of that request.
+    ////////////////////////////////////////////////////////////////////////////
+    void get_command_timing(int* queue_us, int* wire_us);
+
     ////////////////////////////////////////////////////////////////////////////
     // Returns the state from the most recent device query.
     // Call sync_wait() before this to ensure that the returned value is
@@ -133,7 +198,8 @@ public:
     time_point get_last_time_off();
 
     ////////////////////////////////////////////////////////////////////////////
-    // Sets the target device state which will be applied promptly.
+    // Sets the target device state which will be applied promptly. The sync
+    // which applies it runs ahead of routine polls.
     ////////////////////////////////////////////////////////////////////////////
     void set_target(int tgt);
 
@@ -150,6 +216,7 @@ public:
         int cooldown = 5, int error_cooldown = 15);
     kasa(const char* name, const char* addr, int update_frequency = 1,
         int cooldown = 5, int error_cooldown = 15);
+    ~kasa();
 };
 
 #endif
@@ -0,0 +1,247 @@
+
+#include "kasa_codec.hpp"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KASA_CODEC_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define KASA_CODEC_NEON 1
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Scalar reference implementation.
+////////////////////////////////////////////////////////////////////////////////
+static uint8_t encrypt_scalar(const uint8_t* in, size_t len, uint8_t key,
+        uint8_t* out) {
+    for (size_t i = 0; i < len; i++) {
+        key ^= in[i];
+        out[i] = key;
+    }
+    return key;
+}
+
+static uint8_t decrypt_scalar(const uint8_t* in, size_t len, uint8_t key,
+        uint8_t* out) {
+    for (size_t i = 0; i < len; i++) {
+        out[i] = in[i] ^ key;
+        key = in[i];
+    }
+    return key;
+}
+
+#if defined(KASA_CODEC_X86) && defined(__SSE2__)
+////////////////////////////////////////////////////////////////////////////////
+// SSE2 - part of the x86-64 baseline. Encoding is a prefix XOR within each
+// 16 byte block (four shift/xor steps) followed by the carry from the block
+// before. Decoding xors each block with itself shifted by one byte.
+////////////////////////////////////////////////////////////////////////////////
+static uint8_t encrypt_sse2(const uint8_t* in, size_t len, uint8_t key,
+        uint8_t* out) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(in + i));
+        x = _mm_xor_si128(x, _mm_slli_si128(x, 1));
+        x = _mm_xor_si128(x, _mm_slli_si128(x, 2));
+        x = _mm_xor_si128(x, _mm_slli_si128(x, 4));
+        x = _mm_xor_si128(x, _mm_slli_si128(x, 8));
+        x = _mm_xor_si128(x, _mm_set1_epi8((char)key));
+        _mm_storeu_si128((__m128i*)(out + i), x);
+        key = out[i + 15];
+    }
+    return encrypt_scalar(in + i, len - i, key, out + i);
+}
+
+static uint8_t decrypt_sse2(const uint8_t* in, size_t len, uint8_t key,
+        uint8_t* out) {
+    if (!len) return key;
+    out[0] = in[0] ^ key;
+    size_t i = 1;
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(in + i));
+        __m128i p = _mm_loadu_si128((const __m128i*)(in + i - 1));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_xor_si128(x, p));
+    }
+    return decrypt_scalar(in + i, len - i, in[i - 1], out + i);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// AVX2 - selected at runtime. Byte shifts only work within 128-bit lanes, so
+// the low lane's last byte is carried into the high lane separately.
+////////////////////////////////////////////////////////////////////////////////
+__attribute__((target("avx2")))
+static uint8_t encrypt_avx2(const uint8_t* in, size_t len, uint8_t key,
+        uint8_t* out) {
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(in + i));
+        x = _mm256_xor_si256(x, _mm256_slli_si256(x, 1));
+        x = _mm256_xor_si256(x, _mm256_slli_si256(x, 2));
+        x = _mm256_xor_si256(x, _mm256_slli_si256(x, 4));
+        x = _mm256_xor_si256(x, _mm256_slli_si256(x, 8));
+        __m128i lo_carry = _mm_set1_epi8((char)_mm256_extract_epi8(x, 15));
+        x = _mm256_xor_si256(x, _mm256_inserti128_si256(
+            _mm256_setzero_si256(), lo_carry, 1));
+        x = _mm256_xor_si256(x, _mm256_set1_epi8((char)key));
+        _mm256_storeu_si256((__m256i*)(out + i), x);
+        key = out[i + 31];
+    }
+    return encrypt_sse2(in + i, len - i, key, out + i);
+}
+
+__attribute__((target("avx2")))
+static uint8_t decrypt_avx2(const uint8_t* in, size_t len, uint8_t key,
+        uint8_t* out) {
+    if (!len) return key;
+    out[0] = in[0] ^ key;
+    size_t i = 1;
+    for (; i + 32 <= len; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(in + i));
+        __m256i p = _mm256_loadu_si256((const __m256i*)(in + i - 1));
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_xor_si256(x, p));
+    }
+    return decrypt_sse2(in + i, len - i, in[i - 1], out + i);
+}
+#endif
+
+#if defined(KASA_CODEC_NEON)
+////////////////////////////////////////////////////////////////////////////////
+// NEON - vextq_u8(zero, x, 16 - n) shifts x up by n bytes.
+////////////////////////////////////////////////////////////////////////////////
+static uint8_t encrypt_neon(const uint8_t* in, size_t len, uint8_t key,
+        uint8_t* out) {
+    const uint8x16_t zero = vdupq_n_u8(0);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t x = vld1q_u8(in + i);
+        x = veorq_u8(x, vextq_u8(zero, x, 15));
+        x = veorq_u8(x, vextq_u8(zero, x, 14));
+        x = veorq_u8(x, vextq_u8(zero, x, 12));
+        x = veorq_u8(x, vextq_u8(zero, x, 8));
+        x = veorq_u8(x, vdupq_n_u8(key));
+        vst1q_u8(out + i, x);
+        key = out[i + 15];
+    }
+    return encrypt_scalar(in + i, len - i, key, out + i);
+}
+
+static uint8_t decrypt_neon(const uint8_t* in, size_t len, uint8_t key,
+        uint8_t* out) {
+    if (!len) return key;
+    out[0] = in[0] ^ key;
+    size_t i = 1;
+    for (; i + 16 <= len; i += 16)
+        vst1q_u8(out + i, veorq_u8(vld1q_u8(in + i), vld1q_u8(in + i - 1)));
+    return decrypt_scalar(in + i, len - i, in[i - 1], out + i);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Implementation selection.
+////////////////////////////////////////////////////////////////////////////////
+struct codec_impl {
+    const char* name;
+    uint8_t (*encrypt)(const uint8_t*, size_t, uint8_t, uint8_t*);
+    uint8_t (*decrypt)(const uint8_t*, size_t, uint8_t, uint8_t*);
+};
+
+static const codec_impl scalar_impl = {"scalar", encrypt_scalar, decrypt_scalar};
+
+static codec_impl best_impl() {
+#if defined(KASA_CODEC_X86) && defined(__SSE2__)
+    if (__builtin_cpu_supports("avx2"))
+        return {"avx2", encrypt_avx2, decrypt_avx2};
+    return {"sse2", encrypt_sse2, decrypt_sse2};
+#elif defined(KASA_CODEC_NEON)
+    return {"neon", encrypt_neon, decrypt_neon};
+#else
+    return scalar_impl;
+#endif
+}
+
+static codec_impl impl = best_impl();
+
+const char* kasa_codec::implementation() {
+    return impl.name;
+}
+
+void kasa_codec::use_scalar(bool scalar) {
+    impl = scalar ? scalar_impl : best_impl();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+uint8_t kasa_codec::encrypt(const uint8_t* in, size_t len, uint8_t key,
+        uint8_t* out) {
+    return impl.encrypt(in, len, key, out);
+}
+
+uint8_t kasa_codec::decrypt(const uint8_t* in, size_t len, uint8_t key,
+        uint8_t* out) {
+    return impl.decrypt(in, len, key, out);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+size_t kasa_codec::encode(const char* in, size_t len, char* out) {
+    for (int i = 0; i < HEADER_LEN; i++)
+        out[HEADER_LEN - 1 - i] = (len >> (8 * i)) & 255;
+    encrypt((const uint8_t*)in, len, INITIAL_KEY, (uint8_t*)out + HEADER_LEN);
+    return len + HEADER_LEN;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void kasa_codec::decoder::reset() {
+    header_len = 0;
+    msg_len = decoded = 0;
+    key = INITIAL_KEY;
+    failed = false;
+    plain.assign(1, '\0');
+}
+
+size_t kasa_codec::decoder::feed(const char* data, size_t len) {
+    if (plain.empty()) plain.assign(1, '\0');
+    size_t used = 0;
+    while (header_len < HEADER_LEN && used < len) {
+        header[header_len++] = data[used++];
+        if (header_len < HEADER_LEN) continue;
+        // The header is unsigned big-endian.
+        msg_len = ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) |
+            ((uint32_t)header[2] << 8) | (uint32_t)header[3];
+        if (msg_len > MAX_MESSAGE_LEN) {
+            failed = true;
+            return len;
+        }
+        plain.resize(msg_len + 1);
+        plain[msg_len] = '\0';
+    }
+    if (header_len < HEADER_LEN || failed) return used;
+
+    size_t n = len - used;
+    if (n > msg_len - decoded) n = msg_len - decoded;
+    key = decrypt((const uint8_t*)data + used, n, key,
+        (uint8_t*)plain.data() + decoded);
+    decoded += n;
+    return used + n;
+}
+
+bool kasa_codec::decoder::complete() const {
+    return header_len == HEADER_LEN && !failed && decoded == msg_len;
+}
+
+bool kasa_codec::decoder::error() const {
+    return failed;
+}
+
+const char* kasa_codec::decoder::c_str() const {
+    return plain.empty() ? "" : plain.data();
+}
+
+size_t kasa_codec::decoder::size() const {
+    return decoded;
+}
@@ -0,0 +1,93 @@
+
+#ifndef _KASA_CODEC_H_
+#define _KASA_CODEC_H_
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+////////////////////////////////////////////////////////////////////////////////
+// The kasa wire format is a 4 byte big-endian length followed by the payload
+// under an XOR autokey cipher with an initial key of 171:
+//     cipher[i] = plain[i] ^ cipher[i-1]
+//     plain[i]  = cipher[i] ^ cipher[i-1]
+// Decoding is independent per byte and encoding is a prefix XOR, so both are
+// vectorised (SSE2/AVX2 on x86, NEON on ARM) with a scalar fallback chosen at
+// startup.
+//
+// The scheme was reverse-engineered from the decode() function in
+// https://github.com/ggeorgovassilis/linuxscripts/tree/master/tp-link-hs100-smartplug/hs100.sh
+// by George Georgovassilis. George credits Thomas Baust for providing the
+// KASA device encoding scheme.
+////////////////////////////////////////////////////////////////////////////////
+class kasa_codec {
+public:
+    static inline const uint8_t INITIAL_KEY = 171;
+    static inline const int HEADER_LEN = 4;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Replies longer than this are treated as corrupt.
+    ////////////////////////////////////////////////////////////////////////////
+    static inline const uint32_t MAX_MESSAGE_LEN = 1 << 20;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Streaming decoder. Bytes are fed as they arrive, and only the new bytes
+    // are decoded. Replies of any length (up to MAX_MESSAGE_LEN) are accepted.
+    ////////////////////////////////////////////////////////////////////////////
+    class decoder {
+    private:
+        uint8_t header[HEADER_LEN];
+        int header_len = 0;
+        uint32_t msg_len = 0, decoded = 0;
+        uint8_t key = INITIAL_KEY;
+        bool failed = false;
+        std::vector<char> plain;
+
+    public:
+        ////////////////////////////////////////////////////////////////////////
+        // Prepare for a new message. The buffer is kept for reuse.
+        ////////////////////////////////////////////////////////////////////////
+        void reset();
+
+        ////////////////////////////////////////////////////////////////////////
+        // Decode newly received bytes. Returns the number consumed, which is
+        // less than 'len' only if the message completed within them.
+        ////////////////////////////////////////////////////////////////////////
+        size_t feed(const char* data, size_t len);
+
+        ////////////////////////////////////////////////////////////////////////
+        // The decoded payload. It is always null-terminated, and complete once
+        // complete() returns true.
+        ////////////////////////////////////////////////////////////////////////
+        bool complete() const;
+        bool error() const;
+        const char* c_str() const;
+        size_t size() const;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Encode 'len' bytes from 'in' into 'out', which must have room for
+    // encoded_size(len) bytes. Returns the encoded length.
+    ////////////////////////////////////////////////////////////////////////////
+    static size_t encoded_size(size_t len) { return len + HEADER_LEN; }
+    static size_t encode(const char* in, size_t len, char* out);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Raw cipher, without the length header. 'key' is the previous cipher byte
+    // (INITIAL_KEY at the start of a payload). 'in' and 'out' must not overlap.
+    // Returns the key for the bytes which follow.
+    ////////////////////////////////////////////////////////////////////////////
+    static uint8_t encrypt(const uint8_t* in, size_t len, uint8_t key,
+        uint8_t* out);
+    static uint8_t decrypt(const uint8_t* in, size_t len, uint8_t key,
+        uint8_t* out);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Name of the implementation in use ("avx2", "sse2", "neon" or "scalar").
+    // use_scalar() forces the scalar fallback, for testing and benchmarks.
+    ////////////////////////////////////////////////////////////////////////////
+    static const char* implementation();
+    static void use_scalar(bool scalar);
+};
+
+#endif
@@ -0,0 +1,314 @@
+
+#include "kasa_fleet.hpp"
+#include <cstring>
+#include <cerrno>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// RTO limits. Before the first reply the RTO is one second, which covers
+// slow Wi-Fi devices. Once known, fast devices time out in a fraction of the
+// old fixed 400ms, and the bound keeps a timeout from taking the whole sync.
+////////////////////////////////////////////////////////////////////////////////
+static const std::chrono::microseconds INITIAL_RTO(1000000);
+static const std::chrono::microseconds MIN_RTO(100000);
+static const std::chrono::microseconds MAX_RTO(4000000);
+
+std::atomic<int> kasa_fleet::open_count{0};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+kasa_fleet::conn::conn(const char* addr) : rto(INITIAL_RTO) {
+    strncpy(this->addr, addr, 64);
+    this->addr[63] = '\0';
+}
+
+kasa_fleet::conn::~conn() {
+    disconnect(this);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void kasa_fleet::conn::close_socket() {
+    io_loop::get().unwatch(this);
+    if (sock == -1) return;
+    close(sock);
+    sock = -1;
+    open_count--;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Called from the requesting thread with the loop lock held.
+////////////////////////////////////////////////////////////////////////////////
+void kasa_fleet::conn::on_invoke() {
+    sent = 0;
+    // A connection which the device would close before the reply could
+    // arrive is replaced up front.
+    if (sock != -1 && idle_close.count() &&
+            io_loop::clock::now() + rto >= last_used + idle_close)
+        reconnect = true;
+    if (reconnect || sock == -1) {
+        start_connect();
+        return;
+    }
+
+    // Clear the read buffer. Bytes left here belong to an earlier reply which
+    // timed out. Nothing has been sent yet, so a connection found closed is
+    // simply opened again.
+    char temp[256];
+    while (true) {
+        int n = recv(sock, temp, sizeof(temp), 0);
+        if (n > 0) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        start_connect();
+        return;
+    }
+
+    start_request();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void kasa_fleet::conn::start_connect() {
+    close_socket();
+    state = CONNECTING;
+
+    sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock == -1) {
+        finish(true);
+        return;
+    }
+    open_count++;
+
+    struct sockaddr_in sock_addr = {};
+    sock_addr.sin_family = AF_INET;
+    sock_addr.sin_port = htons(9999);
+    inet_pton(AF_INET, addr, &sock_addr.sin_addr);
+    if (!connect(sock, (struct sockaddr*)&sock_addr, sizeof(sock_addr))) {
+        start_request();
+        return;
+    }
+    if (errno != EINPROGRESS) {
+        finish(true);
+        return;
+    }
+
+    io_loop::get().watch(this, sock, EPOLLOUT);
+    io_loop::get().set_timer(this, io_loop::clock::now() + rto);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// The round trip is timed from here to the end of the reply, so it includes
+// the time the device takes to act on the request.
+////////////////////////////////////////////////////////////////////////////////
+void kasa_fleet::conn::start_request() {
+    state = WRITING;
+    sent_at = io_loop::clock::now();
+    try_write();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// RFC 6298, section 2. timing() reads the estimate from other threads, so it
+// is written under mtx.
+////////////////////////////////////////////////////////////////////////////////
+void kasa_fleet::conn::sample_rtt() {
+    auto r = std::chrono::duration_cast<std::chrono::microseconds>(
+        io_loop::clock::now() - sent_at);
+    std::unique_lock<std::mutex> lck(mtx);
+    if (!srtt.count()) {
+        srtt = r;
+        rttvar = r / 2;
+    } else {
+        rttvar = (3 * rttvar + (srtt > r ? srtt - r : r - srtt)) / 4;
+        srtt = (7 * srtt + r) / 8;
+    }
+    rto = std::min(std::max(srtt + 4 * rttvar, MIN_RTO), MAX_RTO);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void kasa_fleet::conn::try_write() {
+    while (sent < request_len) {
+        int n = send(sock, request + sent, request_len - sent, MSG_NOSIGNAL);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            io_loop::get().watch(this, sock, EPOLLOUT);
+            io_loop::get().set_timer(this, io_loop::clock::now() + rto);
+            return;
+        }
+        if (n <= 0) {
+            finish(true);
+            return;
+        }
+        sent += n;
+    }
+
+    state = READING;
+    io_loop::get().watch(this, sock, EPOLLIN);
+    io_loop::get().set_timer(this, io_loop::clock::now() + rto);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Feed whatever has arrived to the decoder. Only the new bytes are decoded.
+// The reply length is in the header, so the decoder knows when it is done.
+////////////////////////////////////////////////////////////////////////////////
+void kasa_fleet::conn::try_read() {
+    char buf[4096];
+    while (true) {
+        int n = recv(sock, buf, sizeof(buf), 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) {
+            finish(true);
+            return;
+        }
+        reply->feed(buf, n);
+        if (reply->error()) {
+            finish(true);
+            return;
+        }
+        if (reply->complete()) {
+            sample_rtt();
+            finish(false);
+            return;
+        }
+    }
+    io_loop::get().set_timer(this, io_loop::clock::now() + rto);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void kasa_fleet::conn::on_event(uint32_t events) {
+    if (state == IDLE) {
+        // The device closed the idle connection.
+        std::unique_lock<std::mutex> lck(mtx);
+        idle_close = std::chrono::duration_cast<std::chrono::microseconds>(
+            io_loop::clock::now() - last_used);
+        lck.unlock();
+        close_socket();
+    } else if (state == CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err || (events & (EPOLLERR | EPOLLHUP))) {
+            finish(true);
+            return;
+        }
+        start_request();
+    } else if (state == WRITING) {
+        try_write();
+    } else if (state == READING) {
+        try_read();
+    }
+}
+
+void kasa_fleet::conn::on_timer() {
+    if (state == IDLE) return;
+    if (state != CONNECTING) {
+        std::unique_lock<std::mutex> lck(mtx);
+        rto = std::min(2 * rto, MAX_RTO);
+    }
+    finish(true);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// An idle connection is only watched for the device closing it, so it costs
+// nothing in the loop until then. Then wake the waiting thread, or call the
+// callback. The conn is IDLE by then, so the callback may start another
+// transaction.
+////////////////////////////////////////////////////////////////////////////////
+void kasa_fleet::conn::finish(bool error) {
+    io_loop::get().cancel_timer(this);
+    unreachable = error && state == CONNECTING;
+    if (error) {
+        close_socket();
+    } else {
+        last_used = io_loop::clock::now();
+        io_loop::get().watch(this, sock, EPOLLRDHUP);
+    }
+    state = IDLE;
+
+    std::unique_lock<std::mutex> lck(mtx);
+    this->error = error;
+    done = true;
+    cv.notify_all();
+    lck.unlock();
+
+    callback cb;
+    cb.swap(done_cb);
+    if (cb) cb(!error, unreachable);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+bool kasa_fleet::transact(conn* c, const char* request, int request_len,
+        kasa_codec::decoder* reply, bool reconnect, bool* unreachable) {
+    // The conn is IDLE, so the loop thread will not touch these fields until
+    // invoke() below.
+    c->request = request;
+    c->request_len = request_len;
+    c->reply = reply;
+    reply->reset();
+    c->reconnect = reconnect;
+    std::unique_lock<std::mutex> lck(c->mtx);
+    c->done = false;
+    lck.unlock();
+
+    io_loop::get().invoke(c);
+
+    lck.lock();
+    while (!c->done) c->cv.wait(lck);
+    if (unreachable) *unreachable = c->unreachable;
+    return !c->error;
+}
+
+void kasa_fleet::transact_async(conn* c, const char* request, int request_len,
+        kasa_codec::decoder* reply, bool reconnect, callback done) {
+    c->request = request;
+    c->request_len = request_len;
+    c->reply = reply;
+    reply->reset();
+    c->reconnect = reconnect;
+    c->done_cb = std::move(done);
+    std::unique_lock<std::mutex> lck(c->mtx);
+    c->done = false;
+    lck.unlock();
+
+    io_loop::get().invoke(c);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void kasa_fleet::disconnect(conn* c) {
+    io_loop::get().remove(c);
+    if (c->sock != -1) {
+        close(c->sock);
+        c->sock = -1;
+        open_count--;
+    }
+    c->state = conn::IDLE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void kasa_fleet::timing(conn* c, int* srtt_ms, int* rto_ms, int* idle_close_ms) {
+    std::unique_lock<std::mutex> lck(c->mtx);
+    *srtt_ms = c->srtt.count() / 1000;
+    *rto_ms = c->rto.count() / 1000;
+    *idle_close_ms = c->idle_close.count() / 1000;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+int kasa_fleet::socket_count() {
+    return open_count;
+}
@@ -0,0 +1,143 @@
+
+#ifndef _KASA_FLEET_H_
+#define _KASA_FLEET_H_
+
+#include "io_loop.hpp"
+#include "kasa_codec.hpp"
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+////////////////////////////////////////////////////////////////////////////////
+// All kasa sockets are driven from the shared io_loop. Each device has a
+// conn, which steps through a small state machine (connect, write, read and
+// decode) without blocking. A transaction either completes through a
+// callback on the loop thread, or the thread that asked for it waits on a
+// condition variable rather than in poll().
+//
+// Timeouts follow each device. Every reply is a round trip sample for a
+// smoothed RTT and variance estimator, as TCP does (RFC 6298), and the
+// retransmission timeout (RTO) derived from them bounds the connect, the
+// wait for the reply and the wait for the rest of it. A reply timeout doubles
+// the RTO until the next good reply.
+//
+// Devices close connections which stay idle for a while. An idle conn
+// watches for the close, learns the idle timeout from it and closes its end
+// at once. A transaction which could not complete before the device's idle
+// timeout opens a new connection first, rather than racing the close.
+////////////////////////////////////////////////////////////////////////////////
+class kasa_fleet {
+public:
+    ////////////////////////////////////////////////////////////////////////////
+    // 'ok' is false on any error or timeout. 'unreachable' is set if the error
+    // was that no connection could be made.
+    ////////////////////////////////////////////////////////////////////////////
+    using callback = std::function<void(bool ok, bool unreachable)>;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // A connection to one kasa device. Only one transaction may be in flight
+    // per conn. The kasa module guarantees this because sync() never runs
+    // concurrently with itself.
+    ////////////////////////////////////////////////////////////////////////////
+    class conn : public io_loop::handler {
+        friend class kasa_fleet;
+    private:
+        ////////////////////////////////////////////////////////////////////////
+        // Connection states
+        ////////////////////////////////////////////////////////////////////////
+        static inline const int IDLE = 0;
+        static inline const int CONNECTING = 1;
+        static inline const int WRITING = 2;
+        static inline const int READING = 3;
+
+        ////////////////////////////////////////////////////////////////////////
+        // Only touched with the io_loop lock held, or while IDLE.
+        ////////////////////////////////////////////////////////////////////////
+        char addr[64];
+        int sock = -1;
+        int state = IDLE;
+        bool reconnect = false, unreachable = false;
+        const char* request = nullptr;
+        int request_len = 0, sent = 0;
+        kasa_codec::decoder* reply = nullptr;
+        callback done_cb;
+
+        ////////////////////////////////////////////////////////////////////////
+        // Round trip estimate and idle timeout - only touched with the io_loop
+        // lock held, or while IDLE. 'srtt', 'rttvar', 'rto' and 'idle_close'
+        // are also read by timing(), so they are written with mtx held.
+        // 'idle_close' is zero until a close was seen.
+        ////////////////////////////////////////////////////////////////////////
+        std::chrono::microseconds srtt{0}, rttvar{0}, rto;
+        std::chrono::microseconds idle_close{0};
+        io_loop::clock::time_point sent_at, last_used;
+
+        ////////////////////////////////////////////////////////////////////////
+        // Completion - protected by mtx.
+        ////////////////////////////////////////////////////////////////////////
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool done = true, error = false;
+
+        void on_event(uint32_t events);
+        void on_timer();
+        void on_invoke();
+
+        void start_connect();
+        void try_write();
+        void try_read();
+        void close_socket();
+        void start_request();
+        void sample_rtt();
+        void finish(bool error);
+
+    public:
+        conn(const char* addr);
+        ~conn();
+    };
+
+private:
+    static std::atomic<int> open_count;
+
+public:
+    ////////////////////////////////////////////////////////////////////////////
+    // Send an encoded request and wait for a complete reply. Received bytes
+    // are fed to 'reply' as they arrive.
+    // A new socket is opened if there is none or if 'reconnect' is set.
+    // Returns false on any error or timeout. The socket is closed on error.
+    // 'unreachable' is set if the error was that no connection could be made,
+    // in which case trying again at once is pointless.
+    ////////////////////////////////////////////////////////////////////////////
+    static bool transact(conn* c, const char* request, int request_len,
+        kasa_codec::decoder* reply, bool reconnect, bool* unreachable = nullptr);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Like transact(), but returns at once. 'done' is called once the reply is
+    // complete or the transaction failed, on the loop thread with the loop
+    // lock held (or on the calling thread, if it failed straight away). It
+    // must not block, and may start the next transaction on the conn.
+    // 'request' and 'reply' must stay valid until then.
+    ////////////////////////////////////////////////////////////////////////////
+    static void transact_async(conn* c, const char* request, int request_len,
+        kasa_codec::decoder* reply, bool reconnect, callback done);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Close the connection. The next transaction opens a new one.
+    ////////////////////////////////////////////////////////////////////////////
+    static void disconnect(conn* c);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Current timing of a conn, in milliseconds. 'srtt' is 0 before the first
+    // reply, 'idle_close' before the device first closed an idle connection.
+    // Call this between transactions.
+    ////////////////////////////////////////////////////////////////////////////
+    static void timing(conn* c, int* srtt_ms, int* rto_ms, int* idle_close_ms);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Number of sockets currently open across every conn.
+    ////////////////////////////////////////////////////////////////////////////
+    static int socket_count();
+};
+
+#endif
@@ -0,0 +1,244 @@
+
+#include "kasa_reply.hpp"
+#include <cstring>
+#include <cmath>
+
+////////////////////////////////////////////////////////////////////////////////
+// A minimal recursive descent JSON tokenizer. It keeps the path of member
+// names (or array indices) leading to the current value so that each scalar
+// can be matched against the few paths we care about.
+////////////////////////////////////////////////////////////////////////////////
+namespace {
+
+struct reply_parser {
+    static inline const int MAX_DEPTH = 16;
+
+    const char* p;
+    const char* end;
+    kasa_reply* r;
+    int depth = 0;
+    const char* key[MAX_DEPTH];
+    int key_len[MAX_DEPTH];
+    int index[MAX_DEPTH];
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    bool is(int level, const char* name) {
+        if (!key[level]) return false;
+        int n = strlen(name);
+        return key_len[level] == n && !memcmp(key[level], name, n);
+    }
+
+    bool in_sysinfo() {
+        return depth == 3 && is(0, "system") && is(1, "get_sysinfo");
+    }
+
+    bool in_realtime() {
+        return depth == 3 && is(0, "emeter") && is(1, "get_realtime");
+    }
+
+    kasa_reply::child* in_child() {
+        if (depth != 5 || !is(0, "system") || !is(1, "get_sysinfo") ||
+                !is(2, "children") || key[3] || index[3] >= kasa_reply::MAX_CHILDREN)
+            return nullptr;
+        if (r->child_count <= index[3]) r->child_count = index[3] + 1;
+        return &r->children[index[3]];
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Called for every number and string, with the path in key[0..depth).
+    ////////////////////////////////////////////////////////////////////////////
+    void on_number(double v) {
+        int i = (int)llround(v);
+        int milli = (int)llround(v * 1000);
+        if (in_sysinfo()) {
+            if (is(2, "relay_state")) r->relay_state = i;
+            else if (is(2, "brightness")) r->brightness = i;
+            else if (is(2, "on_time")) r->on_time = i;
+            else if (is(2, "rssi")) {
+                r->rssi = i;
+                r->has_rssi = true;
+            }
+        } else if (in_realtime()) {
+            if (is(2, "power_mw")) r->power_mw = i;
+            else if (is(2, "total_wh")) r->total_wh = i;
+            else if (is(2, "voltage_mv")) r->voltage_mv = i;
+            else if (is(2, "current_ma")) r->current_ma = i;
+            else if (is(2, "power")) r->power_mw = milli;
+            else if (is(2, "total")) r->total_wh = milli;
+            else if (is(2, "voltage")) r->voltage_mv = milli;
+            else if (is(2, "current")) r->current_ma = milli;
+        } else if (kasa_reply::child* c = in_child()) {
+            if (is(4, "state")) c->state = i;
+            else if (is(4, "on_time")) c->on_time = i;
+        }
+    }
+
+    void on_string(const char* s, int len) {
+        if (kasa_reply::child* c = in_child()) {
+            if (is(4, "id")) {
+                c->id = s;
+                c->id_len = len;
+            } else if (is(4, "alias")) {
+                c->alias = s;
+                c->alias_len = len;
+            }
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Tokens
+    ////////////////////////////////////////////////////////////////////////////
+    void skip_ws() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+            p++;
+    }
+
+    bool parse_string(const char** s, int* len) {
+        if (p >= end || *p != '"') return false;
+        const char* start = ++p;
+        while (p < end && *p != '"') {
+            if (*p == '\\') p++;
+            p++;
+        }
+        if (p >= end) return false;
+        *s = start;
+        *len = p - start;
+        p++;
+        return true;
+    }
+
+    bool parse_number(double* v) {
+        bool neg = false;
+        if (p < end && *p == '-') {
+            neg = true;
+            p++;
+        }
+        if (p >= end || *p < '0' || *p > '9') return false;
+        double x = 0;
+        while (p < end && *p >= '0' && *p <= '9') x = x * 10 + (*p++ - '0');
+        if (p < end && *p == '.') {
+            double scale = 0.1;
+            p++;
+            while (p < end && *p >= '0' && *p <= '9') {
+                x += (*p++ - '0') * scale;
+                scale *= 0.1;
+            }
+        }
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            p++;
+            bool exp_neg = false;
+            if (p < end && (*p == '+' || *p == '-')) exp_neg = (*p++ == '-');
+            int exp = 0;
+            while (p < end && *p >= '0' && *p <= '9') exp = exp * 10 + (*p++ - '0');
+            x *= pow(10, exp_neg ? -exp : exp);
+        }
+        *v = neg ? -x : x;
+        return true;
+    }
+
+    bool parse_literal(const char* lit) {
+        int n = strlen(lit);
+        if (end - p < n || memcmp(p, lit, n)) return false;
+        p += n;
+        return true;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Grammar
+    ////////////////////////////////////////////////////////////////////////////
+    bool parse_value() {
+        skip_ws();
+        if (p >= end) return false;
+        if (*p == '{') return parse_object();
+        if (*p == '[') return parse_array();
+        if (*p == '"') {
+            const char* s;
+            int len;
+            if (!parse_string(&s, &len)) return false;
+            on_string(s, len);
+            return true;
+        }
+        if (*p == 't') return parse_literal("true");
+        if (*p == 'f') return parse_literal("false");
+        if (*p == 'n') return parse_literal("null");
+        double v;
+        if (!parse_number(&v)) return false;
+        on_number(v);
+        return true;
+    }
+
+    bool parse_object() {
+        if (depth >= MAX_DEPTH) return false;
+        p++;
+        skip_ws();
+        if (p < end && *p == '}') {
+            p++;
+            return true;
+        }
+        while (true) {
+            skip_ws();
+            if (!parse_string(&key[depth], &key_len[depth])) return false;
+            skip_ws();
+            if (p >= end || *p != ':') return false;
+            p++;
+            depth++;
+            bool ok = parse_value();
+            depth--;
+            if (!ok) return false;
+            skip_ws();
+            if (p < end && *p == ',') {
+                p++;
+                continue;
+            }
+            if (p < end && *p == '}') {
+                p++;
+                return true;
+            }
+            return false;
+        }
+    }
+
+    bool parse_array() {
+        if (depth >= MAX_DEPTH) return false;
+        p++;
+        skip_ws();
+        if (p < end && *p == ']') {
+            p++;
+            return true;
+        }
+        key[depth] = nullptr;
+        for (index[depth] = 0; ; index[depth]++) {
+            depth++;
+            bool ok = parse_value();
+            depth--;
+            if (!ok) return false;
+            skip_ws();
+            if (p < end && *p == ',') {
+                p++;
+                continue;
+            }
+            if (p < end && *p == ']') {
+                p++;
+                return true;
+            }
+            return false;
+        }
+    }
+};
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+bool kasa_reply::parse(const char* json, size_t len) {
+    reply_parser parser;
+    parser.p = json;
+    parser.end = json + len;
+    parser.r = this;
+    if (!parser.parse_value()) return false;
+    parser.skip_ws();
+    return parser.p == parser.end;
+}
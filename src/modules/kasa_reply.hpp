@@ -0,0 +1,57 @@
+
+#ifndef _KASA_REPLY_H_
+#define _KASA_REPLY_H_
+
+#include <cstddef>
+
+////////////////////////////////////////////////////////////////////////////////
+// Fields of interest from a decoded get_sysinfo / get_realtime reply. The
+// reply is tokenized in one pass with JSON nesting taken into account, so a
+// field only matches at its documented path; for example, "brightness" inside
+// a schedule rule is ignored. Nothing is allocated. String fields point into
+// the reply buffer and are only valid while it is.
+//
+// Numeric fields are -1 when absent. Older emeters report floating point
+// "power" (W), "total" (kWh), "voltage" (V) and "current" (A); these are
+// converted to the integer units below.
+////////////////////////////////////////////////////////////////////////////////
+struct kasa_reply {
+    ////////////////////////////////////////////////////////////////////////////
+    // system.get_sysinfo
+    ////////////////////////////////////////////////////////////////////////////
+    int relay_state = -1;
+    int brightness = -1;
+    int on_time = -1;
+    int rssi = -1;
+    bool has_rssi = false;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // emeter.get_realtime
+    ////////////////////////////////////////////////////////////////////////////
+    int power_mw = -1;
+    int total_wh = -1;
+    int voltage_mv = -1;
+    int current_ma = -1;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // system.get_sysinfo.children - outlets of power strips.
+    ////////////////////////////////////////////////////////////////////////////
+    static inline const int MAX_CHILDREN = 8;
+    struct child {
+        const char* id = nullptr;
+        int id_len = 0;
+        const char* alias = nullptr;
+        int alias_len = 0;
+        int state = -1;
+        int on_time = -1;
+    } children[MAX_CHILDREN];
+    int child_count = 0;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Parse 'len' bytes of JSON. Returns false if the text is not well formed;
+    // fields found before the error are kept.
+    ////////////////////////////////////////////////////////////////////////////
+    bool parse(const char* json, size_t len);
+};
+
+#endif
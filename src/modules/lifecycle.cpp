@@ -0,0 +1,123 @@
+
+#include "lifecycle.hpp"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+lifecycle::lifecycle() {
+    char name[64];
+    strncpy(name, "LIFECYCLE", 64);
+    set_name(name);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+int lifecycle::find(module* m) {
+    for (int i = 0; i < (int)entries.size(); i++)
+        if (entries[i].m == m) return i;
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void lifecycle::add(module* m, const char* name, std::vector<module*> depends_on) {
+    entry e;
+    e.m = m;
+    strncpy(e.name, name, 64);
+    e.name[63] = 0;
+    int id = entries.size();
+    for (module* d : depends_on) {
+        int di = find(d);
+        if (di < 0) {
+            char report_str[128];
+            snprintf(report_str, 128, "Error: %s depends on a module which was "
+                "not added first. Dependency ignored.", e.name);
+            report(report_str, 0);
+            continue;
+        }
+        e.depends_on.push_back(di);
+        entries[di].dependents.push_back(id);
+    }
+    entries.push_back(e);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+std::vector<module*> lifecycle::modules() {
+    std::vector<module*> res;
+    for (entry& e : entries) res.push_back(e.m);
+    return res;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// The callback may run before enable_async()/disable_async() returns, so
+// launch() is called without mtx held.
+////////////////////////////////////////////////////////////////////////////////
+void lifecycle::launch(int i, bool start) {
+    std::function<void()> callback = [this, i]() {
+        std::unique_lock<std::mutex> lck(mtx);
+        finished.push_back(i);
+        cv.notify_all();
+    };
+    entries[i].begin = hc::now();
+    if (start) entries[i].m->enable_async(std::move(callback));
+    else entries[i].m->disable_async(std::move(callback));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Starting walks the graph from modules without dependencies, stopping walks
+// it from modules without dependents.
+////////////////////////////////////////////////////////////////////////////////
+void lifecycle::run(bool start) {
+    const char* verb = start ? "started" : "stopped";
+    hc::time_point begin = hc::now();
+    int count = entries.size();
+    std::vector<int> waiting_on(count);
+    for (int i = 0; i < count; i++)
+        waiting_on[i] = start ? entries[i].depends_on.size() :
+            entries[i].dependents.size();
+    for (int i = 0; i < count; i++)
+        if (!waiting_on[i]) launch(i, start);
+
+    int slowest = -1;
+    for (int pending = count; pending > 0; pending--) {
+        std::unique_lock<std::mutex> lck(mtx);
+        while (finished.empty()) cv.wait(lck);
+        int i = finished.back();
+        finished.pop_back();
+        lck.unlock();
+
+        entry& e = entries[i];
+        // The final sync() is done, this only releases the scheduler task.
+        if (!start) e.m->disable();
+        e.seconds = std::chrono::duration<double>(hc::now() - e.begin).count();
+        if (slowest < 0 || e.seconds > entries[slowest].seconds) slowest = i;
+        char report_str[128];
+        snprintf(report_str, 128, "%s %s in %.3fs", verb, e.name, e.seconds);
+        report(report_str, 2);
+
+        for (int j : start ? e.dependents : e.depends_on)
+            if (!--waiting_on[j]) launch(j, start);
+    }
+
+    char report_str[192];
+    snprintf(report_str, 192, "%s %d modules in %.3fs, slowest %s (%.3fs)",
+        verb, count, std::chrono::duration<double>(hc::now() - begin).count(),
+        slowest < 0 ? "none" : entries[slowest].name,
+        slowest < 0 ? 0.0 : entries[slowest].seconds);
+    report(report_str, 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void lifecycle::start() {
+    run(true);
+}
+
+void lifecycle::stop() {
+    run(false);
+}
@@ -0,0 +1,68 @@
+
+#ifndef _LIFECYCLE_H_
+#define _LIFECYCLE_H_
+
+#include "module.hpp"
+
+////////////////////////////////////////////////////////////////////////////////
+// Starts and stops a set of modules, as concurrently as their dependencies
+// allow. A module is enabled once every module it depends on has completed its
+// first sync(), and disabled once every module depending on it is disabled.
+// Independent modules therefore start and stop together, and a cold start
+// takes about as long as the slowest chain of dependencies.
+////////////////////////////////////////////////////////////////////////////////
+class lifecycle : public unit {
+private:
+    using hc = std::chrono::steady_clock;
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    struct entry {
+        module* m;
+        char name[64];
+        std::vector<int> depends_on, dependents;
+        hc::time_point begin;
+        double seconds = 0;
+    };
+    std::vector<entry> entries;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Completion callbacks run on scheduler workers and only queue the index
+    // of their entry. Everything else happens on the thread in start()/stop().
+    ////////////////////////////////////////////////////////////////////////////
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::vector<int> finished;
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    int find(module* m);
+    void launch(int i, bool start);
+    void run(bool start);
+
+public:
+    lifecycle();
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Dependencies must be added before the modules that depend on them, so
+    // the graph can not contain cycles.
+    ////////////////////////////////////////////////////////////////////////////
+    void add(module* m, const char* name, std::vector<module*> depends_on = {});
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Every module added so far.
+    ////////////////////////////////////////////////////////////////////////////
+    std::vector<module*> modules();
+
+    ////////////////////////////////////////////////////////////////////////////
+    // start() blocks until every module has completed its first sync(). stop()
+    // blocks until every module is disabled. Both report the time taken by
+    // each module.
+    ////////////////////////////////////////////////////////////////////////////
+    void start();
+    void stop();
+};
+
+#endif
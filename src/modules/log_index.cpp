@@ -0,0 +1,309 @@
+
+#include "log_index.hpp"
+#include <cstring>
+#include <cstdio>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Sidecar layout (native byte order, it never leaves the machine):
+//   magic[8], inode, covered, tail hash, entry count, text count
+//   texts: uint32 length, bytes
+//   entries: int64 time, uint32 key length, key bytes
+////////////////////////////////////////////////////////////////////////////////
+static const char MAGIC[8] = {'I', 'O', 'T', 'I', 'D', 'X', '0', '2'};
+static const int SAVE_INTERVAL = 60;
+static const size_t CHUNK = 1 << 20;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+log_index& log_index::get() {
+    static log_index* i = new log_index();
+    return *i;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// FNV-1a over the (up to) 4KB before 'end'. Detects a log which was replaced
+// by a different file of at least the same size.
+////////////////////////////////////////////////////////////////////////////////
+uint64_t log_index::tail_hash(int fd, uint64_t end) {
+    char buf[4096];
+    uint64_t start = end > sizeof(buf) ? end - sizeof(buf) : 0;
+    ssize_t n = pread(fd, buf, end - start, start);
+    uint64_t hash = 14695981039346656037ull;
+    for (ssize_t i = 0; i < n; i++) {
+        hash ^= (unsigned char)buf[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+bool log_index::load_sidecar() {
+    char path[272];
+    snprintf(path, sizeof(path), "%s.idx", log_file);
+    FILE* f = fopen(path, "r");
+    if (!f) return false;
+
+    char magic[8];
+    uint64_t header[5];
+    bool ok = fread(magic, 8, 1, f) == 1 && !memcmp(magic, MAGIC, 8) &&
+        fread(header, sizeof(header), 1, f) == 1;
+
+    if (ok) {
+        int fd = open(log_file, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        ok = fd != -1 && !fstat(fd, &st) && (uint64_t)st.st_ino == header[0] &&
+            (uint64_t)st.st_size >= header[1] &&
+            tail_hash(fd, header[1]) == header[2];
+        if (fd != -1) close(fd);
+    }
+
+    std::vector<char> key;
+    std::unordered_set<std::string> covered_texts;
+    for (uint64_t i = 0; ok && i < header[4]; i++) {
+        uint32_t len;
+        ok = fread(&len, sizeof(len), 1, f) == 1 && len < 4096;
+        if (!ok) break;
+        key.resize(len);
+        ok = !len || fread(key.data(), len, 1, f) == 1;
+        if (ok) covered_texts.insert(std::string(key.data(), len));
+    }
+    for (uint64_t i = 0; ok && i < header[3]; i++) {
+        int64_t time;
+        uint32_t len;
+        ok = fread(&time, sizeof(time), 1, f) == 1 &&
+            fread(&len, sizeof(len), 1, f) == 1 && len < 4096;
+        if (!ok) break;
+        key.resize(len);
+        ok = !len || fread(key.data(), len, 1, f) == 1;
+        if (ok) last_seen[std::string(key.data(), len)] = time;
+    }
+    fclose(f);
+
+    if (!ok) {
+        last_seen.clear();
+        return false;
+    }
+    inode = header[0];
+    covered = header[1];
+    // Texts added since the sidecar was saved were not indexed. Their lines
+    // may be anywhere in the log.
+    for (const std::string& text : texts)
+        if (!covered_texts.count(text)) rescan = true;
+    texts.insert(covered_texts.begin(), covered_texts.end());
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Write-then-rename so that a crash never leaves a partial sidecar.
+////////////////////////////////////////////////////////////////////////////////
+void log_index::save_sidecar() {
+    char path[272], tmp_path[280];
+    snprintf(path, sizeof(path), "%s.idx", log_file);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.idx.tmp", log_file);
+
+    int fd = open(log_file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return;
+    uint64_t header[5] = {inode, covered, tail_hash(fd, covered),
+        last_seen.size(), texts.size()};
+    close(fd);
+
+    FILE* f = fopen(tmp_path, "w");
+    if (!f) return;
+    bool ok = fwrite(MAGIC, 8, 1, f) == 1 &&
+        fwrite(header, sizeof(header), 1, f) == 1;
+    for (auto it = texts.begin(); ok && it != texts.end(); it++) {
+        uint32_t len = it->size();
+        ok = fwrite(&len, sizeof(len), 1, f) == 1 &&
+            (!len || fwrite(it->data(), len, 1, f) == 1);
+    }
+    for (auto it = last_seen.begin(); ok && it != last_seen.end(); it++) {
+        int64_t time = it->second;
+        uint32_t len = it->first.size();
+        ok = fwrite(&time, sizeof(time), 1, f) == 1 &&
+            fwrite(&len, sizeof(len), 1, f) == 1 &&
+            (!len || fwrite(it->first.data(), len, 1, f) == 1);
+    }
+    ok = (fclose(f) == 0) && ok;
+    if (ok && !rename(tmp_path, path)) {
+        dirty = false;
+        last_save = ::time(nullptr);
+    } else {
+        unlink(tmp_path);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Records the line if its text is indexed.
+////////////////////////////////////////////////////////////////////////////////
+void log_index::index(const char* name, int name_len, const char* text,
+        int text_len, time_t time) {
+    static thread_local std::string key;
+    key.assign(text, text_len);
+    if (!texts.count(key)) return;
+    key.insert(0, " ; ");
+    key.insert(0, name, name_len);
+    last_seen[key] = time;
+    dirty = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Index complete lines from 'covered' to the end of the log. A partial line
+// at the end is left for the next call; the writer may be mid-append.
+// Log lines look like "<%c time> ; <name> ; <text>".
+////////////////////////////////////////////////////////////////////////////////
+void log_index::scan_tail() {
+    int fd = open(log_file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return;
+    struct stat st;
+    if (fstat(fd, &st) || (uint64_t)st.st_ino != inode ||
+            (uint64_t)st.st_size < covered) {
+        // A different or truncated file. Start over.
+        last_seen.clear();
+        covered = 0;
+        inode = st.st_ino;
+        dirty = true;
+    } else if (rescan) {
+        // The log is in time order, so rescanning it keeps the entries right.
+        covered = 0;
+        dirty = true;
+    }
+    rescan = false;
+    if ((uint64_t)st.st_size == covered) {
+        close(fd);
+        return;
+    }
+
+    std::vector<char> buf(CHUNK);
+    char time_str[64] = "";
+    time_t time = 0;
+    size_t have = 0;
+    uint64_t offset = covered;
+    while (true) {
+        ssize_t n = pread(fd, buf.data() + have, buf.size() - have,
+            offset + have);
+        if (n <= 0) break;
+        have += n;
+
+        char* line = buf.data();
+        char* end = buf.data() + have;
+        while (true) {
+            char* nl = (char*)memchr(line, '\n', end - line);
+            if (!nl) break;
+            char* sep = (char*)memmem(line, nl - line, " ; ", 3);
+            if (sep && sep - line < 64) {
+                // Consecutive lines usually share a timestamp.
+                if (strncmp(time_str, line, sep - line) ||
+                        time_str[sep - line]) {
+                    memcpy(time_str, line, sep - line);
+                    time_str[sep - line] = '\0';
+                    struct tm tm = {};
+                    strptime(time_str, "%c", &tm);
+                    tm.tm_isdst = -1;
+                    time = mktime(&tm);
+                }
+                char* name = sep + 3;
+                char* text_sep = (char*)memmem(name, nl - name, " ; ", 3);
+                if (text_sep)
+                    index(name, text_sep - name, text_sep + 3, nl - text_sep - 3,
+                        time);
+            }
+            line = nl + 1;
+        }
+
+        size_t used = line - buf.data();
+        offset += used;
+        have -= used;
+        memmove(buf.data(), line, have);
+        // A single line longer than the buffer; grow rather than stall.
+        if (have == buf.size()) buf.resize(buf.size() * 2);
+    }
+    close(fd);
+
+    if (offset != covered) {
+        covered = offset;
+        dirty = true;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void log_index::load() {
+    if (loaded || !log_file[0]) return;
+    loaded = true;
+    if (!load_sidecar()) {
+        covered = 0;
+        inode = 0;
+    }
+    scan_tail();
+    if (dirty) save_sidecar();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void log_index::set_log_file(const char* log_file) {
+    std::unique_lock<std::mutex> lck(mtx);
+    if (loaded && dirty) save_sidecar();
+    last_seen.clear();
+    loaded = dirty = rescan = false;
+    covered = inode = 0;
+    strncpy(this->log_file, log_file, 256);
+    this->log_file[255] = '\0';
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void log_index::add_text(const char* text) {
+    std::unique_lock<std::mutex> lck(mtx);
+    if (texts.insert(text).second && loaded) rescan = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Lines that do not directly follow the covered range are skipped here and
+// picked up by the next scan_tail().
+////////////////////////////////////////////////////////////////////////////////
+void log_index::append(time_t time, const char* name, const char* text,
+        uint64_t offset, uint64_t len) {
+    std::unique_lock<std::mutex> lck(mtx);
+    if (!loaded || offset != covered) return;
+    index(name, strlen(name), text, strlen(text), time);
+    covered += len;
+    dirty = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+bool log_index::lookup(const char* name, const char* text, time_t* time) {
+    std::unique_lock<std::mutex> lck(mtx);
+    if (!log_file[0]) return false;
+    if (texts.insert(text).second && loaded) rescan = true;
+    if (!loaded) load();
+    else scan_tail();
+    std::string key(name);
+    key += " ; ";
+    key += text;
+    auto it = last_seen.find(key);
+    if (it == last_seen.end()) return false;
+    *time = it->second;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void log_index::save(bool force) {
+    std::unique_lock<std::mutex> lck(mtx);
+    if (!loaded || !dirty) return;
+    if (!force && ::time(nullptr) - last_save < SAVE_INTERVAL) return;
+    save_sidecar();
+}
@@ -0,0 +1,98 @@
+
+#ifndef _LOG_INDEX_H_
+#define _LOG_INDEX_H_
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <ctime>
+#include <cstdint>
+
+////////////////////////////////////////////////////////////////////////////////
+// Answers "when was this record last written to the log" without reading the
+// whole log. The index maps "name ; text" to the time of the most recent
+// matching line. It covers the log up to a byte offset.
+//
+// Only lines whose text was added with add_text() are indexed, so that
+// records which are never looked up (power readings, say) do not grow the
+// index with every line. lookup() adds its text too, but a text which is new
+// once the index is loaded costs a scan of the whole log.
+//
+// The index is persisted next to the log as "<log file>.idx". On first use
+// the sidecar is loaded and only the part of the log written after it was
+// saved is scanned. With no usable sidecar, the whole log is scanned once.
+// After that, records appended by the log writer update the index directly.
+//
+// The sidecar is only a cache. It is ignored if the log was replaced or
+// truncated.
+////////////////////////////////////////////////////////////////////////////////
+class log_index {
+private:
+    ////////////////////////////////////////////////////////////////////////////
+    // All state is protected by mtx.
+    ////////////////////////////////////////////////////////////////////////////
+    std::mutex mtx;
+    char log_file[256] = "";
+    bool loaded = false, dirty = false;
+    std::unordered_map<std::string, time_t> last_seen;
+    std::unordered_set<std::string> texts;
+    bool rescan = false;
+    uint64_t covered = 0;
+    uint64_t inode = 0;
+    time_t last_save = 0;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Helpers - all require mtx to be held.
+    ////////////////////////////////////////////////////////////////////////////
+    void load();
+    bool load_sidecar();
+    void save_sidecar();
+    void scan_tail();
+    void index(const char* name, int name_len, const char* text, int text_len,
+        time_t time);
+    uint64_t tail_hash(int fd, uint64_t end);
+
+    log_index() {}
+
+public:
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    static log_index& get();
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Switch to another log file. The sidecar for the old one is saved.
+    ////////////////////////////////////////////////////////////////////////////
+    void set_log_file(const char* log_file);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Index lines with this exact text. Call before the first lookup() of the
+    // text, so that one scan covers all of them. The sidecar remembers the
+    // texts, so later starts need no scan.
+    ////////////////////////////////////////////////////////////////////////////
+    void add_text(const char* text);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Called by the log writer for every line appended to the log file, once
+    // the line has been flushed. 'offset' and 'len' give the position of the
+    // line in the file.
+    ////////////////////////////////////////////////////////////////////////////
+    void append(time_t time, const char* name, const char* text,
+        uint64_t offset, uint64_t len);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Looks up the time of the last line matching "name ; text" exactly.
+    // Returns false if there is none. The caller must make sure pending log
+    // records have been written (see log_ring::flush()).
+    ////////////////////////////////////////////////////////////////////////////
+    bool lookup(const char* name, const char* text, time_t* time);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Writes the sidecar if the index changed. With 'force' false, this is
+    // rate limited so that the log writer can call it after every batch.
+    ////////////////////////////////////////////////////////////////////////////
+    void save(bool force);
+};
+
+#endif
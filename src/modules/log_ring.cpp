@@ -0,0 +1,286 @@
+
+#include "log_ring.hpp"
+#include "log_index.hpp"
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <pthread.h>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+// Stops the writer at normal process exit. This object is constructed before
+// main() so it is destroyed after every function-local static (such as the
+// scheduler) which might still be reporting.
+////////////////////////////////////////////////////////////////////////////////
+static struct log_ring_guard {
+    log_ring_guard() { log_ring::get(); }
+    ~log_ring_guard() { log_ring::get().stop(); }
+} guard;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+log_ring& log_ring::get() {
+    static log_ring* l = new log_ring();
+    return *l;
+}
+
+log_ring::log_ring() {
+    cells = new cell[SIZE];
+    for (size_t i = 0; i < SIZE; i++)
+        cells[i].seq.store(i, std::memory_order_relaxed);
+    thread = std::thread(&writer_loop, this);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// A cell is free for the producer at 'pos' when its sequence equals pos, and
+// holds a record for the consumer at 'pos' when its sequence equals pos + 1.
+////////////////////////////////////////////////////////////////////////////////
+void log_ring::push(time_t time, const char* name, const char* text, bool log) {
+    if (stopped.load()) {
+        record r;
+        r.time = time;
+        r.log = log;
+        strncpy(r.name, name, NAME_LEN - 1);
+        r.name[NAME_LEN - 1] = '\0';
+        strncpy(r.text, text, TEXT_LEN - 1);
+        r.text[TEXT_LEN - 1] = '\0';
+        std::vector<char> out(2 * TEXT_LEN);
+        size_t out_len = 0;
+        std::unique_lock<std::mutex> lck(mtx);
+        write_record(&r, out.data(), &out_len, out.size());
+        fwrite(out.data(), 1, out_len, stdout);
+        fflush(stdout);
+        flush_log_file();
+        return;
+    }
+
+    cell* c;
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    while (true) {
+        c = &cells[pos & (SIZE - 1)];
+        size_t seq = c->seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                    std::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            // Full.
+            if (!log) {
+                dropped++;
+                return;
+            }
+            std::this_thread::yield();
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        } else {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    c->r.time = time;
+    c->r.log = log;
+    strncpy(c->r.name, name, NAME_LEN - 1);
+    c->r.name[NAME_LEN - 1] = '\0';
+    strncpy(c->r.text, text, TEXT_LEN - 1);
+    c->r.text[TEXT_LEN - 1] = '\0';
+    c->seq.store(pos + 1, std::memory_order_release);
+
+    // Only pay for a wake-up when the writer has gone to sleep. The fence
+    // orders the publish above before the flag check (see writer_loop()).
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (writer_sleeping.load()) {
+        std::unique_lock<std::mutex> lck(mtx);
+        cv_writer.notify_one();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Only the writer pops, but the queue itself is safe for many consumers.
+////////////////////////////////////////////////////////////////////////////////
+bool log_ring::pop(record* r) {
+    cell* c;
+    size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+    while (true) {
+        c = &cells[pos & (SIZE - 1)];
+        size_t seq = c->seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (dequeue_pos.compare_exchange_weak(pos, pos + 1,
+                    std::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    *r = c->r;
+    c->seq.store(pos + SIZE, std::memory_order_release);
+    return true;
+}
+
+bool log_ring::empty() {
+    size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+    return cells[pos & (SIZE - 1)].seq.load(std::memory_order_acquire) != pos + 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Requires mtx. Console output is appended to 'out'; log file output goes
+// straight to the (buffered) log FILE.
+////////////////////////////////////////////////////////////////////////////////
+void log_ring::write_record(const record* r, char* out, size_t* out_len,
+        size_t cap) {
+    if (r->time != cached_time) {
+        struct tm tm;
+        localtime_r(&r->time, &tm);
+        strftime(cached_time_str, 64, "%c", &tm);
+        cached_time = r->time;
+    }
+
+    if (r->log && log_file[0]) {
+        if (!f) open_log_file();
+        if (f) {
+            long offset = ftell(f);
+            int n = fprintf(f, "%s ; %s ; %s\n", cached_time_str, r->name,
+                r->text);
+            if (offset >= 0 && n > 0)
+                unindexed.push_back({r->time, r->name, r->text,
+                    (uint64_t)offset, (uint64_t)n});
+        }
+    }
+
+    if (cap - *out_len < TEXT_LEN + 256) {
+        fwrite(out, 1, *out_len, stdout);
+        *out_len = 0;
+    }
+    int n = snprintf(out + *out_len, cap - *out_len, "%s ; %s ; %s%s\n",
+        cached_time_str, r->name, r->log ? "log <- " : "", r->text);
+    if (n > 0) *out_len += ((size_t)n < cap - *out_len) ? n : cap - *out_len - 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Requires mtx. The lines written since the last call are in the file once
+// fflush() returns, and only then are they added to the index.
+////////////////////////////////////////////////////////////////////////////////
+void log_ring::flush_log_file() {
+    if (f) fflush(f);
+    for (unindexed_line& l : unindexed)
+        log_index::get().append(l.time, l.name.c_str(), l.text.c_str(),
+            l.offset, l.len);
+    unindexed.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Requires mtx.
+////////////////////////////////////////////////////////////////////////////////
+void log_ring::open_log_file() {
+    f = fopen(log_file, "a");
+    // ftell() must report the end of the file for log_index::append().
+    if (f) fseek(f, 0, SEEK_END);
+    if (!f) {
+        printf("Failed to open log file (%d): ", errno);
+        fflush(stdout);
+        printf("%s\n", log_file);
+        fflush(stdout);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// The writer is started before main(), so it can not inherit the signal mask
+// main() sets up for signal_handler. It never handles signals, so it blocks
+// every asynchronous one itself.
+////////////////////////////////////////////////////////////////////////////////
+void log_ring::writer_loop(log_ring* l) {
+    sigset_t mask;
+    sigfillset(&mask);
+    for (int signum : {SIGSEGV, SIGBUS, SIGFPE, SIGILL}) sigdelset(&mask, signum);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+
+    std::vector<char> out(64 * 1024);
+    record* r = new record;
+    std::unique_lock<std::mutex> lck(l->mtx);
+    while (true) {
+        size_t out_len = 0;
+        bool any = false;
+        while (l->pop(r)) {
+            l->write_record(r, out.data(), &out_len, out.size());
+            any = true;
+        }
+        size_t dropped = l->dropped.exchange(0);
+        if (dropped) {
+            out_len += snprintf(out.data() + out_len, out.size() - out_len,
+                "%s ; LOG ; %zu messages dropped\n", l->cached_time_str,
+                dropped);
+            any = true;
+        }
+        if (any) {
+            fwrite(out.data(), 1, out_len, stdout);
+            fflush(stdout);
+            l->flush_log_file();
+            log_index::get().save(false);
+        }
+        l->written = l->dequeue_pos.load();
+        l->cv_flush.notify_all();
+
+        if (l->exiting && l->empty()) break;
+
+        // Sleep until a producer sees writer_sleeping and notifies. The
+        // ring is re-checked after the flag is set so no wake-up is lost.
+        l->writer_sleeping = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (l->empty() && !l->exiting) l->cv_writer.wait(lck);
+        l->writer_sleeping = false;
+    }
+    delete r;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void log_ring::flush() {
+    size_t ticket = enqueue_pos.load();
+    std::unique_lock<std::mutex> lck(mtx);
+    if (stopped) return;
+    cv_writer.notify_one();
+    while (written < ticket && !exiting) cv_flush.wait(lck);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void log_ring::set_log_file(const char* log_file) {
+    flush();
+    std::unique_lock<std::mutex> lck(mtx);
+    flush_log_file();
+    if (f) fclose(f);
+    f = nullptr;
+    strncpy(this->log_file, log_file, 256);
+    this->log_file[255] = '\0';
+    log_index::get().set_log_file(this->log_file);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void log_ring::stop() {
+    std::unique_lock<std::mutex> lck(mtx);
+    if (exiting) return;
+    exiting = true;
+    cv_writer.notify_one();
+    lck.unlock();
+    thread.join();
+
+    // Producers which raced with the writer's exit.
+    stopped = true;
+    lck.lock();
+    std::vector<char> out(64 * 1024);
+    size_t out_len = 0;
+    record* r = new record;
+    while (pop(r)) write_record(r, out.data(), &out_len, out.size());
+    delete r;
+    fwrite(out.data(), 1, out_len, stdout);
+    fflush(stdout);
+    flush_log_file();
+    log_index::get().save(true);
+}
@@ -0,0 +1,133 @@
+
+#ifndef _LOG_RING_H_
+#define _LOG_RING_H_
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <ctime>
+#include <cstdio>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+// Output for unit::report(). Callers copy their record into a bounded,
+// lock-free multi-producer ring (Dmitry Vyukov's MPMC queue). A background
+// writer formats the records and writes them to stdout and the log file in
+// batches. The log file stays open.
+//
+// Flush guarantee: once flush() returns, every record pushed before the call
+// has been written and fflush()ed. flush() is called automatically at normal
+// process exit (return from main() or exit()), after every other static object
+// has been destroyed. From then on, records are written synchronously by the
+// caller. Records still in the ring are lost if the process is killed by a
+// signal that is not handled.
+////////////////////////////////////////////////////////////////////////////////
+class log_ring {
+public:
+    ////////////////////////////////////////////////////////////////////////////
+    // Longer texts are truncated. Only verbosity 6 (network messages) comes
+    // near this limit.
+    ////////////////////////////////////////////////////////////////////////////
+    static inline const int NAME_LEN = 64;
+    static inline const int TEXT_LEN = 1024;
+
+private:
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    struct record {
+        time_t time;
+        bool log;
+        char name[NAME_LEN];
+        char text[TEXT_LEN];
+    };
+
+    struct cell {
+        std::atomic<size_t> seq;
+        record r;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    // A log file line which is written but not yet flushed. The log index
+    // only learns about it once it is in the file, so that a lookup never
+    // finds the file shorter than the index.
+    ////////////////////////////////////////////////////////////////////////////
+    struct unindexed_line {
+        time_t time;
+        std::string name, text;
+        uint64_t offset, len;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    // The ring. Producer and consumer positions sit on separate cache lines.
+    ////////////////////////////////////////////////////////////////////////////
+    static inline const size_t SIZE = 512;
+    cell* cells;
+    alignas(64) std::atomic<size_t> enqueue_pos{0};
+    alignas(64) std::atomic<size_t> dequeue_pos{0};
+    alignas(64) std::atomic<bool> writer_sleeping{false};
+    std::atomic<size_t> dropped{0};
+    std::atomic<bool> stopped{false};
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Writer state - protected by mtx.
+    ////////////////////////////////////////////////////////////////////////////
+    std::mutex mtx;
+    std::condition_variable cv_writer, cv_flush;
+    size_t written = 0;
+    bool exiting = false;
+    char log_file[256] = "";
+    bool log_file_changed = false;
+    FILE* f = nullptr;
+    std::vector<unindexed_line> unindexed;
+    time_t cached_time = 0;
+    char cached_time_str[64] = "";
+    std::thread thread;
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    bool pop(record* r);
+    bool empty();
+    void write_record(const record* r, char* out, size_t* out_len, size_t cap);
+    void open_log_file();
+    void flush_log_file();
+    static void writer_loop(log_ring* l);
+
+    log_ring();
+
+public:
+    ////////////////////////////////////////////////////////////////////////////
+    // The ring is created on first use and never destroyed, so reports made
+    // from other static destructors are still safe.
+    ////////////////////////////////////////////////////////////////////////////
+    static log_ring& get();
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Queue a record. Never blocks for console-only records: if the ring is
+    // full they are dropped and counted. Records destined for the log file are
+    // never dropped; the caller waits for space instead.
+    ////////////////////////////////////////////////////////////////////////////
+    void push(time_t time, const char* name, const char* text, bool log);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Blocks until everything pushed before the call is written out.
+    ////////////////////////////////////////////////////////////////////////////
+    void flush();
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Flushes, then switches to the new log file.
+    ////////////////////////////////////////////////////////////////////////////
+    void set_log_file(const char* log_file);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Drain the ring and stop the writer. Later records are written
+    // synchronously.
+    ////////////////////////////////////////////////////////////////////////////
+    void stop();
+};
+
+#endif
@@ -1,76 +1,146 @@
 
 #include "module.hpp"
+#include "checkpoint.hpp"
 #include <ctime>
 #include <time.h>
 
 ////////////////////////////////////////////////////////////////////////////////
+// One iteration of the management loop. Runs on a scheduler worker, computes
+// the default time of the next sync, calls sync() and then asks the scheduler
+// to run the next iteration at next_sync_time (or immediately if a sync was
+// requested in the meantime).
 //
+// If sync() is still pending when it returns, the task returns too, and
+// sync_complete() wakes it again to finish the iteration.
 ////////////////////////////////////////////////////////////////////////////////
-void module::management_thread(module* m) {
+void module::management_task(void* arg) {
+    module* m = (module*)arg;
     std::unique_lock<std::mutex> lck(m->mtx);
-    while (true) {
-        m->report("[MODULE] management_thread loop", 5);
-        if (m->key_times.empty()) {
-            m->default_update = false;
-            // Round up.
-            uint64_t uf = m->update_frequency;
-            m->next_sync_time = time_point(duration(
-                (((m->now_ceil().time_since_epoch().count() + uf - 1 ) / uf) * uf) +
-                (rand() % m->update_frequency)));
-        } else {
-            m->default_update = true;
-            int id;
-            std::time_t tt = sc::to_time_t(m->now_floor());
-            std::tm lt;
-            localtime_r(&tt, &lt);
-            int now = lt.tm_hour * 60 + lt.tm_min;
-            for (id = 0; id < m->key_times.size(); id++)
-                if (m->key_times[id] > now) break;
-            if (id == m->key_times.size()) {
-                id = 0;
-                lt.tm_mday++;
-            }
-            lt.tm_hour = m->key_times[id] / 60;
-            lt.tm_min = m->key_times[id] % 60;
-            tt = mktime(&lt);
-            m->next_sync_time = std::chrono::floor<duration>(sc::from_time_t(tt));
-        }
-        bool last = m->done;
-        m->sync_start_count++;
-        m->report("[MODULE] calling sync()", 5);
+    if (m->mt_exit) return;
+    if (m->parked) {
+        if (!m->async_done) return;
+        m->parked = false;
         lck.unlock();
-        m->sync(last);
-        lck.lock();
-        time_point nc = m->now_ceil();
-        m->heart_beat_requested = false;
-        m->report("[MODULE] sync() done", 4);
-        m->cv_wt.notify_all();
-        m->sync_finish_count++;
-        if (last) break;
-        if (!m->skip_wait) {
-            m->report("[MODULE] management_thread waiting", 5);
-            if (m->next_sync_time < nc) m->next_sync_time = nc;
-            if (m->automatic) {
-                do {
-                    m->cv_mt.wait_until(lck, m->next_sync_time);
-                    m->heart_beat_requested = false;
-                    m->cv_wt.notify_all();
-                } while (!m->skip_wait && m->now_floor() < m->next_sync_time);
-            } else {
-                do {
-                    m->cv_mt.wait(lck);
-                    m->heart_beat_requested = false;
-                    m->cv_wt.notify_all();
-                } while (!m->skip_wait);
-            }
+        m->finish_sync();
+        return;
+    }
+    m->report("[MODULE] management_task", 5);
+    m->running = true;
+    m->skip_wait = false;
+    m->skip_urgent = false;
+    scheduler::get().clear_pending(&m->task);
+    if (m->key_times.empty()) {
+        m->default_update = false;
+        // Round up.
+        uint64_t uf = m->update_frequency;
+        m->next_sync_time = time_point(duration(
+            (((m->now_ceil().time_since_epoch().count() + uf - 1 ) / uf) * uf) +
+            (rand() % m->update_frequency)));
+    } else {
+        m->default_update = true;
+        size_t id;
+        std::time_t tt = sc::to_time_t(m->now_floor());
+        std::tm lt;
+        localtime_r(&tt, &lt);
+        int now = lt.tm_hour * 60 + lt.tm_min;
+        for (id = 0; id < m->key_times.size(); id++)
+            if (m->key_times[id] > now) break;
+        if (id == m->key_times.size()) {
+            id = 0;
+            lt.tm_mday++;
+        }
+        lt.tm_hour = m->key_times[id] / 60;
+        lt.tm_min = m->key_times[id] % 60;
+        tt = mktime(&lt);
+        m->next_sync_time = std::chrono::floor<duration>(sc::from_time_t(tt));
+    }
+    bool last = m->done;
+    m->sync_start_count++;
+    m->report("[MODULE] calling sync()", 5);
+    m->sync_last = last;
+    m->async_sync = false;
+    m->async_done = false;
+    m->skipped = false;
+    lck.unlock();
+    m->sync(last);
+    lck.lock();
+    if (m->async_sync && !m->async_done) {
+        m->parked = true;
+        m->report("[MODULE] sync() pending", 5);
+        return;
+    }
+    lck.unlock();
+    m->finish_sync();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// The end of an iteration, once sync() is over. Runs on a scheduler worker.
+////////////////////////////////////////////////////////////////////////////////
+void module::finish_sync() {
+    checkpoint_state();
+    std::unique_lock<std::mutex> lck(mtx);
+    bool last = sync_last;
+    time_point nc = now_ceil();
+    running = false;
+    if (!skipped)
+        last_sync_at.store(sc::to_time_t(now_floor()), std::memory_order_relaxed);
+    report("[MODULE] sync() done", 4);
+    sync_finish_count++;
+    cv_wt.notify_all();
+
+    // Waiters are completed with the lock released, since callbacks may call
+    // back into this module.
+    std::vector<sync_waiter> ready;
+    for (size_t i = 0; i < waiters.size(); ) {
+        if (last || waiters[i].target <= sync_finish_count) {
+            ready.push_back(std::move(waiters[i]));
+            waiters[i] = std::move(waiters.back());
+            waiters.pop_back();
         } else {
-            m->report("[MODULE] management_thread skipped waiting", 3);
+            i++;
         }
-        m->skip_wait = false;
     }
-    m->mt_exit = true;
-    m->cv_wt.notify_all();
-    m->report("[MODULE] management_thread complete", 3);
+
+    if (last) {
+        mt_exit = true;
+        sync_due_at.store(NEVER, std::memory_order_release);
+        cv_wt.notify_all();
+        report("[MODULE] management_task complete", 3);
+    } else if (!skip_wait) {
+        report("[MODULE] management_task waiting", 5);
+        if (next_sync_time < nc) next_sync_time = nc;
+        sync_due_at.store(automatic ? sc::to_time_t(next_sync_time) : NEVER,
+            std::memory_order_release);
+        if (automatic)
+            scheduler::get().wake_at(&task, next_sync_time);
+    } else {
+        report("[MODULE] management_task skipped waiting", 3);
+        sync_due_at.store(sc::to_time_t(now_floor()), std::memory_order_release);
+        scheduler::get().wake(&task, skip_urgent);
+    }
+    lck.unlock();
+    complete(ready);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// The task is only woken if management_task() has already returned. It is
+// urgent, since finishing the iteration costs next to nothing and whoever
+// waits for the sync has waited for the network already.
+////////////////////////////////////////////////////////////////////////////////
+void module::sync_pending() {
+    std::unique_lock<std::mutex> lck(mtx);
+    async_sync = true;
+}
+
+void module::sync_complete() {
+    std::unique_lock<std::mutex> lck(mtx);
+    async_done = true;
+    if (parked) scheduler::get().wake(&task, true);
+}
+
+void module::sync_skipped() {
+    std::unique_lock<std::mutex> lck(mtx);
+    skipped = true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -87,6 +157,12 @@ void module::set_sync_time(time_point next_sync_time) {
     default_update = false;
 }
 
+void module::defer_sync(time_point next_sync_time) {
+    if (this->next_sync_time < next_sync_time)
+        this->next_sync_time = next_sync_time;
+    default_update = false;
+}
+
 void module::add_key_time(int min) {
     key_times.push_back(min);
 }
@@ -166,79 +242,136 @@ void module::sync(bool last) {
 ////////////////////////////////////////////////////////////////////////////////
 void module::sync_wait() {
     report("[MODULE] sync_wait()", 3);
-    std::unique_lock<std::mutex> lck(mtx);
-    // Wait for the next iteration to finish
-    uint64_t target = sync_start_count + 1;
-    skip_wait = true;
-    do {
-        cv_mt.notify_all();
-        // Timeout after 1 second and verify that sync() hasn't
-        // completed yet.
-        cv_wt.wait_for(lck, duration(1));
-    } while (sync_finish_count < target);
+    sync_async().wait();
     report("[MODULE] sync_wait() done", 3);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// The target is the next sync() to start, so a sync() already in progress
+// does not count. Returns false, leaving 'w' to the caller, if the module has
+// already exited. Requires mtx to be held.
+////////////////////////////////////////////////////////////////////////////////
+bool module::add_waiter(sync_waiter& w) {
+    if (mt_exit) return false;
+    w.target = sync_start_count + 1;
+    waiters.push_back(std::move(w));
+    request_sync();
+    return true;
+}
+
+void module::complete(std::vector<sync_waiter>& ready) {
+    for (sync_waiter& w : ready) w.callback();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+std::shared_future<void> module::sync_async() {
+    std::shared_ptr<std::promise<void>> p = std::make_shared<std::promise<void>>();
+    std::shared_future<void> f = p->get_future().share();
+    sync_async([p]() { p->set_value(); });
+    return f;
+}
+
+void module::sync_async(std::function<void()> callback) {
+    report("[MODULE] sync_async()", 4);
+    sync_waiter w;
+    w.callback = std::move(callback);
+    std::unique_lock<std::mutex> lck(mtx);
+    if (!add_waiter(w)) {
+        lck.unlock();
+        w.callback();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// The last callback completes the promise, so the handle is ready exactly
+// when the last operation is, without anybody waiting on the others.
+////////////////////////////////////////////////////////////////////////////////
+std::function<void()> module::when_all(int count, std::shared_future<void>* all) {
+    std::shared_ptr<std::promise<void>> p = std::make_shared<std::promise<void>>();
+    *all = p->get_future().share();
+    if (count <= 0) {
+        p->set_value();
+        return []() {};
+    }
+    std::shared_ptr<std::atomic<int>> remaining = std::make_shared<std::atomic<int>>(count);
+    return [p, remaining]() {
+        if (remaining->fetch_sub(1) == 1) p->set_value();
+    };
+}
+
+std::shared_future<void> module::sync_all(const std::vector<module*>& modules) {
+    std::shared_future<void> all;
+    std::function<void()> done = when_all(modules.size(), &all);
+    for (module* m : modules) m->sync_async(done);
+    return all;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // sync_now() triggers a call to sync() and returns immediately. If
 // there is a sync() in progress, another sync() call is scheduled to
 // begin immediately upon return of the current call.
 ////////////////////////////////////////////////////////////////////////////////
-void module::sync_now() {
+void module::sync_now(bool urgent) {
     report("[MODULE] sync_now()", 3);
     std::unique_lock<std::mutex> lck(mtx);
-    skip_wait = true;
-    cv_mt.notify_all();
+    request_sync(urgent);
     report("[MODULE] sync_now() done", 4);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// heart_beat_wait() requests an immediate heart beat and waits for one second
-// or until it completes, whichever is faster. Any number of users of this
-// module can call heart_beat_wait() concurrently.
+// Ask for another iteration of management_task() as soon as possible. If
+// sync() is in progress, finish_sync() picks up skip_wait (and skip_urgent,
+// so that the next run is queued ahead) once it is over.
+// Requires mtx to be held.
+////////////////////////////////////////////////////////////////////////////////
+void module::request_sync(bool urgent) {
+    skip_wait = true;
+    skip_urgent = skip_urgent || urgent;
+    if (!enabled || mt_exit) return;
+    int64_t nf = sc::to_time_t(now_floor());
+    if (sync_due_at.load(std::memory_order_relaxed) > nf)
+        sync_due_at.store(nf, std::memory_order_release);
+    if (!running) scheduler::get().wake(&task, urgent);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// heart_beat_wait() waits for one second or until the sync() in progress (if
+// any) completes, whichever is faster. Any number of users of this module can
+// call heart_beat_wait() concurrently.
 ////////////////////////////////////////////////////////////////////////////////
 void module::heart_beat_wait() {
     report("[MODULE] heart_beat_wait()", 3);
     std::unique_lock<std::mutex> lck(mtx);
-    if (!heart_beat_requested) heart_beat_request_time = now_floor();
-    heart_beat_requested = true;
-    cv_mt.notify_all();
     // Timeout after 1 second.
-    cv_wt.wait_for(lck, duration(1));
+    if (running) cv_wt.wait_for(lck, duration(1));
     report("[MODULE] heart_beat_wait() done", 3);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// heart_beat_now() requests an immediate heart beat and then returns without
-// waiting.
+// Liveness is tracked continuously, so there is nothing to request.
 ////////////////////////////////////////////////////////////////////////////////
 void module::heart_beat_now() {
-    report("[MODULE] heart_beat_now()", 3);
-    std::unique_lock<std::mutex> lck(mtx);
-    if (!heart_beat_requested) heart_beat_request_time = now_floor();
-    heart_beat_requested = true;
-    cv_mt.notify_all();
-    report("[MODULE] heart_beat_now() done", 3);
+    report("[MODULE] heart_beat_now()", 5);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// Answers: How long has the heart beat been missing for? If no heart beat
-// was requested, returns zero duration.
+// The heart beat is missing from the time the next sync() was due until it
+// finishes, less a second of grace. That covers a sync() which hangs as well
+// as one which never got a worker. A sync() skipped while a breaker is open
+// still beats: the module is alive and deliberately backing off, and
+// last_sync_time() shows how old its data is.
 ////////////////////////////////////////////////////////////////////////////////
 module::duration module::heart_beat_missed() {
     report("[MODULE] heart_beat_missed()", 5);
-    std::unique_lock<std::mutex> lck(mtx);
+    int64_t due = sync_due_at.load(std::memory_order_acquire);
     duration res = duration(0);
-    if (!heart_beat_requested) {
-        heart_beat_request_time = now_floor();
+    if (due != NEVER) {
+        int64_t nf = sc::to_time_t(now_floor());
+        if (nf > due + 1)
+            res = duration(nf - due - 1);
     }
-    else {
-        time_point nf = now_floor();
-        if (nf > heart_beat_request_time + duration(1))
-            res = nf - heart_beat_request_time - duration(1);
-    }
-    heart_beat_requested = true;
-    cv_mt.notify_all();
     char report_str[64];
     snprintf(report_str, 64, "[MODULE] heart_beat_missed(): %ld", res.count());
     if (res > duration(5))
@@ -251,7 +384,15 @@ module::duration module::heart_beat_missed() {
 ////////////////////////////////////////////////////////////////////////////////
 //
 ////////////////////////////////////////////////////////////////////////////////
-module::module(bool automatic, int update_frequency) {
+module::time_point module::last_sync_time() {
+    return time_point(duration(last_sync_at.load(std::memory_order_relaxed)));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+module::module(bool automatic, int update_frequency) :
+        task { &management_task, this } {
     char name[64];
     strncpy(name, "MODULE [ empty ]", 64);
     set_name(name);
@@ -264,8 +405,21 @@ module::module(bool automatic, int update_frequency) {
 //
 ////////////////////////////////////////////////////////////////////////////////
 void module::enable() {
-    thread = std::thread(&management_thread, this);
-    sync_wait();
+    enable_async().wait();
+}
+
+std::shared_future<void> module::enable_async() {
+    std::shared_ptr<std::promise<void>> p = std::make_shared<std::promise<void>>();
+    std::shared_future<void> f = p->get_future().share();
+    enable_async([p]() { p->set_value(); });
+    return f;
+}
+
+void module::enable_async(std::function<void()> callback) {
+    std::unique_lock<std::mutex> lck(mtx);
+    enabled = true;
+    lck.unlock();
+    sync_async(std::move(callback));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -273,27 +427,46 @@ void module::enable() {
 ////////////////////////////////////////////////////////////////////////////////
 void module::disable() {
     report("[MODULE] disable()", 3);
+    disable_async().wait();
     std::unique_lock<std::mutex> lck(mtx);
-    // Wait for the next iteration to finish
-    done = true;
-    skip_wait = true;
-    while (!mt_exit) {
-        cv_mt.notify_all();
-        // Timeout after 5 seconds and verify that sync() hasn't
-        // completed yet.
-        cv_wt.wait_for(lck, duration(5));
-    };
-    thread.join();
+    enabled = false;
+    lck.unlock();
+    // Wait for the worker to let go of the task.
+    scheduler::get().remove(&task);
+    checkpoint::get().save(true);
     report("[MODULE] disable() done", 3);
 }
 
+std::shared_future<void> module::disable_async() {
+    std::shared_ptr<std::promise<void>> p = std::make_shared<std::promise<void>>();
+    std::shared_future<void> f = p->get_future().share();
+    disable_async([p]() { p->set_value(); });
+    return f;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Every waiter is completed by the final sync(), whatever its target. A
+// module which was never enabled has nothing to stop.
+////////////////////////////////////////////////////////////////////////////////
+void module::disable_async(std::function<void()> callback) {
+    report("[MODULE] disable_async()", 3);
+    sync_waiter w;
+    w.callback = std::move(callback);
+    std::unique_lock<std::mutex> lck(mtx);
+    done = true;
+    if (!enabled || !add_waiter(w)) {
+        lck.unlock();
+        w.callback();
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 ////////////////////////////////////////////////////////////////////////////////
 void module::notify_listeners() {
     std::unique_lock<std::mutex> lck(listeners_mtx);
     for (auto iter = listeners.begin(); iter != listeners.end(); iter++)
-        (*iter)->sync_now();
+        (*iter)->sync_now(true);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
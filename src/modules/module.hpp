@@ -3,8 +3,12 @@
 #define _MODULE_H_
 
 #include "unit.hpp"
+#include "scheduler.hpp"
 #include <thread>
 #include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
 #include <set>
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -16,7 +20,7 @@ private:
     //
     ////////////////////////////////////////////////////////////////////////////
     std::mutex mtx, listeners_mtx;
-    std::condition_variable cv_mt, cv_wt;
+    std::condition_variable cv_wt;
 
     ////////////////////////////////////////////////////////////////////////////
     //
@@ -28,20 +32,53 @@ private:
     ////////////////////////////////////////////////////////////////////////////
     //
     ////////////////////////////////////////////////////////////////////////////
-    bool done = false, skip_wait = false;
+    bool done = false, skip_wait = false, skip_urgent = false;
 
     ////////////////////////////////////////////////////////////////////////////
     //
     ////////////////////////////////////////////////////////////////////////////
-    bool mt_exit = false, heart_beat_requested = false;
+    bool mt_exit = false;
+    bool enabled = false, running = false;
     uint64_t sync_start_count = 0, sync_finish_count = 0;
-    time_point next_sync_time, heart_beat_request_time;
+    time_point next_sync_time;
 
     ////////////////////////////////////////////////////////////////////////////
-    //
+    // An asynchronous sync() (see sync_pending()). 'parked' is set once
+    // management_task() has returned with the sync still going.
     ////////////////////////////////////////////////////////////////////////////
-    std::thread thread;
-    static void management_thread(module* m);
+    bool sync_last = false, async_sync = false, async_done = false;
+    bool parked = false, skipped = false;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Liveness, in seconds since the epoch. Written with mtx held and read
+    // without locks. sync_due_at is when the next sync() should have finished
+    // its work (next_sync_time, or when one was requested), NEVER if none is
+    // expected. last_sync_at is when the last sync() which did its work
+    // finished.
+    ////////////////////////////////////////////////////////////////////////////
+    static inline const int64_t NEVER = INT64_MAX;
+    std::atomic<int64_t> sync_due_at{NEVER}, last_sync_at{0};
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Completion callbacks from sync_async(). Each fires once
+    // sync_finish_count reaches its target (or the module exits).
+    ////////////////////////////////////////////////////////////////////////////
+    struct sync_waiter {
+        uint64_t target;
+        std::function<void()> callback;
+    };
+    std::vector<sync_waiter> waiters;
+    bool add_waiter(sync_waiter& w);
+    static void complete(std::vector<sync_waiter>& ready);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Modules do not own a thread. Each sync() iteration is a task which the
+    // shared scheduler runs on one of its workers.
+    ////////////////////////////////////////////////////////////////////////////
+    scheduler::task task;
+    static void management_task(void* arg);
+    void finish_sync();
+    void request_sync(bool urgent = false);
 
     ////////////////////////////////////////////////////////////////////////////
     // Listen
@@ -56,13 +93,43 @@ protected:
     ////////////////////////////////////////////////////////////////////////////
     virtual void sync(bool last = false);
 
+    ////////////////////////////////////////////////////////////////////////////
+    // A sync() which waits for the network calls sync_pending() before it
+    // starts its I/O and returns without waiting, so that no scheduler worker
+    // is held. The sync is over when sync_complete() is called, from any
+    // thread and possibly before sync() has returned. Only then are its
+    // waiters completed and the next sync() scheduled.
+    ////////////////////////////////////////////////////////////////////////////
+    void sync_pending();
+    void sync_complete();
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Called by a sync() which did not get to do its work, because a breaker
+    // is open for example. last_sync_time() is not advanced by it. Only call
+    // this from sync(), or before sync_complete().
+    ////////////////////////////////////////////////////////////////////////////
+    void sync_skipped();
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Called after every sync(). The derived class saves whatever should
+    // survive a restart with save_checkpoint() and reads it back with
+    // load_checkpoint() in its constructor.
+    ////////////////////////////////////////////////////////////////////////////
+    virtual void checkpoint_state() {}
+
     ////////////////////////////////////////////////////////////////////////////
     //
     ////////////////////////////////////////////////////////////////////////////
     void set_sync_time(time_point tp);
 
     ////////////////////////////////////////////////////////////////////////////
-    // Listen
+    // Pushes the next sync back to 'tp' at the earliest. Only call this from
+    // sync(), or before sync_complete(). sync_now() still syncs at once.
+    ////////////////////////////////////////////////////////////////////////////
+    void defer_sync(time_point tp);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Listen - listeners react to a change, so their syncs are urgent.
     ////////////////////////////////////////////////////////////////////////////
     void notify_listeners();
 
@@ -77,14 +144,24 @@ public:
     module(bool automatic = true, int update_frequency = 1);
 
     ////////////////////////////////////////////////////////////////////////////
-    //
+    // enable() blocks until the first sync() completes. enable_async()
+    // returns straight away; the handle, or the callback, completes with that
+    // sync(). Derived classes hook the callback form.
     ////////////////////////////////////////////////////////////////////////////
-    virtual void enable();
+    void enable();
+    std::shared_future<void> enable_async();
+    virtual void enable_async(std::function<void()> callback);
 
     ////////////////////////////////////////////////////////////////////////////
-    //
+    // disable() blocks until the final sync(last = true) completes and the
+    // scheduler has let go of the module. disable_async() only asks for the
+    // final sync(); disable() must still be called before the module is
+    // destroyed, and returns at once if the final sync() is already done.
+    // Derived classes hook the callback form.
     ////////////////////////////////////////////////////////////////////////////
-    virtual void disable();
+    void disable();
+    std::shared_future<void> disable_async();
+    virtual void disable_async(std::function<void()> callback);
 
     ////////////////////////////////////////////////////////////////////////////
     // sync_wait() triggers a call to sync() and blocks until that call
@@ -99,28 +176,56 @@ public:
     // sync_now() triggers a call to sync() and returns immediately. If
     // there is a sync() in progress, another sync() call is scheduled to
     // begin immediately upon return of the current call.
+    // An urgent sync() gets the next free scheduler worker, ahead of routine
+    // syncs of other modules. Use it for commands somebody waits for.
     ////////////////////////////////////////////////////////////////////////////
-    void sync_now();
+    void sync_now(bool urgent = false);
 
     ////////////////////////////////////////////////////////////////////////////
-    // heart_beat_wait() requests an immediate heart beat and waits until it
-    // completes. Any number of users of this module can call heart_beat_wait()
+    // sync_async() triggers a call to sync() like sync_wait(), but returns
+    // immediately. The returned future, or the callback, completes when that
+    // sync() returns (or when the module exits). Callbacks run on a scheduler
+    // worker and must not block.
+    ////////////////////////////////////////////////////////////////////////////
+    std::shared_future<void> sync_async();
+    void sync_async(std::function<void()> callback);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // when_all() returns a callback for the callback forms of sync_async(),
+    // enable_async() or disable_async(). Once it has been called 'count'
+    // times, the handle in 'all' completes. sync_all() syncs several modules
     // concurrently.
     ////////////////////////////////////////////////////////////////////////////
+    static std::function<void()> when_all(int count, std::shared_future<void>* all);
+    static std::shared_future<void> sync_all(const std::vector<module*>& modules);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // heart_beat_wait() waits for one second or until the sync() in progress
+    // (if any) completes, whichever is faster. Any number of users of this
+    // module can call heart_beat_wait() concurrently.
+    ////////////////////////////////////////////////////////////////////////////
     void heart_beat_wait();
 
     ////////////////////////////////////////////////////////////////////////////
-    // heart_beat_now() requests an immediate heart beat and then returns
-    // without waiting.
+    // Liveness is tracked continuously, so there is nothing to request.
+    // Kept for existing callers.
     ////////////////////////////////////////////////////////////////////////////
     void heart_beat_now();
 
     ////////////////////////////////////////////////////////////////////////////
-    // Answers: How long has the heart beat been missing for? If no heart beat
-    // was requested, returns zero duration.
+    // Answers: How long has the heart beat been missing for? A module is
+    // considered stuck when the sync() due at its next sync time (or asked
+    // for) has not finished within a second, whether it is slow or was never
+    // started. Returns zero duration otherwise. Lock-free; the module is not
+    // woken.
     ////////////////////////////////////////////////////////////////////////////
     duration heart_beat_missed();
 
+    ////////////////////////////////////////////////////////////////////////////
+    // When the most recent sync() which did its work finished. Lock-free.
+    ////////////////////////////////////////////////////////////////////////////
+    time_point last_sync_time();
+
     ////////////////////////////////////////////////////////////////////////////
     // Listen
     ////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,376 @@
+
+#include "neigh_table.hpp"
+#include <arpa/inet.h>
+#include <linux/neighbour.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+////////////////////////////////////////////////////////////////////////////////
+// Recording layout: for every datagram, a uint32 length then the datagram
+// exactly as received (native byte order, like netlink itself).
+////////////////////////////////////////////////////////////////////////////////
+static const int BUF_SIZE = 1 << 16;
+
+////////////////////////////////////////////////////////////////////////////////
+// MACs are lower case "aa:bb:cc:dd:ee:ff", addresses are as inet_ntop()
+// prints them. Returns false if 'key' is neither.
+////////////////////////////////////////////////////////////////////////////////
+static bool normalize(const char* key, std::string* out) {
+    unsigned int m[6];
+    char tail;
+    if (sscanf(key, "%2x:%2x:%2x:%2x:%2x:%2x%c", &m[0], &m[1], &m[2], &m[3],
+            &m[4], &m[5], &tail) == 6) {
+        char mac[18];
+        snprintf(mac, 18, "%02x:%02x:%02x:%02x:%02x:%02x",
+            m[0], m[1], m[2], m[3], m[4], m[5]);
+        *out = mac;
+        return true;
+    }
+    unsigned char addr[16];
+    char ip[INET6_ADDRSTRLEN];
+    if (inet_pton(AF_INET, key, addr) == 1)
+        inet_ntop(AF_INET, addr, ip, sizeof(ip));
+    else if (inet_pton(AF_INET6, key, addr) == 1)
+        inet_ntop(AF_INET6, addr, ip, sizeof(ip));
+    else
+        return false;
+    *out = ip;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+neigh_table::neigh_table(const char* name, int update_frequency,
+        const char* replay_file) : module(true, update_frequency) {
+    char name_full[64];
+    snprintf(name_full, 64, "NEIGH TABLE [ %s ]", name);
+    set_name(name_full);
+    if (replay_file) {
+        strncpy(this->replay_file, replay_file, 256);
+        this->replay_file[255] = '\0';
+    }
+    handler.table = this;
+    report("constructor done", 3);
+}
+
+neigh_table::~neigh_table() {
+    io_loop::get().remove(&handler);
+    if (sock != -1) close(sock);
+    if (record_file) fclose(record_file);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+bool neigh_table::record(const char* file) {
+    record_file = fopen(file, "a");
+    return record_file != nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+bool neigh_table::open_socket() {
+    sock = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (sock == -1) return false;
+    int rcvbuf = 1 << 20;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    struct sockaddr_nl local = {};
+    local.nl_family = AF_NETLINK;
+    local.nl_groups = RTMGRP_NEIGH;
+    if (bind(sock, (struct sockaddr*)&local, sizeof(local))) {
+        close(sock);
+        sock = -1;
+        return false;
+    }
+    io_loop::get().watch(&handler, sock, EPOLLIN);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Called with mtx held.
+////////////////////////////////////////////////////////////////////////////////
+void neigh_table::start_dump(uint32_t seq) {
+    dump_seq = seq;
+    dump_pending = true;
+    dump_interrupted = false;
+    dump_seen.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Called with mtx held, on the NLMSG_DONE of the dump requested last. Every
+// host which is not gone was either in the dump, or reported by an event
+// which arrived since the request. The others were deleted without an event
+// we saw.
+////////////////////////////////////////////////////////////////////////////////
+void neigh_table::finish_dump(time_point now, std::vector<std::string>* changed) {
+    dump_pending = false;
+    if (dump_interrupted) {
+        report("dump interrupted, not looking for gone hosts", 3);
+        dump_seen.clear();
+        return;
+    }
+    for (auto& entry : by_mac) {
+        host& h = entry.second;
+        if (h.gone || dump_seen.count(entry.first)) continue;
+        h.gone = true;
+        h.last_change = now;
+        changed->push_back(h.mac);
+        changed->push_back(h.ip);
+        char report_str[128];
+        snprintf(report_str, 128, "%s %s gone, not in the dump", h.mac, h.ip);
+        report(report_str, 3);
+    }
+    dump_seen.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Applies every RTM_NEWNEIGH/RTM_DELNEIGH in one datagram (events and dump
+// replies look the same, but events carry sequence 0). Entries without a link
+// layer address are only useful for deletions of hosts we already know.
+////////////////////////////////////////////////////////////////////////////////
+void neigh_table::parse(const char* buf, int len,
+        std::vector<std::string>* changed) {
+    time_point now = now_floor();
+    std::unique_lock<std::mutex> lck(mtx);
+    for (const struct nlmsghdr* nh = (const struct nlmsghdr*)buf;
+            NLMSG_OK(nh, (unsigned int)len); nh = NLMSG_NEXT(nh, len)) {
+        // A replay never asked for a dump, so the recorded ones stand in for
+        // the requests.
+        if (replay_file[0] && nh->nlmsg_seq && nh->nlmsg_seq != dump_seq)
+            start_dump(nh->nlmsg_seq);
+        bool dump = dump_pending && nh->nlmsg_seq == dump_seq;
+        if (dump && (nh->nlmsg_flags & NLM_F_DUMP_INTR)) dump_interrupted = true;
+        if (nh->nlmsg_type == NLMSG_DONE || nh->nlmsg_type == NLMSG_ERROR) {
+            // An error reply ends a dump which the kernel refused.
+            if (dump && nh->nlmsg_type == NLMSG_DONE) finish_dump(now, changed);
+            else if (dump) dump_pending = false;
+            continue;
+        }
+        if (nh->nlmsg_type != RTM_NEWNEIGH && nh->nlmsg_type != RTM_DELNEIGH)
+            continue;
+        const struct ndmsg* nd = (const struct ndmsg*)NLMSG_DATA(nh);
+        if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*nd))) continue;
+        if (nd->ndm_family != AF_INET && nd->ndm_family != AF_INET6) continue;
+        // Multicast and point-to-point entries, not hosts.
+        if (nd->ndm_state & NUD_NOARP) continue;
+
+        char ip[INET6_ADDRSTRLEN] = "", mac[18] = "";
+        const struct nda_cacheinfo* ci = nullptr;
+        int alen = NLMSG_PAYLOAD(nh, sizeof(*nd));
+        for (const struct rtattr* a = (const struct rtattr*)((const char*)nd +
+                NLMSG_ALIGN(sizeof(*nd))); RTA_OK(a, alen); a = RTA_NEXT(a, alen)) {
+            int plen = RTA_PAYLOAD(a);
+            const unsigned char* p = (const unsigned char*)RTA_DATA(a);
+            if (a->rta_type == NDA_DST && (plen == 4 || plen == 16))
+                inet_ntop(plen == 4 ? AF_INET : AF_INET6, p, ip, sizeof(ip));
+            else if (a->rta_type == NDA_LLADDR && plen == 6)
+                snprintf(mac, 18, "%02x:%02x:%02x:%02x:%02x:%02x",
+                    p[0], p[1], p[2], p[3], p[4], p[5]);
+            else if (a->rta_type == NDA_CACHEINFO && plen >= (int)sizeof(*ci))
+                ci = (const struct nda_cacheinfo*)p;
+        }
+        if (!ip[0]) continue;
+        if (!mac[0]) {
+            auto it = by_ip.find(ip);
+            if (it == by_ip.end()) continue;
+            strncpy(mac, it->second.c_str(), 18);
+        }
+        if (dump_pending) dump_seen.insert(mac);
+
+        bool added = !by_mac.count(mac);
+        host& h = by_mac[mac];
+        if (added) {
+            strncpy(h.mac, mac, 18);
+            h.ip[0] = '\0';
+            h.first_seen = now;
+        }
+        bool gone = nh->nlmsg_type == RTM_DELNEIGH || (nd->ndm_state & NUD_FAILED);
+        bool moved = !gone && strcmp(h.ip, ip);
+        if (moved) {
+            auto old = by_ip.find(h.ip);
+            if (old != by_ip.end() && old->second == mac) by_ip.erase(old);
+            strncpy(h.ip, ip, sizeof(h.ip));
+            by_ip[ip] = mac;
+        }
+        if (!gone && (nd->ndm_state & (NUD_REACHABLE | NUD_PERMANENT))) {
+            h.last_seen = now;
+        } else if (!gone && ci) {
+            // Confirmation times are in clock ticks (USER_HZ) before now.
+            time_point confirmed = now - duration(ci->ndm_confirmed / 100);
+            if (confirmed > h.last_seen) h.last_seen = confirmed;
+        }
+        if (added || moved || gone != h.gone || nd->ndm_state != h.state) {
+            h.last_change = now;
+            changed->push_back(mac);
+            changed->push_back(h.ip);
+            char report_str[128];
+            snprintf(report_str, 128, "%s %s %s state 0x%02x", mac, h.ip,
+                added ? "new" : gone ? "gone" : "changed", nd->ndm_state);
+            report(report_str, added || gone != h.gone ? 3 : 4);
+        }
+        h.gone = gone;
+        h.state = nd->ndm_state;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void neigh_table::notify(const std::vector<std::string>& changed) {
+    std::unique_lock<std::mutex> lck(subs_mtx);
+    for (const std::string& key : changed) {
+        auto range = subs.equal_range(key);
+        for (auto it = range.first; it != range.second; it++)
+            it->second->sync_now();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Runs on the loop thread. If the socket buffer overflowed, events were lost
+// and a fresh dump is requested.
+////////////////////////////////////////////////////////////////////////////////
+void neigh_table::on_readable() {
+    std::vector<char> buf(BUF_SIZE);
+    std::vector<std::string> changed;
+    bool overrun = false;
+    while (true) {
+        int n = recv(sock, buf.data(), buf.size(), 0);
+        if (n < 0) {
+            if (errno == ENOBUFS) {
+                overrun = true;
+                continue;
+            }
+            break;
+        }
+        if (record_file) {
+            uint32_t len = n;
+            fwrite(&len, sizeof(len), 1, record_file);
+            fwrite(buf.data(), n, 1, record_file);
+            fflush(record_file);
+        }
+        parse(buf.data(), n, &changed);
+    }
+    notify(changed);
+    if (overrun) {
+        report("netlink overrun, requesting a dump", 3);
+        sync_now();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void neigh_table::replay() {
+    FILE* f = fopen(replay_file, "r");
+    if (!f) {
+        report("Error: can not open the replay file.", 0);
+        return;
+    }
+    std::vector<char> buf(BUF_SIZE);
+    std::vector<std::string> changed;
+    int count = 0;
+    uint32_t len;
+    while (fread(&len, sizeof(len), 1, f) == 1 && len <= buf.size() &&
+            fread(buf.data(), len, 1, f) == 1) {
+        parse(buf.data(), len, &changed);
+        count++;
+    }
+    fclose(f);
+    char report_str[128];
+    snprintf(report_str, 128, "replayed %d messages, %d hosts", count, host_count());
+    report(report_str, 3);
+    notify(changed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Requests a dump of the neighbour table. The replies are handled by
+// on_readable() like any other event.
+////////////////////////////////////////////////////////////////////////////////
+void neigh_table::sync(bool last) {
+    if (last) {
+        io_loop::get().remove(&handler);
+        if (sock != -1) close(sock);
+        sock = -1;
+        return;
+    }
+    if (replay_file[0]) {
+        if (!replayed) replay();
+        replayed = true;
+        return;
+    }
+    if (sock == -1 && !open_socket()) {
+        char report_str[128];
+        snprintf(report_str, 128, "Error: netlink socket failed. errno: %d", errno);
+        report(report_str, 0);
+        return;
+    }
+
+    struct {
+        struct nlmsghdr nh;
+        struct ndmsg nd;
+    } req;
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.nd));
+    req.nh.nlmsg_type = RTM_GETNEIGH;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    std::unique_lock<std::mutex> lck(mtx);
+    start_dump(dump_seq + 1);
+    req.nh.nlmsg_seq = dump_seq;
+    lck.unlock();
+    req.nd.ndm_family = AF_UNSPEC;
+    struct sockaddr_nl kernel = {};
+    kernel.nl_family = AF_NETLINK;
+    if (sendto(sock, &req, req.nh.nlmsg_len, 0, (struct sockaddr*)&kernel,
+            sizeof(kernel)) < 0)
+        report("Error: neighbour dump request failed.", 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+bool neigh_table::get_host(const char* key, host* h) {
+    std::string k;
+    if (!normalize(key, &k)) return false;
+    std::unique_lock<std::mutex> lck(mtx);
+    auto ip = by_ip.find(k);
+    if (ip != by_ip.end()) k = ip->second;
+    auto it = by_mac.find(k);
+    if (it == by_mac.end()) return false;
+    *h = it->second;
+    return true;
+}
+
+int neigh_table::host_count() {
+    std::unique_lock<std::mutex> lck(mtx);
+    return by_mac.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void neigh_table::subscribe(const char* key, module* m) {
+    std::string k;
+    if (!normalize(key, &k)) return;
+    std::unique_lock<std::mutex> lck(subs_mtx);
+    subs.insert({k, m});
+}
+
+void neigh_table::unsubscribe(const char* key, module* m) {
+    std::string k;
+    if (!normalize(key, &k)) return;
+    std::unique_lock<std::mutex> lck(subs_mtx);
+    auto range = subs.equal_range(k);
+    for (auto it = range.first; it != range.second; it++) {
+        if (it->second == m) {
+            subs.erase(it);
+            return;
+        }
+    }
+}
@@ -0,0 +1,136 @@
+
+#ifndef _NEIGH_TABLE_H_
+#define _NEIGH_TABLE_H_
+
+#include "module.hpp"
+#include "io_loop.hpp"
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdio>
+
+////////////////////////////////////////////////////////////////////////////////
+// Mirrors the kernel neighbour table (ARP and NDP) from rtnetlink. Changes
+// arrive as RTM_NEWNEIGH/RTM_DELNEIGH events on the io_loop, so following a
+// device costs no traffic at all. sync() only asks for a full dump, at start
+// and every 'update_frequency' seconds, to recover from lost events. When the
+// dump is done, hosts which neither the dump nor an event since the request
+// reported are marked gone, as if their RTM_DELNEIGH had arrived.
+//
+// Hosts are keyed by MAC address, with an index from IP address to MAC, so a
+// lookup by either is O(1). Modules subscribe to a single key and are synced
+// when that host changes.
+//
+// Every netlink message received can be recorded to a file, and a recording
+// can be replayed instead of opening the netlink socket. Replays need no
+// privileges and no network.
+////////////////////////////////////////////////////////////////////////////////
+class neigh_table : public module {
+public:
+    ////////////////////////////////////////////////////////////////////////////
+    // last_seen is the last time the kernel confirmed the host reachable.
+    // 'gone' is set once the entry failed or was deleted.
+    ////////////////////////////////////////////////////////////////////////////
+    struct host {
+        char mac[18];
+        char ip[46];
+        int state = 0;
+        bool gone = false;
+        time_point first_seen, last_seen, last_change;
+    };
+
+private:
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    class socket_handler : public io_loop::handler {
+    public:
+        neigh_table* table;
+        void on_event(uint32_t) { table->on_readable(); }
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Configuration - only written by the constructor and record().
+    ////////////////////////////////////////////////////////////////////////////
+    char replay_file[256] = "";
+    FILE* record_file = nullptr;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Table - protected by mtx.
+    ////////////////////////////////////////////////////////////////////////////
+    std::mutex mtx;
+    std::unordered_map<std::string, host> by_mac;
+    std::unordered_map<std::string, std::string> by_ip;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // The dump requested last, and the MACs reported since it was requested
+    // - protected by mtx. A dump which the kernel flags as interrupted is not
+    // used to find gone hosts.
+    ////////////////////////////////////////////////////////////////////////////
+    uint32_t dump_seq = 0;
+    bool dump_pending = false, dump_interrupted = false;
+    std::unordered_set<std::string> dump_seen;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Socket - only touched on the loop, or by sync() before it is watched.
+    ////////////////////////////////////////////////////////////////////////////
+    socket_handler handler;
+    int sock = -1;
+    bool replayed = false;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Subscriptions - protected by subs_mtx, which is held while notifying.
+    ////////////////////////////////////////////////////////////////////////////
+    std::mutex subs_mtx;
+    std::unordered_multimap<std::string, module*> subs;
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    bool open_socket();
+    void on_readable();
+    void parse(const char* buf, int len, std::vector<std::string>* changed);
+    void start_dump(uint32_t seq);
+    void finish_dump(time_point now, std::vector<std::string>* changed);
+    void notify(const std::vector<std::string>& changed);
+    void replay();
+
+protected:
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    void sync(bool last = false);
+
+public:
+    ////////////////////////////////////////////////////////////////////////////
+    // With 'replay_file', the recording is played back on the first sync()
+    // and the kernel is never asked.
+    ////////////////////////////////////////////////////////////////////////////
+    neigh_table(const char* name, int update_frequency = 300,
+        const char* replay_file = nullptr);
+    ~neigh_table();
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Appends every netlink message received to 'file'. Call before enable().
+    ////////////////////////////////////////////////////////////////////////////
+    bool record(const char* file);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // 'key' is a MAC ("aa:bb:cc:dd:ee:ff") or an IPv4/IPv6 address. Returns
+    // false if the host is unknown.
+    ////////////////////////////////////////////////////////////////////////////
+    bool get_host(const char* key, host* h);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Number of known hosts, gone or not.
+    ////////////////////////////////////////////////////////////////////////////
+    int host_count();
+
+    ////////////////////////////////////////////////////////////////////////////
+    // 'm' is synced whenever the host matching 'key' changes.
+    ////////////////////////////////////////////////////////////////////////////
+    void subscribe(const char* key, module* m);
+    void unsubscribe(const char* key, module* m);
+};
+
+#endif
@@ -0,0 +1,100 @@
+
+#include "pacer.hpp"
+#include <algorithm>
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+pacer& pacer::get() {
+    static pacer p;
+    return p;
+}
+
+void pacer::set_rate(double per_second, int burst) {
+    std::unique_lock<std::mutex> lck(mtx);
+    rate = per_second;
+    this->burst = std::max(burst, 1);
+}
+
+void pacer::set_subnet_rate(double per_second, int burst) {
+    std::unique_lock<std::mutex> lck(mtx);
+    subnet_rate = per_second;
+    subnet_burst = std::max(burst, 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// 'tat' is when the bucket is full again. A request may start once at most
+// burst - 1 intervals are still outstanding.
+////////////////////////////////////////////////////////////////////////////////
+pacer::clock::duration pacer::interval(double rate) {
+    return std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(1 / rate));
+}
+
+pacer::clock::time_point pacer::earliest(const bucket& b, double rate, int burst) {
+    if (rate <= 0) return clock::time_point::min();
+    return b.tat - (burst - 1) * interval(rate);
+}
+
+void pacer::take(bucket& b, double rate, clock::time_point start) {
+    if (rate <= 0) return;
+    b.tat = std::max(b.tat, start) + interval(rate);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+pacer::clock::time_point pacer::reserve(const char* addr, bool priority) {
+    std::string key(addr);
+    size_t dot = key.rfind('.');
+    if (dot != std::string::npos) key.erase(dot);
+
+    clock::time_point now = clock::now();
+    std::unique_lock<std::mutex> lck(mtx);
+    bucket& subnet = subnets[key];
+    clock::time_point start = now;
+    if (!priority) {
+        start = std::max({now, earliest(global, rate, burst),
+            earliest(subnet, subnet_rate, subnet_burst)});
+    }
+    take(global, rate, start);
+    take(subnet, subnet_rate, start);
+    return start;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Whoever takes 'go' first, the timer or fire(), runs it.
+////////////////////////////////////////////////////////////////////////////////
+void pacer::waiter::wait_until(clock::time_point start, std::function<void()> go) {
+    if (start <= clock::now()) {
+        go();
+        return;
+    }
+    std::unique_lock<std::mutex> lck(mtx);
+    this->go = std::move(go);
+    lck.unlock();
+    io_loop::get().set_timer(this, start);
+}
+
+bool pacer::waiter::fire() {
+    std::unique_lock<std::mutex> lck(mtx);
+    std::function<void()> go;
+    go.swap(this->go);
+    lck.unlock();
+    if (!go) return false;
+    io_loop::get().cancel_timer(this);
+    go();
+    return true;
+}
+
+void pacer::waiter::on_timer() {
+    std::unique_lock<std::mutex> lck(mtx);
+    std::function<void()> go;
+    go.swap(this->go);
+    lck.unlock();
+    if (go) go();
+}
+
+pacer::waiter::~waiter() {
+    io_loop::get().remove(this);
+}
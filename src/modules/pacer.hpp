@@ -0,0 +1,109 @@
+
+#ifndef _PACER_H_
+#define _PACER_H_
+
+#include "io_loop.hpp"
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+////////////////////////////////////////////////////////////////////////////////
+// Paces the requests of every module which talks to devices, so that a fleet
+// polled on the same second does not hit the network in one burst.
+//
+// There is a token bucket for the whole process and one for each /24. Each
+// bucket refills at its rate and holds up to 'burst' tokens. A request takes
+// a token from both buckets of its address and waits until both have one.
+// Tokens are reserved in the order requests arrive, so waiting requests go
+// out evenly spaced at the lower of the two rates.
+//
+// Requests beyond the rate are spread out, never dropped. A module has at
+// most one request waiting, and its sync() is not over until the request
+// went out, so a fleet larger than the rate allows is simply polled less
+// often. Priority requests (commands somebody waits for) never wait. They
+// still take their tokens, which pushes the polls behind them back.
+//
+// Nobody waits for the pacer on a thread: a request which may not go out yet
+// is started by a waiter on the io_loop.
+////////////////////////////////////////////////////////////////////////////////
+class pacer {
+public:
+    using clock = io_loop::clock;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Runs a request once it may go out. Each user owns one, and has at most
+    // one request waiting in it.
+    ////////////////////////////////////////////////////////////////////////////
+    class waiter : public io_loop::handler {
+    private:
+        std::mutex mtx;
+        std::function<void()> go;
+        void on_timer();
+
+    public:
+        ////////////////////////////////////////////////////////////////////////
+        // Calls 'go' at 'start': on the calling thread if that has passed,
+        // otherwise on the loop thread, where it must not block.
+        ////////////////////////////////////////////////////////////////////////
+        void wait_until(clock::time_point start, std::function<void()> go);
+
+        ////////////////////////////////////////////////////////////////////////
+        // Calls the waiting 'go' on the calling thread now, for a command
+        // which overtakes the request. Returns false if nothing was waiting.
+        ////////////////////////////////////////////////////////////////////////
+        bool fire();
+
+        ~waiter();
+    };
+
+private:
+    ////////////////////////////////////////////////////////////////////////////
+    // A bucket is kept as the time its next token is due (generic cell rate
+    // algorithm), so refilling costs nothing. A rate of 0 is unlimited.
+    ////////////////////////////////////////////////////////////////////////////
+    struct bucket {
+        clock::time_point tat;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    // All state is protected by mtx.
+    ////////////////////////////////////////////////////////////////////////////
+    std::mutex mtx;
+    double rate = 200, subnet_rate = 50;
+    int burst = 20, subnet_burst = 10;
+    bucket global;
+    std::unordered_map<std::string, bucket> subnets;
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    static clock::duration interval(double rate);
+    static clock::time_point earliest(const bucket& b, double rate, int burst);
+    static void take(bucket& b, double rate, clock::time_point start);
+
+    pacer() {}
+
+public:
+    ////////////////////////////////////////////////////////////////////////////
+    // Returns the process-wide pacer.
+    ////////////////////////////////////////////////////////////////////////////
+    static pacer& get();
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Requests per second and bucket size, for the whole process (default
+    // 200/s, 20) and for each /24 (default 50/s, 10). A rate of 0 turns that
+    // limit off.
+    ////////////////////////////////////////////////////////////////////////////
+    void set_rate(double per_second, int burst);
+    void set_subnet_rate(double per_second, int burst);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Takes the tokens for a request to the IPv4 address 'addr' and returns
+    // when it may go out, which is now if 'priority' is set.
+    ////////////////////////////////////////////////////////////////////////////
+    clock::time_point reserve(const char* addr, bool priority = false);
+};
+
+#endif
@@ -82,6 +82,32 @@ protected:
 
     }
 
+    ////////////////////////////////////////////////////////////////////////////
+    // Restores last_time_present/not_present from the checkpoint, or from the
+    // log if there is none. Called by the derived constructors once the name
+    // is set.
+    ////////////////////////////////////////////////////////////////////////////
+    void init_times() {
+        int64_t v[2];
+        if (load_checkpoint(v, 2)) {
+            last_time_present = time_point(duration(v[0]));
+            last_time_not_present = time_point(duration(v[1]));
+        } else {
+            index_report("DEVICE_PRESENT");
+            index_report("DEVICE_NOT_PRESENT");
+            last_time_present = scan_report("DEVICE_PRESENT");
+            last_time_not_present = scan_report("DEVICE_NOT_PRESENT");
+        }
+    }
+
+    void checkpoint_state() {
+        std::unique_lock<std::mutex> lck(mtx);
+        int64_t v[2] = {last_time_present.time_since_epoch().count(),
+            last_time_not_present.time_since_epoch().count()};
+        lck.unlock();
+        save_checkpoint(v, 2);
+    }
+
     void update_last() {
         if (presence_reported) {
             if (last_reported)
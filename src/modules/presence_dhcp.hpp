@@ -0,0 +1,78 @@
+
+#ifndef _PRESENCE_DHCP_H_
+#define _PRESENCE_DHCP_H_
+
+#include "presence.hpp"
+#include "dhcp_leases.hpp"
+
+////////////////////////////////////////////////////////////////////////////////
+// Follows a single lease of a dhcp_leases, by address, hardware address or
+// host name. The device counts as present while its lease is active. The
+// module syncs whenever the lease changes, and every 30s to notice expiry.
+////////////////////////////////////////////////////////////////////////////////
+class presence_dhcp : public presence {
+private:
+    dhcp_leases* leases;
+    char key[64];
+
+protected:
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    void sync(bool last = false) {
+        if (last) {
+            update_last();
+            return;
+        }
+
+        dhcp_leases::lease l;
+        if (!leases->get_lease(key, &l)) {
+            update_not_present();
+            return;
+        }
+        time_point now = now_floor();
+        time_point end = time_point(duration(l.cltt));
+        if (!l.state && l.valid_lifetime)
+            end = std::min(now, time_point(duration(l.expire)));
+        update_present(end);
+    }
+
+public:
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    presence_dhcp(const char* name, dhcp_leases* leases, const char* key,
+            int time_limit = 60) : presence(true, 30) {
+        char name_full[64];
+        snprintf(name_full, 64, "PRESENCE DHCP [ %s @ %s ]", name, key);
+        set_name(name_full);
+        this->time_limit = duration(time_limit);
+        this->leases = leases;
+        strncpy(this->key, key, 64);
+        this->key[63] = '\0';
+
+        init_times();
+
+        report("constructor done", 3);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    using module::enable_async;
+    void enable_async(std::function<void()> callback) {
+        leases->subscribe(key, this);
+        module::enable_async(std::move(callback));
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    using module::disable_async;
+    void disable_async(std::function<void()> callback) {
+        leases->unsubscribe(key, this);
+        module::disable_async(std::move(callback));
+    }
+};
+
+#endif
@@ -4,36 +4,74 @@
 
 #include "presence.hpp"
 #include "icmp_helper.hpp"
+#include "circuit_breaker.hpp"
+#include "pacer.hpp"
 
 ////////////////////////////////////////////////////////////////////////////////
 // this module detects the presence of a device on the network using Internet
 // Control Message Protocol (ICMP) Echo requests and Responses (ping).
+//
+// A device which stops answering is pinged less and less often, at least
+// every 30 seconds so that it is still seen soon after it comes back. No
+// device behind an unreachable gateway is pinged at all (see
+// circuit_breaker).
 ////////////////////////////////////////////////////////////////////////////////
 class presence_icmp : public presence {
 private:
     icmp_helper ping;
+    char addr[64];
+    circuit_breaker breaker{3, 5, 30};
+    circuit_breaker* subnet;
+    pacer::waiter pace;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // The end of a sync, on the loop thread.
+    ////////////////////////////////////////////////////////////////////////////
+    void pinged(bool ok) {
+        if (ok) {
+            // The device was seen.
+            breaker.success();
+            subnet->success(this);
+            update_present(now_floor());
+        } else {
+            breaker.failure(now_floor());
+            subnet->failure(now_floor(), this);
+            if (breaker.get_state() == circuit_breaker::OPEN ||
+                    subnet->get_state() == circuit_breaker::OPEN)
+                defer_sync(std::max(breaker.get_retry_at(), subnet->get_retry_at()));
+            update_not_present();
+        }
+        sync_complete();
+    }
 
 protected:
     ////////////////////////////////////////////////////////////////////////////
-    //
+    // The ping goes out when the pacer lets it, and the sync completes with
+    // its reply, so no scheduler worker waits for either.
     ////////////////////////////////////////////////////////////////////////////
     void sync(bool last = false) {
-        char report_str[256];
-
         if (last) {
             update_last();
             return;
         }
 
-        // Wait a random amount, up to 500ms, to avoid bursts.
-        usleep(1000 * (rand() % 500));
+        // The pacer is asked first, since a probe of a half open breaker must
+        // be sent.
+        pacer::clock::time_point start = pacer::get().reserve(addr);
 
-        if (ping.ping()) {
-            // The device was seen.
-            update_present(now_floor());
-        } else {
+        if (!(breaker.allow(now_floor()) && subnet->allow(now_floor(), this))) {
+            defer_sync(std::max(breaker.get_retry_at(), subnet->get_retry_at()));
+            sync_skipped();
             update_not_present();
+            return;
         }
+
+        sync_pending();
+        pace.wait_until(start, [this]() {
+            ping.ping_async([this](bool ok, std::chrono::microseconds) {
+                pinged(ok);
+            });
+        });
     }
 
 public:
@@ -41,28 +79,35 @@ public:
     //
     ////////////////////////////////////////////////////////////////////////////
     presence_icmp(char* name, char* addr, int time_limit = 300) : ping{addr} {
+        subnet = circuit_breaker::subnet(addr, this);
+        strncpy(this->addr, addr, 64);
+        this->addr[63] = '\0';
         char name_full[64];
         snprintf(name_full, 64, "PRESENCE ICMP [ %s @ %s ]", name, addr);
         set_name(name_full);
         this->time_limit = duration(time_limit);
 
-        last_time_present = scan_report("DEVICE_PRESENT");
-        last_time_not_present = scan_report("DEVICE_NOT_PRESENT");
+        init_times();
 
         report("constructor done", 3);
     }
     presence_icmp(const char* name, const char* addr, int time_limit = 300) : ping{addr} {
         ping = icmp_helper(addr);
+        subnet = circuit_breaker::subnet(addr, this);
+        strncpy(this->addr, addr, 64);
+        this->addr[63] = '\0';
         char name_full[64];
         snprintf(name_full, 64, "PRESENCE ICMP [ %s @ %s ]", name, addr);
         set_name(name_full);
         this->time_limit = duration(time_limit);
 
-        last_time_present = scan_report("DEVICE_PRESENT");
-        last_time_not_present = scan_report("DEVICE_NOT_PRESENT");
+        init_times();
 
         report("constructor done", 3);
     }
+    ~presence_icmp() {
+        subnet->leave(this);
+    }
 };
 
 #endif
@@ -0,0 +1,74 @@
+
+#ifndef _PRESENCE_NEIGH_H_
+#define _PRESENCE_NEIGH_H_
+
+#include "presence.hpp"
+#include "neigh_table.hpp"
+
+////////////////////////////////////////////////////////////////////////////////
+// Follows a single host of a neigh_table, by MAC or by IP address. The module
+// syncs whenever the kernel reports a change for the host, and every 30s so
+// a host whose entry just went stale still expires after 'time_limit'.
+////////////////////////////////////////////////////////////////////////////////
+class presence_neigh : public presence {
+private:
+    neigh_table* table;
+    char key[64];
+
+protected:
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    void sync(bool last = false) {
+        if (last) {
+            update_last();
+            return;
+        }
+
+        neigh_table::host h;
+        if (table->get_host(key, &h) && !h.gone &&
+                h.last_seen.time_since_epoch().count())
+            update_present(h.last_seen);
+        else
+            update_not_present();
+    }
+
+public:
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    presence_neigh(const char* name, neigh_table* table, const char* key,
+            int time_limit = 300) : presence(true, 30) {
+        char name_full[64];
+        snprintf(name_full, 64, "PRESENCE NEIGH [ %s @ %s ]", name, key);
+        set_name(name_full);
+        this->time_limit = duration(time_limit);
+        this->table = table;
+        strncpy(this->key, key, 64);
+        this->key[63] = '\0';
+
+        init_times();
+
+        report("constructor done", 3);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    using module::enable_async;
+    void enable_async(std::function<void()> callback) {
+        table->subscribe(key, this);
+        module::enable_async(std::move(callback));
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    using module::disable_async;
+    void disable_async(std::function<void()> callback) {
+        table->unsubscribe(key, this);
+        module::disable_async(std::move(callback));
+    }
+};
+
+#endif
@@ -1,6 +1,5 @@
-
 #include "presence_shmem.hpp"
-#include <string>
+#include <cstring>
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -11,44 +10,44 @@ void presence_shmem::sync(bool last) {
         return;
     }
     time_point last_time_present;
-    sm->get_result(&last_time_present);
-
-    update_present(last_time_present);
+    if (table->read(addr, &last_time_present) &&
+            last_time_present.time_since_epoch().count())
+        update_present(last_time_present);
+    else
+        update_not_present();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-//
+// Syncs on every update of the slot, and every 30s so that the device
+// expires after time_limit.
 ////////////////////////////////////////////////////////////////////////////////
-presence_shmem::presence_shmem(char* name, char* addr, signal_handler* sh, int time_limit) {
+presence_shmem::presence_shmem(const char* name, const char* addr,
+        presence_table* table, int time_limit) : presence(true, 30) {
     char name_full[64];
     snprintf(name_full, 64, "PRESENCE shmem [ %s @ %s ]", name, addr);
     set_name(name_full);
     this->time_limit = duration(time_limit);
+    this->table = table;
+    strncpy(this->addr, addr, 48);
+    this->addr[47] = '\0';
 
-    last_time_present = scan_report("DEVICE_PRESENT");
-    last_time_not_present = scan_report("DEVICE_NOT_PRESENT");
-
-    std::string device = "/var/iot/presence/" + std::string(addr) + ".txt";
-    sm = new shmem(device.c_str(), sizeof(time_point), sh);
+    init_times();
 
     report("constructor done", 3);
 }
 
-presence_shmem::presence_shmem(const char* name, const char* addr, signal_handler* sh, int time_limit) {
-    char name_full[64];
-    snprintf(name_full, 64, "PRESENCE shmem [ %s @ %s ]", name, addr);
-    set_name(name_full);
-    this->time_limit = duration(time_limit);
-
-    last_time_present = scan_report("DEVICE_PRESENT");
-    last_time_not_present = scan_report("DEVICE_NOT_PRESENT");
-
-    std::string device = "/var/iot/presence/" + std::string(addr) + ".txt";
-    sm = new shmem(device.c_str(), sizeof(time_point), sh);
-
-    report("constructor done", 3);
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void presence_shmem::enable_async(std::function<void()> callback) {
+    table->subscribe(addr, this);
+    module::enable_async(std::move(callback));
 }
 
-presence_shmem::~presence_shmem() {
-    sm->~shmem();
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void presence_shmem::disable_async(std::function<void()> callback) {
+    table->unsubscribe(addr, this);
+    module::disable_async(std::move(callback));
 }
@@ -1,19 +1,19 @@
-
 #ifndef _PRESENCE_shmem_H_
 #define _PRESENCE_shmem_H_
 
 #include "presence.hpp"
-#include "shmem.hpp"
-#include "signal_handler.hpp"
+#include "presence_table.hpp"
 
 ////////////////////////////////////////////////////////////////////////////////
 // this module detects the presence of a device based on some external process.
-// When the device is seen, the external process updates a shared memory file.
-// This module observes the update and responds accordingly.
+// When the device is seen, the external process updates the device's slot in
+// a shared presence_table. This module observes the update and responds
+// accordingly.
 ////////////////////////////////////////////////////////////////////////////////
 class presence_shmem : public presence {
 private:
-    shmem* sm;
+    presence_table* table;
+    char addr[48];
 
 protected:
     ////////////////////////////////////////////////////////////////////////////
@@ -24,9 +24,20 @@ public:
     ////////////////////////////////////////////////////////////////////////////
     //
     ////////////////////////////////////////////////////////////////////////////
-    presence_shmem(char* name, char* addr, signal_handler* sh, int time_limit = 300);
-    presence_shmem(const char* name, const char* addr, signal_handler* sh, int time_limit = 300);
-    ~presence_shmem();
+    presence_shmem(const char* name, const char* addr, presence_table* table,
+        int time_limit = 300);
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    using module::enable_async;
+    void enable_async(std::function<void()> callback);
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    using module::disable_async;
+    void disable_async(std::function<void()> callback);
 };
 
 #endif
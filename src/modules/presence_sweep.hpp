@@ -0,0 +1,73 @@
+
+#ifndef _PRESENCE_SWEEP_H_
+#define _PRESENCE_SWEEP_H_
+
+#include "presence.hpp"
+#include "icmp_sweep.hpp"
+
+////////////////////////////////////////////////////////////////////////////////
+// Follows a single host of an icmp_sweep. The module does not probe anything
+// itself: it syncs whenever the sweep completes and reads the time the host
+// was last seen.
+////////////////////////////////////////////////////////////////////////////////
+class presence_sweep : public presence {
+private:
+    icmp_sweep* sweep;
+    char addr[64];
+
+protected:
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    void sync(bool last = false) {
+        if (last) {
+            update_last();
+            return;
+        }
+
+        time_point first_seen, last_seen;
+        if (sweep->get_host(addr, &first_seen, &last_seen))
+            update_present(last_seen);
+        else
+            update_not_present();
+    }
+
+public:
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    presence_sweep(const char* name, icmp_sweep* sweep, const char* addr,
+            int time_limit = 300) : presence(false) {
+        char name_full[64];
+        snprintf(name_full, 64, "PRESENCE SWEEP [ %s @ %s ]", name, addr);
+        set_name(name_full);
+        this->time_limit = duration(time_limit);
+        this->sweep = sweep;
+        strncpy(this->addr, addr, 64);
+        this->addr[63] = '\0';
+
+        init_times();
+
+        report("constructor done", 3);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    using module::enable_async;
+    void enable_async(std::function<void()> callback) {
+        sweep->listen(this);
+        module::enable_async(std::move(callback));
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    using module::disable_async;
+    void disable_async(std::function<void()> callback) {
+        sweep->unlisten(this);
+        module::disable_async(std::move(callback));
+    }
+};
+
+#endif
@@ -0,0 +1,275 @@
+#include "presence_table.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(sizeof(presence_table::header) == 64, "header is a cache line");
+static_assert(sizeof(presence_table::slot) == 64, "slot is a cache line");
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+static uint32_t fnv1a(const char* s) {
+    uint32_t h = 2166136261u;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Maps the table. A file without the header is initialised, an existing
+// table is mapped again at its own size.
+////////////////////////////////////////////////////////////////////////////////
+presence_table::presence_table(const char* file, int slot_count,
+        int update_frequency) : module(true, update_frequency) {
+    char name[64];
+    snprintf(name, 64, "PRESENCE TABLE [ %s ]", file);
+    set_name(name);
+
+    fd = open(file, O_RDWR | O_CREAT | O_CLOEXEC, S_IRWXU | S_IRWXG | S_IRWXO);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st)) {
+        report("Error: can not open the table.", 0);
+        return;
+    }
+    header existing;
+    bool valid = st.st_size >= (off_t)sizeof(header) &&
+        pread(fd, &existing, sizeof(header), 0) == sizeof(header) &&
+        existing.magic == MAGIC && existing.slot_count > 0 &&
+        st.st_size >= (off_t)(sizeof(header) + existing.slot_count * sizeof(slot));
+    if (valid) slot_count = existing.slot_count;
+
+    map_size = sizeof(header) + slot_count * sizeof(slot);
+    if (!valid && ftruncate(fd, map_size)) {
+        report("Error: can not size the table.", 0);
+        return;
+    }
+    void* mem = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+        report("Error: mmap failed.", 0);
+        map_size = 0;
+        return;
+    }
+    hdr = (header*)mem;
+    slots = (slot*)(hdr + 1);
+    if (!valid) {
+        memset(mem, 0, map_size);
+        hdr->slot_count = slot_count;
+        __atomic_store_n(&hdr->magic, MAGIC, __ATOMIC_RELEASE);
+    }
+    last_change_seq = hdr->change_seq.load();
+
+    char report_str[128];
+    snprintf(report_str, 128, "%s table with %d slots", valid ? "opened" : "created",
+        slot_count);
+    report(report_str, 3);
+}
+
+presence_table::~presence_table() {
+    stop_watching();
+    if (map_size) munmap(hdr, map_size);
+    if (fd != -1) close(fd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Linear probing from the hash of the id. A slot is claimed under the
+// table's writer lock, by writing the id and publishing the slot as USED, so
+// a process which dies while claiming leaves the slot EMPTY and the lock to be
+// taken over (see seqlock). Slots are never freed, so a probe sequence is
+// never broken.
+////////////////////////////////////////////////////////////////////////////////
+int presence_table::find(const char* id, bool create) {
+    if (!hdr || !id[0] || strlen(id) > MAX_ID) return -1;
+    std::unique_lock<std::mutex> lck(mtx);
+    auto it = index_cache.find(id);
+    if (it != index_cache.end()) return it->second;
+    lck.unlock();
+
+    char key[sizeof(slot::id)] = {};
+    strcpy(key, id);
+    uint32_t n = hdr->slot_count;
+    uint32_t start = fnv1a(key) % n;
+    for (uint32_t i = 0; i < n; i++) {
+        slot& s = slots[(start + i) % n];
+        uint32_t state = s.state.load(std::memory_order_acquire);
+        if (state != USED) {
+            if (!create) return -1;
+            seqlock::lock(&hdr->writer);
+            state = s.state.load(std::memory_order_acquire);
+            if (state != USED) {
+                memcpy(s.id, key, sizeof(key));
+                s.state.store(USED, std::memory_order_release);
+            }
+            seqlock::unlock(&hdr->writer);
+        }
+        if (!strcmp(s.id, key)) {
+            int index = (start + i) % n;
+            lck.lock();
+            index_cache[id] = index;
+            return index;
+        }
+    }
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// The same seqlock protocol as shmem, per slot, with one writer lock for the
+// table. The change counter is bumped after the slot is published.
+////////////////////////////////////////////////////////////////////////////////
+bool presence_table::update(const char* id, time_point last_seen) {
+    if (strlen(id) > MAX_ID) {
+        report("Error: id too long.", 0);
+        return false;
+    }
+    int index = find(id, true);
+    if (index < 0) {
+        report("Error: table full.", 0);
+        return false;
+    }
+    slot& s = slots[index];
+    uint32_t seq = seqlock::write_begin(&s.seq, &hdr->writer);
+    s.last_seen = last_seen.time_since_epoch().count();
+    seqlock::write_end(&s.seq, &hdr->writer, seq);
+    futex::wake(&s.seq, &hdr->slot_waiters);
+    hdr->change_seq.fetch_add(1, std::memory_order_seq_cst);
+    futex::wake(&hdr->change_seq, &hdr->waiters);
+    return true;
+}
+
+bool presence_table::read(const char* id, time_point* last_seen, uint32_t* seq_out) {
+    int index = find(id, false);
+    if (index < 0) return false;
+    slot& s = slots[index];
+    for (int spins = 1; ; spins++) {
+        uint32_t seq = s.seq.load(std::memory_order_acquire);
+        if (seq & 1) {
+            if (spins % seqlock::STALE_SPINS == 0 &&
+                    seqlock::recover(&s.seq, &hdr->writer)) {
+                report("Error: a writer died mid-write, slot recovered as is.", 0);
+                futex::wake(&s.seq, &hdr->slot_waiters);
+            }
+            if (spins % 64 == 0) sched_yield();
+            continue;
+        }
+        int64_t t = s.last_seen;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (s.seq.load(std::memory_order_relaxed) != seq) continue;
+        *last_seen = time_point(duration(t));
+        if (seq_out) *seq_out = seq;
+        return true;
+    }
+}
+
+bool presence_table::wait(const char* id, uint32_t seq, int timeout_ms) {
+    int index = find(id, false);
+    if (index < 0) return false;
+    return futex::wait(&slots[index].seq, &hdr->slot_waiters, seq, timeout_ms);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Costs one load when nothing changed, otherwise one load per subscription.
+// Runs on the watcher thread and from sync().
+////////////////////////////////////////////////////////////////////////////////
+void presence_table::dispatch() {
+    uint32_t change_seq = hdr->change_seq.load(std::memory_order_acquire);
+    std::vector<module*> changed;
+    std::unique_lock<std::mutex> lck(mtx);
+    if (change_seq == last_change_seq) return;
+    last_change_seq = change_seq;
+    for (subscription& sub : subs) {
+        uint32_t seq = slots[sub.index].seq.load(std::memory_order_acquire);
+        if (seq == sub.seq) continue;
+        sub.seq = seq;
+        changed.push_back(sub.m);
+    }
+    lck.unlock();
+    for (module* m : changed) m->sync_now();
+}
+
+void presence_table::sync(bool last) {
+    if (!last && hdr) dispatch();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void presence_table::watch() {
+    uint32_t change_seq = hdr->change_seq.load();
+    while (watching.load()) {
+        if (!futex::wait(&hdr->change_seq, &hdr->waiters, change_seq, 1000))
+            continue;
+        change_seq = hdr->change_seq.load();
+        dispatch();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// See shmem::stop_watching().
+////////////////////////////////////////////////////////////////////////////////
+void presence_table::stop_watching() {
+    if (!watching.exchange(false)) return;
+    futex::wake(&hdr->change_seq, &hdr->waiters);
+    watcher.join();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void presence_table::enable_async(std::function<void()> callback) {
+    if (hdr && !watching.exchange(true))
+        watcher = std::thread(&presence_table::watch, this);
+    module::enable_async(std::move(callback));
+}
+
+void presence_table::disable_async(std::function<void()> callback) {
+    stop_watching();
+    module::disable_async(std::move(callback));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+int presence_table::slot_count() {
+    return hdr ? hdr->slot_count : 0;
+}
+
+int presence_table::used_count() {
+    int count = 0;
+    for (int i = 0; i < slot_count(); i++)
+        if (slots[i].state.load(std::memory_order_relaxed) == USED) count++;
+    return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void presence_table::subscribe(const char* id, module* m) {
+    if (strlen(id) > MAX_ID) {
+        report("Error: id too long.", 0);
+        return;
+    }
+    int index = find(id, true);
+    if (index < 0) {
+        report("Error: table full.", 0);
+        return;
+    }
+    std::unique_lock<std::mutex> lck(mtx);
+    subs.push_back(subscription {m, index,
+        slots[index].seq.load(std::memory_order_acquire)});
+}
+
+void presence_table::unsubscribe(const char* id, module* m) {
+    int index = find(id, false);
+    std::unique_lock<std::mutex> lck(mtx);
+    for (auto it = subs.begin(); it != subs.end(); it++) {
+        if (it->m == m && it->index == index) {
+            subs.erase(it);
+            return;
+        }
+    }
+}
@@ -0,0 +1,157 @@
+#ifndef _PRESENCE_TABLE_H_
+#define _PRESENCE_TABLE_H_
+
+#include "module.hpp"
+#include "futex.hpp"
+#include "seqlock.hpp"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+////////////////////////////////////////////////////////////////////////////////
+// A table of presence slots in a single mapped file, shared between the
+// processes which see devices and the daemon. One file, one mapping and one
+// module replace a shmem file and module per device.
+//
+// Slots are found by hashing the device id into an open addressed table, so
+// any process can find a slot without coordination. Each slot is a seqlock
+// (see shmem), and every update also bumps a table-wide change counter.
+// Writers, and processes claiming a slot, take the table-wide 'writer' lock,
+// so only one slot is ever mid-write, and a write or claim left by a dead
+// process is taken over.
+//
+// Writers wake waiters through futexes on both words. While the module is
+// enabled, a watcher thread waits on the change counter and syncs only the
+// subscribers whose slot moved. Any thread may also wait on a single slot.
+// sync() does the same check on a timer, in case a wake up was missed.
+////////////////////////////////////////////////////////////////////////////////
+class presence_table : public module {
+public:
+    ////////////////////////////////////////////////////////////////////////////
+    // Layout of the file. Shared with other processes, so only ever append
+    // fields. A slot is one cache line.
+    ////////////////////////////////////////////////////////////////////////////
+    struct header {
+        uint32_t magic;
+        uint32_t slot_count;
+        std::atomic<uint32_t> change_seq;
+        std::atomic<uint32_t> waiters;       // on change_seq
+        std::atomic<uint32_t> slot_waiters;  // on any slot's seq
+        std::atomic<uint32_t> writer;        // see seqlock
+        uint8_t reserved[40];
+    };
+    struct slot {
+        std::atomic<uint32_t> state;  // EMPTY or USED
+        std::atomic<uint32_t> seq;    // odd while last_seen is written
+        int64_t last_seen;            // seconds since the epoch
+        char id[48];
+    };
+    static const uint32_t MAGIC = 0x494f5450;  // "IOTP"
+    // 1 was a slot being claimed, before claims took the writer lock.
+    enum { EMPTY = 0, USED = 2 };
+
+private:
+    ////////////////////////////////////////////////////////////////////////////
+    // Mapping - fixed once the constructor returns.
+    ////////////////////////////////////////////////////////////////////////////
+    header* hdr = nullptr;
+    slot* slots = nullptr;
+    size_t map_size = 0;
+    int fd = -1;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Slot indexes found so far, and subscriptions with the slot sequence
+    // last seen - protected by mtx.
+    ////////////////////////////////////////////////////////////////////////////
+    struct subscription {
+        module* m;
+        int index;
+        uint32_t seq;
+    };
+    std::mutex mtx;
+    std::unordered_map<std::string, int> index_cache;
+    std::vector<subscription> subs;
+    uint32_t last_change_seq = 0;
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    std::thread watcher;
+    std::atomic<bool> watching{false};
+    void watch();
+    void stop_watching();
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    int find(const char* id, bool create);
+    void dispatch();
+
+protected:
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    void sync(bool last = false);
+
+public:
+    ////////////////////////////////////////////////////////////////////////////
+    // 'slot_count' only matters when the file is created. An existing table
+    // keeps its size.
+    ////////////////////////////////////////////////////////////////////////////
+    presence_table(const char* file, int slot_count = 4096, int update_frequency = 60);
+    ~presence_table();
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Ids are at most MAX_ID characters, since the slot stores them whole.
+    // Longer ones are rejected rather than cut, so that two ids which share
+    // a prefix never share a slot.
+    ////////////////////////////////////////////////////////////////////////////
+    static const int MAX_ID = sizeof(slot::id) - 1;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Records that device 'id' was seen at 'last_seen', claiming a slot if
+    // needed. Returns false if the table is full or 'id' is too long.
+    ////////////////////////////////////////////////////////////////////////////
+    bool update(const char* id, time_point last_seen);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Returns false if 'id' has no slot. Never blocks. 'seq' is the slot
+    // sequence the copy is consistent with.
+    ////////////////////////////////////////////////////////////////////////////
+    bool read(const char* id, time_point* last_seen, uint32_t* seq = nullptr);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Blocks until the slot of 'id' moves past 'seq', for at most
+    // 'timeout_ms'. Returns false on timeout, or if 'id' has no slot.
+    ////////////////////////////////////////////////////////////////////////////
+    bool wait(const char* id, uint32_t seq, int timeout_ms);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Number of slots, and of slots in use.
+    ////////////////////////////////////////////////////////////////////////////
+    int slot_count();
+    int used_count();
+
+    ////////////////////////////////////////////////////////////////////////////
+    // 'm' is synced whenever the slot of 'id' changes. The slot is claimed if
+    // needed, so a device may be subscribed to before it is first seen. An
+    // 'id' longer than MAX_ID is not subscribed.
+    ////////////////////////////////////////////////////////////////////////////
+    void subscribe(const char* id, module* m);
+    void unsubscribe(const char* id, module* m);
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    using module::enable_async;
+    void enable_async(std::function<void()> callback);
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    using module::disable_async;
+    void disable_async(std::function<void()> callback);
+};
+
+#endif
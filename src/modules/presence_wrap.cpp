@@ -28,8 +28,7 @@ presence_wrap::presence_wrap(char* name, presence* modules, int count) {
     // not_present.
     this->time_limit = duration(60);
 
-    last_time_present = scan_report("DEVICE_PRESENT");
-    last_time_not_present = scan_report("DEVICE_NOT_PRESENT");
+    init_times();
 
     report("constructor done", 3);
     module_count = count;
@@ -44,8 +43,7 @@ presence_wrap::presence_wrap(const char* name, presence* modules, int count) {
     // not_present.
     this->time_limit = duration(60);
 
-    last_time_present = scan_report("DEVICE_PRESENT");
-    last_time_not_present = scan_report("DEVICE_NOT_PRESENT");
+    init_times();
 
     report("constructor done", 3);
     module_count = count;
@@ -55,21 +53,19 @@ presence_wrap::presence_wrap(const char* name, presence* modules, int count) {
 ////////////////////////////////////////////////////////////////////////////////
 //
 ////////////////////////////////////////////////////////////////////////////////
-void presence_wrap::enable() {
-    report("enable()", 4);
-    module::enable();
+void presence_wrap::enable_async(std::function<void()> callback) {
+    report("enable_async()", 4);
     for (int i = 0; i < module_count; i++)
         modules[i].listen(this);
-    report("enable() done", 4);
+    module::enable_async(std::move(callback));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 ////////////////////////////////////////////////////////////////////////////////
-void presence_wrap::disable() {
-    report("disable()", 4);
+void presence_wrap::disable_async(std::function<void()> callback) {
+    report("disable_async()", 4);
     for (int i = 0; i < module_count; i++)
         modules[i].unlisten(this);
-    module::disable();
-    report("disable() done", 4);
+    module::disable_async(std::move(callback));
 }
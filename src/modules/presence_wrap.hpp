@@ -27,12 +27,14 @@ public:
     ////////////////////////////////////////////////////////////////////////////
     //
     ////////////////////////////////////////////////////////////////////////////
-    void enable();
+    using module::enable_async;
+    void enable_async(std::function<void()> callback);
 
     ////////////////////////////////////////////////////////////////////////////
     //
     ////////////////////////////////////////////////////////////////////////////
-    void disable();
+    using module::disable_async;
+    void disable_async(std::function<void()> callback);
 };
 
 #endif
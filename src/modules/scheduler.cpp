@@ -0,0 +1,345 @@
+
+#include "scheduler.hpp"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+int scheduler::worker_limit = 16;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+scheduler::task::task(void (*fn)(void*), void* arg) {
+    this->fn = fn;
+    this->arg = arg;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// The current tick is rounded down while requested ticks are rounded up so
+// that a task never runs before its requested time.
+////////////////////////////////////////////////////////////////////////////////
+uint64_t scheduler::now_tick() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        clock::now().time_since_epoch()).count() / TICK_MS;
+}
+
+uint64_t scheduler::to_tick(clock::time_point tp) {
+    int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        tp.time_since_epoch()).count();
+    if (ms < 0) return 0;
+    return (ms + TICK_MS - 1) / TICK_MS;
+}
+
+scheduler::clock::time_point scheduler::from_tick(uint64_t tick) {
+    return clock::time_point(std::chrono::duration_cast<clock::duration>(
+        std::chrono::milliseconds(tick * TICK_MS)));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Place a task in the wheel based on its distance from current_tick.
+////////////////////////////////////////////////////////////////////////////////
+void scheduler::wheel_insert(task* t) {
+    if (t->expiry <= current_tick) {
+        ready_push(t);
+        return;
+    }
+    uint64_t delta = t->expiry - current_tick;
+    uint64_t expiry = t->expiry;
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (1ull << (SLOT_BITS * (level + 1))))
+        level++;
+    if (delta >= (1ull << (SLOT_BITS * LEVELS)))
+        expiry = current_tick + (1ull << (SLOT_BITS * LEVELS)) - 1;
+    int slot = (expiry >> (SLOT_BITS * level)) & (SLOTS - 1);
+
+    t->state = TIMER;
+    t->level = level;
+    t->slot = slot;
+    t->prev = nullptr;
+    t->next = wheel[level][slot];
+    if (t->next) t->next->prev = t;
+    wheel[level][slot] = t;
+    occupied[level] |= 1ull << slot;
+
+    // Wake the timer thread if it is sleeping past the new expiry.
+    if (t->expiry < wait_tick) cv_timer.notify_one();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void scheduler::wheel_unlink(task* t) {
+    if (t->prev) {
+        t->prev->next = t->next;
+    } else {
+        wheel[t->level][t->slot] = t->next;
+        if (!t->next) occupied[t->level] &= ~(1ull << t->slot);
+    }
+    if (t->next) t->next->prev = t->prev;
+    t->prev = t->next = nullptr;
+    t->state = IDLE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void scheduler::ready_push(task* t) {
+    t->state = READY;
+    if (t->urgent) {
+        // Behind the urgent tasks already queued, ahead of everything else.
+        t->prev = urgent_tail;
+        t->next = urgent_tail ? urgent_tail->next : ready_head;
+        urgent_tail = t;
+    } else {
+        t->prev = ready_tail;
+        t->next = nullptr;
+    }
+    if (t->prev) t->prev->next = t;
+    else ready_head = t;
+    if (t->next) t->next->prev = t;
+    else ready_tail = t;
+    ready_count++;
+
+    if (ready_count > idle_workers && workers.size() < (size_t)worker_limit &&
+            !exiting) {
+        idle_workers++;
+        workers.push_back(std::thread(&worker_loop, this));
+    }
+    cv_ready.notify_one();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void scheduler::ready_unlink(task* t) {
+    if (t == urgent_tail) urgent_tail = t->prev;
+    if (t->prev) t->prev->next = t->next;
+    else ready_head = t->next;
+    if (t->next) t->next->prev = t->prev;
+    else ready_tail = t->prev;
+    t->prev = t->next = nullptr;
+    t->state = IDLE;
+    ready_count--;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Returns the first tick after current_tick at which something must happen:
+// either a level 0 slot fires or a higher level slot cascades downwards.
+// Ticks in between can be skipped without visiting them.
+////////////////////////////////////////////////////////////////////////////////
+uint64_t scheduler::next_event_tick() {
+    uint64_t best = UINT64_MAX;
+    for (int level = 0; level < LEVELS; level++) {
+        if (!occupied[level]) continue;
+        int shift = SLOT_BITS * level;
+        uint64_t base = current_tick >> shift;
+        // Rotate so that bit 0 is the slot after the current one.
+        int r = (base + 1) & (SLOTS - 1);
+        uint64_t rotated = occupied[level];
+        if (r) rotated = (rotated >> r) | (rotated << (SLOTS - r));
+        int k = __builtin_ctzll(rotated) + 1;
+        uint64_t tick = (base + k) << shift;
+        if (tick < best) best = tick;
+    }
+    return best;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Move the wheel forward to now_tick, cascading higher levels and firing
+// level 0 slots along the way.
+////////////////////////////////////////////////////////////////////////////////
+void scheduler::advance(uint64_t now_tick) {
+    while (true) {
+        uint64_t tick = next_event_tick();
+        if (tick > now_tick) {
+            if (now_tick > current_tick) current_tick = now_tick;
+            return;
+        }
+        current_tick = tick;
+
+        for (int level = LEVELS - 1; level > 0; level--) {
+            int shift = SLOT_BITS * level;
+            if (current_tick & ((1ull << shift) - 1)) continue;
+            int slot = (current_tick >> shift) & (SLOTS - 1);
+            task* t = wheel[level][slot];
+            wheel[level][slot] = nullptr;
+            occupied[level] &= ~(1ull << slot);
+            while (t) {
+                task* next = t->next;
+                wheel_insert(t);
+                t = next;
+            }
+        }
+
+        int slot = current_tick & (SLOTS - 1);
+        task* t = wheel[0][slot];
+        wheel[0][slot] = nullptr;
+        occupied[0] &= ~(1ull << slot);
+        while (t) {
+            task* next = t->next;
+            // Anything not yet due goes back in.
+            if (t->expiry <= current_tick) ready_push(t);
+            else wheel_insert(t);
+            t = next;
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void scheduler::timer_loop(scheduler* s) {
+    std::unique_lock<std::mutex> lck(s->mtx);
+    while (!s->exiting) {
+        s->advance(now_tick());
+        s->wait_tick = s->next_event_tick();
+        if (s->wait_tick == UINT64_MAX)
+            s->cv_timer.wait(lck);
+        else
+            s->cv_timer.wait_until(lck, from_tick(s->wait_tick));
+        s->wait_tick = UINT64_MAX;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void scheduler::worker_loop(scheduler* s) {
+    std::unique_lock<std::mutex> lck(s->mtx);
+    while (true) {
+        while (!s->exiting && !s->ready_head) s->cv_ready.wait(lck);
+        if (s->exiting) break;
+        task* t = s->ready_head;
+        s->ready_unlink(t);
+        t->urgent = false;
+        s->idle_workers--;
+        t->state = RUNNING;
+        t->pending = IDLE;
+        lck.unlock();
+        t->fn(t->arg);
+        lck.lock();
+        s->idle_workers++;
+        int pending = t->pending;
+        t->state = IDLE;
+        t->pending = IDLE;
+        if (pending == READY) {
+            s->ready_push(t);
+        } else if (pending == TIMER) {
+            t->expiry = t->pending_expiry;
+            s->wheel_insert(t);
+        }
+        s->cv_idle.notify_all();
+    }
+    s->idle_workers--;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void scheduler::wake(task* t, bool urgent) {
+    std::unique_lock<std::mutex> lck(mtx);
+    if (urgent && !t->urgent) {
+        t->urgent = true;
+        if (t->state == READY) {
+            ready_unlink(t);
+            ready_push(t);
+        }
+    }
+    if (t->state == RUNNING) {
+        t->pending = READY;
+    } else if (t->state == TIMER) {
+        wheel_unlink(t);
+        ready_push(t);
+    } else if (t->state == IDLE) {
+        ready_push(t);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void scheduler::wake_at(task* t, clock::time_point tp) {
+    std::unique_lock<std::mutex> lck(mtx);
+    uint64_t expiry = to_tick(tp);
+    if (t->state == RUNNING) {
+        if (t->pending == IDLE ||
+                (t->pending == TIMER && expiry < t->pending_expiry)) {
+            t->pending = TIMER;
+            t->pending_expiry = expiry;
+        }
+    } else if (t->state == TIMER) {
+        if (expiry < t->expiry) {
+            wheel_unlink(t);
+            t->expiry = expiry;
+            wheel_insert(t);
+        }
+    } else if (t->state == IDLE) {
+        t->expiry = expiry;
+        wheel_insert(t);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void scheduler::clear_pending(task* t) {
+    std::unique_lock<std::mutex> lck(mtx);
+    if (t->state == RUNNING) {
+        t->pending = IDLE;
+        t->urgent = false;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void scheduler::remove(task* t) {
+    std::unique_lock<std::mutex> lck(mtx);
+    while (t->state == RUNNING) cv_idle.wait(lck);
+    if (t->state == TIMER) wheel_unlink(t);
+    else if (t->state == READY) ready_unlink(t);
+    t->pending = IDLE;
+    t->urgent = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+int scheduler::thread_count() {
+    std::unique_lock<std::mutex> lck(mtx);
+    return workers.size() + 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void scheduler::set_worker_count(int count) {
+    if (count < 1) count = 1;
+    worker_limit = count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+scheduler& scheduler::get() {
+    static scheduler s;
+    return s;
+}
+
+scheduler::scheduler() {
+    current_tick = to_tick(clock::now());
+    timer_thread = std::thread(&timer_loop, this);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Stop all threads at process exit. Tasks still in the wheel are dropped.
+////////////////////////////////////////////////////////////////////////////////
+scheduler::~scheduler() {
+    std::unique_lock<std::mutex> lck(mtx);
+    exiting = true;
+    cv_timer.notify_all();
+    cv_ready.notify_all();
+    lck.unlock();
+    timer_thread.join();
+    for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+}
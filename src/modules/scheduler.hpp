@@ -0,0 +1,154 @@
+
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+////////////////////////////////////////////////////////////////////////////////
+// The scheduler is shared by every module in the process. Tasks which are
+// waiting for a point in time are held in a hierarchical timer wheel. Tasks
+// which are ready to run are handed to a bounded pool of worker threads.
+//
+// A task is never run by two workers at the same time. Requests made while a
+// task is running are remembered and applied once the task returns.
+//
+// An urgent wake-up puts the task ahead of every task which is not urgent, so
+// that it gets the next free worker.
+////////////////////////////////////////////////////////////////////////////////
+class scheduler {
+public:
+    using clock = std::chrono::system_clock;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // A task is owned by its user (normally a module). The scheduler only
+    // links it into the wheel or the ready queue.
+    ////////////////////////////////////////////////////////////////////////////
+    class task {
+        friend class scheduler;
+    private:
+        void (*fn)(void*);
+        void* arg;
+        task* prev = nullptr;
+        task* next = nullptr;
+        int state = 0, pending = 0;
+        bool urgent = false;
+        int level = 0, slot = 0;
+        uint64_t expiry = 0, pending_expiry = 0;
+    public:
+        task(void (*fn)(void*), void* arg);
+    };
+
+private:
+    ////////////////////////////////////////////////////////////////////////////
+    // Task states
+    ////////////////////////////////////////////////////////////////////////////
+    static inline const int IDLE = 0;
+    static inline const int TIMER = 1;
+    static inline const int READY = 2;
+    static inline const int RUNNING = 3;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Timer wheel geometry. Level 0 has a resolution of one tick. Each level
+    // above covers 64 times the span of the level below it. Five levels cover
+    // about 124 days; anything further out is parked in the top level and
+    // re-inserted when it cascades.
+    ////////////////////////////////////////////////////////////////////////////
+    static inline const int TICK_MS = 10;
+    static inline const int LEVELS = 5;
+    static inline const int SLOT_BITS = 6;
+    static inline const int SLOTS = 1 << SLOT_BITS;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // All state is protected by mtx.
+    ////////////////////////////////////////////////////////////////////////////
+    std::mutex mtx;
+    std::condition_variable cv_timer, cv_ready, cv_idle;
+    task* wheel[LEVELS][SLOTS] = {};
+    uint64_t occupied[LEVELS] = {};
+    uint64_t current_tick, wait_tick = UINT64_MAX;
+    task* ready_head = nullptr;
+    task* ready_tail = nullptr;
+    task* urgent_tail = nullptr;
+    int ready_count = 0;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Threads
+    ////////////////////////////////////////////////////////////////////////////
+    static int worker_limit;
+    bool exiting = false;
+    int idle_workers = 0;
+    std::thread timer_thread;
+    std::vector<std::thread> workers;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Helpers - all require mtx to be held.
+    ////////////////////////////////////////////////////////////////////////////
+    static uint64_t now_tick();
+    static uint64_t to_tick(clock::time_point tp);
+    static clock::time_point from_tick(uint64_t tick);
+    void wheel_insert(task* t);
+    void wheel_unlink(task* t);
+    void ready_push(task* t);
+    void ready_unlink(task* t);
+    uint64_t next_event_tick();
+    void advance(uint64_t now_tick);
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    static void timer_loop(scheduler* s);
+    static void worker_loop(scheduler* s);
+
+    scheduler();
+    ~scheduler();
+
+public:
+    ////////////////////////////////////////////////////////////////////////////
+    // Returns the process-wide scheduler. Threads are started on first use.
+    ////////////////////////////////////////////////////////////////////////////
+    static scheduler& get();
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Sets the maximum number of worker threads. Workers are started lazily,
+    // up to this limit, only when every existing worker is busy.
+    ////////////////////////////////////////////////////////////////////////////
+    static void set_worker_count(int count);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // wake() makes the task ready to run as soon as a worker is free. If the
+    // task is waiting on a timer, the timer is cancelled. An urgent task runs
+    // before the tasks which are already waiting for a worker.
+    ////////////////////////////////////////////////////////////////////////////
+    void wake(task* t, bool urgent = false);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // wake_at() makes the task ready at the specified time. An earlier pending
+    // wake-up is not delayed.
+    ////////////////////////////////////////////////////////////////////////////
+    void wake_at(task* t, clock::time_point tp);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Called by a running task to drop wake-ups which were requested before
+    // it started. Those requests are satisfied by the current run.
+    ////////////////////////////////////////////////////////////////////////////
+    void clear_pending(task* t);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // remove() cancels any pending wake-up. If the task is running, remove()
+    // blocks until it returns. After remove() returns, the scheduler holds no
+    // reference to the task.
+    ////////////////////////////////////////////////////////////////////////////
+    void remove(task* t);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Number of threads owned by the scheduler (timer + workers).
+    ////////////////////////////////////////////////////////////////////////////
+    int thread_count();
+};
+
+#endif
@@ -0,0 +1,114 @@
+
+#ifndef _SEQLOCK_H_
+#define _SEQLOCK_H_
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// The write side of a seqlock in a mapped file, shared between processes.
+//
+// 'seq' is odd while a write is in progress. Writers exclude each other with
+// 'owner', which holds the kernel thread id of the writer, and is taken before
+// 'seq' goes odd and released after it is even again. So an odd 'seq' with no
+// owner, or with an owner which no longer exists, was left by a writer which
+// died in the middle of a write. Readers and writers which see that take the
+// lock over and publish the value as it is. The value may be half written,
+// but nobody waits for a dead process forever, which the fcntl locks this
+// replaced guaranteed too.
+//
+// Thread ids are only compared within one pid namespace, and a dead writer's
+// id which is reused at once is taken for a live one until it changes.
+////////////////////////////////////////////////////////////////////////////////
+class seqlock {
+public:
+    ////////////////////////////////////////////////////////////////////////////
+    // Readers which see an odd 'seq' for this many spins check the owner.
+    ////////////////////////////////////////////////////////////////////////////
+    static inline const int STALE_SPINS = 1024;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Takes the lock and makes 'seq' odd. Returns the odd value, which is
+    // passed to write_end().
+    ////////////////////////////////////////////////////////////////////////////
+    static uint32_t write_begin(std::atomic<uint32_t>* seq,
+            std::atomic<uint32_t>* owner) {
+        lock(owner);
+        uint32_t s = seq->load(std::memory_order_relaxed);
+        // Left odd by a writer which died.
+        if (s & 1) s++;
+        seq->store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        return s + 1;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Publishes the value and releases the lock. The store is seq_cst so that
+    // a futex wake after it sees every waiter (see futex).
+    ////////////////////////////////////////////////////////////////////////////
+    static void write_end(std::atomic<uint32_t>* seq, std::atomic<uint32_t>* owner,
+            uint32_t odd) {
+        seq->store(odd + 1, std::memory_order_seq_cst);
+        unlock(owner);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // The writer lock alone, for changes which readers do not follow through
+    // 'seq'. A dead owner is replaced, not waited for.
+    ////////////////////////////////////////////////////////////////////////////
+    static void lock(std::atomic<uint32_t>* owner) {
+        uint32_t tid = self();
+        for (int spins = 1; ; spins++) {
+            uint32_t cur = 0;
+            if (owner->compare_exchange_weak(cur, tid, std::memory_order_acquire))
+                return;
+            if (spins % 64 == 0) {
+                if (cur && !alive(cur) && owner->compare_exchange_strong(cur, tid,
+                        std::memory_order_acquire))
+                    return;
+                sched_yield();
+            }
+        }
+    }
+
+    static void unlock(std::atomic<uint32_t>* owner) {
+        owner->store(0, std::memory_order_release);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Called by a reader which saw 'seq' odd for STALE_SPINS. If the writer is
+    // gone, 'seq' is made even with an empty write, and true is returned so
+    // that the caller can wake futex waiters.
+    ////////////////////////////////////////////////////////////////////////////
+    static bool recover(std::atomic<uint32_t>* seq, std::atomic<uint32_t>* owner) {
+        uint32_t cur = owner->load(std::memory_order_acquire);
+        if (cur && alive(cur)) return false;
+        if (!(seq->load(std::memory_order_acquire) & 1)) return false;
+        write_end(seq, owner, write_begin(seq, owner));
+        return true;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // The thread id costs a system call, so it is cached per thread. A forked
+    // child gets a new id.
+    ////////////////////////////////////////////////////////////////////////////
+    static uint32_t self() {
+        static thread_local uint32_t tid = 0;
+        static int registered = pthread_atfork(nullptr, nullptr, []() { tid = 0; });
+        (void)registered;
+        if (!tid) tid = syscall(SYS_gettid);
+        return tid;
+    }
+
+    static bool alive(uint32_t tid) {
+        return kill(tid, 0) == 0 || errno != ESRCH;
+    }
+};
+
+#endif
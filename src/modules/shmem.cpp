@@ -2,71 +2,135 @@
 #include "shmem.hpp"
 #include <cstring>
 #include <stdio.h>
-#include <csignal>
 #include <mutex>
 #include <fcntl.h>
+#include <sched.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 ////////////////////////////////////////////////////////////////////////////////
-// Open the file as shared memory
+// Open the file as shared memory. A file without the header (new, or written
+// by an older version) is initialised.
 ////////////////////////////////////////////////////////////////////////////////
-shmem::shmem(const char* device, int size, signal_handler* sigio_handler) :
+shmem::shmem(const char* device, int size) :
         module { false } {
     char name[64];
     snprintf(name, 64, "SHMEM [ %s ]", device);
     set_name(name);
     report("constructor called", 5);
-    if (shared_mem != nullptr) return;
     sock = open(device, O_RDWR | O_CREAT, S_IRWXU | S_IRWXG | S_IRWXO);
-    shared_mem = mmap(NULL, size,
+    map_size = sizeof(header) + size;
+    struct stat st;
+    if (!fstat(sock, &st) && st.st_size < (off_t)map_size)
+        if (ftruncate(sock, map_size)) report("Error: can not size the file.", 0);
+    void* mem = mmap(NULL, map_size,
         PROT_READ | PROT_WRITE, MAP_SHARED, sock, 0);
+    if (mem == MAP_FAILED) {
+        report("Error: mmap failed.", 0);
+        mem = calloc(map_size, 1);
+        map_size = 0;
+    }
+    hdr = (header*)mem;
+    shared_mem = (uint8_t*)mem + sizeof(header);
+    if (hdr->magic != MAGIC || hdr->size != (uint32_t)size) {
+        hdr->size = size;
+        hdr->seq.store(0);
+        hdr->waiters.store(0);
+        hdr->writer.store(0);
+        memset(shared_mem, 0, size);
+        __atomic_store_n(&hdr->magic, MAGIC, __ATOMIC_RELEASE);
+    }
     target_value = calloc(size, 1);
     result_value = calloc(size, 1);
+    scratch = calloc(size, 1);
     this->size = size;
-    this->sigio_handler = sigio_handler;
-    if (sigio_handler) fcntl(sock, F_SETOWN, getpid());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// A reader only spins while a writer is between its two stores, or until it
+// finds that the writer died there.
+////////////////////////////////////////////////////////////////////////////////
+uint32_t shmem::read(void* value) {
+    for (int spins = 1; ; spins++) {
+        uint32_t seq = hdr->seq.load(std::memory_order_acquire);
+        if (!(seq & 1)) {
+            memcpy(value, shared_mem, size);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (hdr->seq.load(std::memory_order_relaxed) == seq) return seq;
+        } else if (spins % seqlock::STALE_SPINS == 0 &&
+                seqlock::recover(&hdr->seq, &hdr->writer)) {
+            report("Error: a writer died mid-write, value recovered as is.", 0);
+            futex::wake(&hdr->seq, &hdr->waiters);
+        }
+        if (spins % 64 == 0) sched_yield();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// The final store must be ordered before the load of 'waiters', or a waiter
+// which just registered could miss the wake.
+////////////////////////////////////////////////////////////////////////////////
+void shmem::write(const void* value) {
+    uint32_t seq = seqlock::write_begin(&hdr->seq, &hdr->writer);
+    memcpy(shared_mem, value, size);
+    seqlock::write_end(&hdr->seq, &hdr->writer, seq);
+    futex::wake(&hdr->seq, &hdr->waiters);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 ////////////////////////////////////////////////////////////////////////////////
+bool shmem::wait(uint32_t seq, int timeout_ms) {
+    return futex::wait(&hdr->seq, &hdr->waiters, seq, timeout_ms);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Syncs whenever the value changes, from any process. A wake up from this
+// process's own write() costs one sync() which finds nothing new.
+////////////////////////////////////////////////////////////////////////////////
+void shmem::watch() {
+    uint32_t seq = hdr->seq.load();
+    while (watching.load()) {
+        if (!wait(seq, 1000)) continue;
+        seq = hdr->seq.load();
+        if (watching.load()) sync_now();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Peers waiting on the same file wake up for nothing, and go back to sleep.
+// If the watcher was not waiting yet, it stops after its timeout.
+////////////////////////////////////////////////////////////////////////////////
+void shmem::stop_watching() {
+    if (!watching.exchange(false)) return;
+    futex::wake(&hdr->seq, &hdr->waiters);
+    watcher.join();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// sync() runs once at a time, so 'scratch' needs no lock.
+////////////////////////////////////////////////////////////////////////////////
 void shmem::sync(bool last) {
     std::unique_lock<std::mutex> lck(mtx);
-    uint8_t target_value[size], result_value[size];
     bool target_valid = this->target_valid;
-    memcpy(target_value, this->target_value, size);
+    if (target_valid) memcpy(scratch, this->target_value, size);
     lck.unlock();
 
-    // Lock the file to avoid races between processes.
-    struct flock flock = {
-        .l_type = F_RDLCK,
-        .l_whence = SEEK_SET,
-        .l_start = 0,
-        .l_len = size,
-        .l_pid = 0};
-    if (target_valid) flock.l_type = F_WRLCK;
-    fcntl(sock, F_SETLKW, &flock);
-
-    if (target_valid) memcpy(shared_mem, &target_value, size);
-    memcpy(result_value, shared_mem, size);
-
-    // Unlock the file. All accesses to shared_mem are complete.
-    flock.l_type = F_UNLCK;
-    fcntl(sock, F_SETLK, flock);
-
-    if (target_valid && !sigio_handler)
-        kill(fcntl(sock, F_GETOWN), SIGIO);
+    if (target_valid) write(scratch);
+    read(scratch);
 
     lck.lock();
-    if (0 == memcmp(this->result_value, result_value, size)) {
+    bool changed = memcmp(this->result_value, scratch, size);
+    if (changed) {
         last_change = now_floor();
-        notify_listeners();
+        memcpy(this->result_value, scratch, size);
     }
-    memcpy(this->result_value, result_value, size);
     // target==result, further updates are not needed.
     if (0 == memcmp(this->result_value, this->target_value, size))
         this->target_valid = false;
+    lck.unlock();
+    if (changed) notify_listeners();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -91,28 +155,30 @@ void shmem::set_target(void* value) {
 //
 ////////////////////////////////////////////////////////////////////////////////
 shmem::~shmem() {
-    munmap(shared_mem, size + sizeof(time_point));
+    stop_watching();
+    if (map_size) munmap(hdr, map_size);
+    else free(hdr);
     free(target_value);
     free(result_value);
+    free(scratch);
     close(sock);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 ////////////////////////////////////////////////////////////////////////////////
-void shmem::enable() {
-    report("enable()", 4);
-    module::enable();
-    if (sigio_handler) sigio_handler->listen(this);
-    report("enable() done", 4);
+void shmem::enable_async(std::function<void()> callback) {
+    report("enable_async()", 4);
+    if (!watching.exchange(true))
+        watcher = std::thread(&shmem::watch, this);
+    module::enable_async(std::move(callback));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 ////////////////////////////////////////////////////////////////////////////////
-void shmem::disable() {
-    report("disable()", 4);
-    if (sigio_handler) sigio_handler->unlisten(this);
-    module::disable();
-    report("disable() done", 4);
+void shmem::disable_async(std::function<void()> callback) {
+    report("disable_async()", 4);
+    stop_watching();
+    module::disable_async(std::move(callback));
 }
@@ -1,26 +1,64 @@
-
 #ifndef _SHMEM_H_
 #define _SHMEM_H_
 
-#include "signal_handler.hpp"
+#include "module.hpp"
+#include "futex.hpp"
+#include "seqlock.hpp"
+#include <atomic>
+#include <thread>
 
 ////////////////////////////////////////////////////////////////////////////////
+// A value of 'size' bytes shared between processes through a mapped file.
+//
+// The file starts with a header, followed by the value. Access is a seqlock:
+// 'seq' is odd while a write is in progress. Readers copy the value and retry
+// if 'seq' moved, so they never block and never enter the kernel. Writers
+// take the lock by writing their thread id to 'writer', copy the value and
+// publish it with one atomic store, plus a futex wake if anybody waits. A
+// write left unfinished by a process which died is taken over (see seqlock).
 //
+// While enabled, a watcher thread waits on the sequence number and syncs the
+// module as soon as any process writes.
 ////////////////////////////////////////////////////////////////////////////////
 class shmem : public module {
+public:
+    ////////////////////////////////////////////////////////////////////////////
+    // Layout of the start of the file. Shared with other processes, so only
+    // ever append fields, and change MAGIC when the header grows, since the
+    // value follows it.
+    ////////////////////////////////////////////////////////////////////////////
+    struct header {
+        uint32_t magic;
+        uint32_t size;
+        std::atomic<uint32_t> seq;
+        std::atomic<uint32_t> waiters;
+        std::atomic<uint32_t> writer;
+    };
+    static const uint32_t MAGIC = 0x494f5332;  // "IOS2"
+
 private:
     ////////////////////////////////////////////////////////////////////////////
     //
     ////////////////////////////////////////////////////////////////////////////
-    void* shared_mem;
+    header* hdr = nullptr;
+    uint8_t* shared_mem = nullptr;
+    size_t map_size = 0;
     void* result_value;
     time_point last_change;
     void* target_value;
-    signal_handler* sigio_handler = nullptr;
+    void* scratch;
     bool target_valid = false;
     int size;
     int sock;
     std::mutex mtx;
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    std::thread watcher;
+    std::atomic<bool> watching{false};
+    void watch();
+    void stop_watching();
 protected:
     ////////////////////////////////////////////////////////////////////////////
     //
@@ -33,20 +71,32 @@ public:
     time_point get_result(void* value = nullptr);
     void set_target(void* value);
 
+    ////////////////////////////////////////////////////////////////////////////
+    // Direct access to the mapping, without going through sync(). read()
+    // returns the sequence number the copy is consistent with. wait() blocks
+    // until the sequence number differs from 'seq' or 'timeout_ms' passes,
+    // and returns false on timeout.
+    ////////////////////////////////////////////////////////////////////////////
+    uint32_t read(void* value);
+    void write(const void* value);
+    bool wait(uint32_t seq, int timeout_ms);
+
     ////////////////////////////////////////////////////////////////////////////
     //
     ////////////////////////////////////////////////////////////////////////////
-    void enable();
+    using module::enable_async;
+    void enable_async(std::function<void()> callback);
 
     ////////////////////////////////////////////////////////////////////////////
     //
     ////////////////////////////////////////////////////////////////////////////
-    void disable();
+    using module::disable_async;
+    void disable_async(std::function<void()> callback);
 
     ////////////////////////////////////////////////////////////////////////////
     //
     ////////////////////////////////////////////////////////////////////////////
-    shmem(const char* device, int size, signal_handler* sigio_handler = nullptr);
+    shmem(const char* device, int size);
     ~shmem();
 };
 
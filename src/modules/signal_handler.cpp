@@ -1,35 +1,68 @@
 
 #include "signal_handler.hpp"
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <pthread.h>
+#include <unistd.h>
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 ////////////////////////////////////////////////////////////////////////////////
-std::map<int,signal_handler*> signal_handler::handlers;
-std::mutex signal_handler::mtx;
+void signal_handler::block(std::initializer_list<int> signums) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (int signum : signums) sigaddset(&mask, signum);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+}
 
 ////////////////////////////////////////////////////////////////////////////////
-//
+// Only the first sync after a signal notifies anybody, so a burst of signals
+// costs one wake up.
 ////////////////////////////////////////////////////////////////////////////////
 void signal_handler::sync(bool last) {
-    if (!last) notify_listeners();
+    if (last) return;
+    uint64_t c = count.load();
+    if (c == synced_count) return;
+    synced_count = c;
+    notify_listeners();
+    if (callback) callback();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Runs on the loop. Drains everything queued since the last call.
+////////////////////////////////////////////////////////////////////////////////
+void signal_handler::on_readable() {
+    struct signalfd_siginfo info[16];
+    int received = 0;
+    while (true) {
+        ssize_t n = read(fd, info, sizeof(info));
+        if (n < (ssize_t)sizeof(info[0])) break;
+        received += n / sizeof(info[0]);
+    }
+    if (!received) return;
+    count.fetch_add(received);
+    char report_str[64];
+    snprintf(report_str, 64, "received %d signal(s)", received);
+    report(report_str, 4);
+    sync_now();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 ////////////////////////////////////////////////////////////////////////////////
-signal_handler::signal_handler(int signum) :
-        module { false } {
-    this->signum = signum;
+signal_handler::signal_handler(int signum, std::function<void()> callback) :
+        module { false }, signum(signum), callback(std::move(callback)) {
     char name_full[64];
     snprintf(name_full, 64, "SIGNAL_HANDLER (%d)", signum);
     set_name(name_full);
-    std::unique_lock<std::mutex> lck(mtx);
-    if (handlers.count(signum)) {
-        this->signum = -1;
-    } else handlers[signum] = this;
-    lck.unlock();
-    if (this->signum == -1)
-        report("ERROR: multiple handlers with the same signum", 0);
+    handler.sh = this;
+    block({signum});
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, signum);
+    fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd == -1) report("ERROR: signalfd failed", 0);
+    else io_loop::get().watch(&handler, fd, EPOLLIN);
     report("constructor done", 3);
 }
 
@@ -37,15 +70,13 @@ signal_handler::signal_handler(int signum) :
 //
 ////////////////////////////////////////////////////////////////////////////////
 signal_handler::~signal_handler() {
-    std::unique_lock<std::mutex> lck(mtx);
-    handlers.erase(signum);
+    io_loop::get().remove(&handler);
+    if (fd != -1) close(fd);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 ////////////////////////////////////////////////////////////////////////////////
-void signal_handler::handler(int signum) {
-    std::unique_lock<std::mutex> lck(mtx);
-    if (handlers.count(signum))
-        handlers[signum]->sync_now();
+uint64_t signal_handler::get_count() {
+    return count.load();
 }
@@ -3,23 +3,50 @@
 #define _SIGNAL_HANDLER_H_
 
 #include "module.hpp"
-#include <map>
+#include "io_loop.hpp"
+#include <atomic>
 #include <csignal>
+#include <functional>
+#include <initializer_list>
 
 ////////////////////////////////////////////////////////////////////////////////
+// Turns a signal into a sync of this module. The signal is blocked and read
+// from a signalfd on the io_loop, so nothing runs in signal context and any
+// lock may be taken. However many signals arrive between two syncs, the
+// listeners and the callback are only woken once.
 //
+// A blocked signal is only queued for the signalfd if every thread blocks it,
+// and threads inherit the signal mask of the thread which starts them. main()
+// has to call block() before it starts any thread (io_loop and the scheduler
+// included). There should be one handler per signal.
+//
+// Synchronous signals (SIGSEGV, SIGBUS, ...) can not be handled this way.
 ////////////////////////////////////////////////////////////////////////////////
 class signal_handler : public module {
 private:
     ////////////////////////////////////////////////////////////////////////////
     //
     ////////////////////////////////////////////////////////////////////////////
-    static std::map<int,signal_handler*> handlers;
-    static std::mutex mtx;
+    class fd_handler : public io_loop::handler {
+    public:
+        signal_handler* sh;
+        void on_event(uint32_t) { sh->on_readable(); }
+    };
+
     ////////////////////////////////////////////////////////////////////////////
     //
     ////////////////////////////////////////////////////////////////////////////
     int signum;
+    int fd = -1;
+    fd_handler handler;
+    std::function<void()> callback;
+    std::atomic<uint64_t> count{0};
+    uint64_t synced_count = 0;
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    ////////////////////////////////////////////////////////////////////////////
+    void on_readable();
 protected:
     ////////////////////////////////////////////////////////////////////////////
     //
@@ -27,9 +54,9 @@ protected:
     void sync(bool last);
 public:
     ////////////////////////////////////////////////////////////////////////////
-    //
+    // 'callback' is optional. It runs from sync(), never in signal context.
     ////////////////////////////////////////////////////////////////////////////
-    signal_handler(int signum);
+    signal_handler(int signum, std::function<void()> callback = nullptr);
 
     ////////////////////////////////////////////////////////////////////////////
     //
@@ -37,9 +64,15 @@ public:
     ~signal_handler();
 
     ////////////////////////////////////////////////////////////////////////////
-    //
+    // Blocks 'signums' in the calling thread, and so in every thread it starts
+    // from now on.
+    ////////////////////////////////////////////////////////////////////////////
+    static void block(std::initializer_list<int> signums);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Number of signals received so far.
     ////////////////////////////////////////////////////////////////////////////
-    static void handler(int signum);
+    uint64_t get_count();
 };
 
 #endif
@@ -79,6 +79,7 @@ protected:
             else
                 snprintf(log_str, 256, "Sunrise time: %d:%d;", kt.tm_hour, kt.tm_min);
             report(log_str, 2, true);
+            notify_listeners();
 
             return;
         }
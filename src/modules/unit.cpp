@@ -1,87 +1,59 @@
 
 #include "unit.hpp"
+#include "log_ring.hpp"
+#include "log_index.hpp"
+#include "checkpoint.hpp"
 #include <ctime>
-#include <time.h>
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 ////////////////////////////////////////////////////////////////////////////////
 std::mutex unit::log_mtx;
-int unit::verbosity_limit = 3;
+std::atomic<int> unit::verbosity_limit{3};
 char unit::log_file[256] = "";
 
 ////////////////////////////////////////////////////////////////////////////////
-// Report an event.
+// Report an event. Filtered reports cost a single comparison. Others are
+// copied into the log ring and formatted later by its writer thread.
 ////////////////////////////////////////////////////////////////////////////////
 void unit::report(char* text, int verbosity, bool log) {
-    std::unique_lock<std::mutex> lck(log_mtx);
-    char time_str[64];
-    time_t time = sc::to_time_t(now_floor());
-    strftime(time_str, 64, "%c", std::localtime(&time));
-
-    if (verbosity_limit >= verbosity) {
-        if (log) {
-            if (log_file[0]) {
-                FILE* f = fopen(log_file, "a");
-                if (f) {
-                    fprintf(f, "%s ; %s ; %s\n", time_str, name, text);
-                    fflush(f);
-                    fclose(f);
-                } else {
-                    printf("Failed to open log file (%d): ", errno);
-                    fflush(stdout);
-                    printf("%s\n", log_file);
-                    fflush(stdout);
-                }
-            }
-            printf("%s ; %s ; log <- %s\n", time_str, name, text);
-            fflush(stdout);
-        }
-        else {
-            printf("%s ; %s ; %s\n", time_str, name, text);
-            fflush(stdout);
-        }
-    }
+    report((const char*)text, verbosity, log);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 ////////////////////////////////////////////////////////////////////////////////
 void unit::report(const char* text, int verbosity, bool log) {
-    char str[256];
-    strncpy(str, text, 256);
-    report(str, verbosity, log);
+    if (verbosity_limit.load(std::memory_order_relaxed) < verbosity) return;
+    char name[64];
+    copy_name(name);
+    log_ring::get().push(sc::to_time_t(sc::now()), name, text, log);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// Scan for events.
+//
+////////////////////////////////////////////////////////////////////////////////
+void unit::index_report(const char* text) {
+    log_index::get().add_text(text);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Scan for events. Returns the time of the last log entry for this unit whose
+// text is exactly 'text', or now_floor() if there is none. The answer comes
+// from the log index rather than a scan of the whole log.
 ////////////////////////////////////////////////////////////////////////////////
 unit::time_point unit::scan_report(char* text) {
+    // Events which are still in the log ring must be found too.
+    log_ring::get().flush();
+    char name[64];
+    copy_name(name);
     std::unique_lock<std::mutex> lck(log_mtx);
 
-    char looking_for[512], input_time_str[512], input_line[512];
-    snprintf(looking_for, 512, "%s ; %s", name, text);
-
-
     time_point found_time = now_floor();
 
-    if (log_file[0]) {
-        FILE* f = fopen(log_file, "r");
-        if (f) {
-            while (true) {
-                if (fscanf(f, "%512[^;]", input_time_str) == EOF) break;
-                if (fscanf(f, "%512[^\n] ", input_line) == EOF) break;
-                if (nullptr != strstr(input_line, looking_for)) {
-                    // Found a match. Get the time.
-                    struct tm time;
-                    strptime(input_time_str, "%c", &time);
-                    time_t tt = mktime(&time);
-                    found_time = std::chrono::time_point_cast<std::chrono::seconds>(sc::from_time_t(tt));
-                }
-            }
-            fclose(f);
-        }
-    }
+    time_t tt;
+    if (log_file[0] && log_index::get().lookup(name, text, &tt))
+        found_time = std::chrono::time_point_cast<std::chrono::seconds>(sc::from_time_t(tt));
 
     return found_time;
 }
@@ -95,6 +67,21 @@ unit::time_point unit::scan_report(const char* text) {
     return scan_report(str);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+bool unit::load_checkpoint(int64_t* values, int count) {
+    char name[64];
+    copy_name(name);
+    return checkpoint::get().lookup(name, values, count);
+}
+
+void unit::save_checkpoint(const int64_t* values, int count) {
+    char name[64];
+    copy_name(name);
+    checkpoint::get().store(name, values, count);
+}
+
 unit::unit() {
     strncpy(name, "UNIT [ empty ]", 64);
 }
@@ -103,15 +90,20 @@ unit::unit() {
 //
 ////////////////////////////////////////////////////////////////////////////////
 void unit::set_name(char* name) {
-    std::unique_lock<std::mutex> lck(log_mtx);
+    std::unique_lock<std::mutex> lck(name_mtx);
     strncpy(this->name, name, 64);
+    this->name[63] = '\0';
+}
+
+void unit::copy_name(char* buf) {
+    std::unique_lock<std::mutex> lck(name_mtx);
+    memcpy(buf, name, 64);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 ////////////////////////////////////////////////////////////////////////////////
 void unit::set_verbosity(int verbosity) {
-    std::unique_lock<std::mutex> lck(log_mtx);
     verbosity_limit = verbosity;
 }
 
@@ -121,6 +113,15 @@ void unit::set_verbosity(int verbosity) {
 void unit::set_log_file(char* log_file) {
     std::unique_lock<std::mutex> lck(log_mtx);
     strncpy(unit::log_file, log_file, 256);
+    log_ring::get().set_log_file(log_file);
+    checkpoint::get().set_log_file(log_file);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void unit::flush_log() {
+    log_ring::get().flush();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -4,7 +4,9 @@
 
 #include <chrono>
 #include <mutex>
+#include <atomic>
 #include <vector>
+#include <cstdint>
 #include <cstring>
 #include <csignal>
 
@@ -22,16 +24,19 @@ public:
 
 private:
     ////////////////////////////////////////////////////////////////////////////
-    // Report
+    // Report - set_name() may run while other threads report, so the name is
+    // only read or written with name_mtx held.
     ////////////////////////////////////////////////////////////////////////////
     char name[64];
+    std::mutex name_mtx;
+    void copy_name(char* buf);
 
     ////////////////////////////////////////////////////////////////////////////
     //
     ////////////////////////////////////////////////////////////////////////////
     static char log_file[256];
     static std::mutex log_mtx;
-    static int verbosity_limit;
+    static std::atomic<int> verbosity_limit;
 
 protected:
     ////////////////////////////////////////////////////////////////////////////
@@ -46,13 +51,28 @@ protected:
     void report(const char* text, int verbosity = 2, bool log = false);
 
     ////////////////////////////////////////////////////////////////////////////
-    //
+    // index_report() declares a text scan_report() will be asked for (see
+    // log_index::add_text()). Declare all of them before the first scan.
     ////////////////////////////////////////////////////////////////////////////
+    static void index_report(const char* text);
     time_point scan_report(char* text);
     time_point scan_report(const char* text);
 
+    ////////////////////////////////////////////////////////////////////////////
+    // Checkpoint - a few integers saved under this unit's name, which survive
+    // a restart. load_checkpoint() returns false if nothing was saved, or if
+    // it was saved with a different count.
+    ////////////////////////////////////////////////////////////////////////////
+    bool load_checkpoint(int64_t* values, int count);
+    void save_checkpoint(const int64_t* values, int count);
+
 public:
+    ////////////////////////////////////////////////////////////////////////////
+    // Units are deleted through base class pointers, e.g. a presence_icmp held
+    // as a presence*.
+    ////////////////////////////////////////////////////////////////////////////
     unit();
+    virtual ~unit() {}
 
     ////////////////////////////////////////////////////////////////////////////
     // Report
@@ -64,6 +84,13 @@ public:
     ////////////////////////////////////////////////////////////////////////////
     static void set_log_file(char* log_file);
 
+    ////////////////////////////////////////////////////////////////////////////
+    // Reports are written by a background thread. Blocks until every report
+    // made before the call has reached stdout and the log file. This also
+    // happens automatically at normal process exit.
+    ////////////////////////////////////////////////////////////////////////////
+    static void flush_log();
+
     ////////////////////////////////////////////////////////////////////////////
     // Utils
     ////////////////////////////////////////////////////////////////////////////
@@ -1,5 +1,9 @@
 
 #include "modules/presence_icmp.hpp"
+#include "modules/presence_sweep.hpp"
+#include "modules/presence_neigh.hpp"
+#include "modules/presence_dhcp.hpp"
+#include "modules/presence_shmem.hpp"
 #include <csignal>
 #include <cstring>
 #include <stdio.h>
@@ -16,27 +20,89 @@ void signalHandler(int signum) {
 ////////////////////////////////////////////////////////////////////////////////
 //
 ////////////////////////////////////////////////////////////////////////////////
-void interactive(char* name, char* addr, int port) {
+void interactive(char* name, char* addr, int port, std::vector<char*> ranges,
+        bool neigh, char* replay_file, char* record_file, char* lease_file,
+        char* table_file) {
     char cmd[64];
-    presence_icmp p_icmp = presence_icmp(name, addr);
-    p_icmp.enable();
+    // With ranges, the address is followed through a sweep of the ranges
+    // instead of being pinged on its own. With neigh, it is followed through
+    // the kernel neighbour table, with a lease file through the leases of a
+    // Kea DHCP server and with a table file through a shared presence table.
+    // None of these sends anything at all.
+    icmp_sweep sweep = icmp_sweep(name);
+    for (char* r : ranges)
+        if (!sweep.add_range(r)) printf("Bad range: %s\n", r);
+    neigh_table table = neigh_table(name, 300, replay_file[0] ? replay_file : nullptr);
+    if (record_file[0] && !table.record(record_file))
+        printf("Can not open: %s\n", record_file);
+    dhcp_leases leases = dhcp_leases(name, lease_file[0] ? lease_file : "/dev/null");
+    presence_table* table_shm = nullptr;
+    if (table_file[0]) table_shm = new presence_table(table_file);
+    presence* p;
+    if (table_shm) p = new presence_shmem(name, addr, table_shm);
+    else if (lease_file[0]) p = new presence_dhcp(name, &leases, addr);
+    else if (neigh) p = new presence_neigh(name, &table, addr);
+    else if (ranges.empty()) p = new presence_icmp(name, addr);
+    else p = new presence_sweep(name, &sweep, addr);
+    if (table_shm) table_shm->enable();
+    else if (lease_file[0]) leases.enable();
+    else if (neigh) table.enable();
+    else if (!ranges.empty()) sweep.enable();
+    p->enable();
     while (1 == scanf("%63s", cmd)) {
         if (!strcmp(cmd, "SYNC" )) {
             printf("Trigger sync\n");
-            p_icmp.sync_now();
+            if (table_shm) table_shm->sync_now();
+            else if (lease_file[0]) leases.sync_now();
+            else if (neigh) table.sync_now();
+            else if (ranges.empty()) p->sync_now();
+            else sweep.sync_now();
             printf("Done.\n");
         }
         if (!strcmp(cmd, "SYNCW" )) {
             printf("Sync and wait.\n");
-            p_icmp.sync_wait();
+            p->sync_wait();
             printf("Done.\n");
         }
         if (!strcmp(cmd, "QUERY" )) {
             printf("Query.\n");
-            printf("ICMP: %d\n", p_icmp.present());
+            printf("ICMP: %d\n", p->present());
+        }
+        if (!strcmp(cmd, "HOSTS" )) {
+            std::vector<std::string> hosts = sweep.present_hosts();
+            printf("%d of %d hosts up.\n", (int)hosts.size(), sweep.host_count());
+            for (std::string& h : hosts) printf("  %s\n", h.c_str());
+        }
+        if (!strcmp(cmd, "NEIGH" )) {
+            neigh_table::host h;
+            printf("%d hosts known.\n", table.host_count());
+            if (table.get_host(addr, &h))
+                printf("  %s %s state 0x%02x%s, last seen %lds ago\n", h.mac, h.ip,
+                    h.state, h.gone ? " (gone)" : "",
+                    h.last_seen.time_since_epoch().count() ?
+                    (long)std::chrono::duration_cast<std::chrono::seconds>(
+                    std::chrono::system_clock::now() - h.last_seen).count() : -1L);
+        }
+        if (!strcmp(cmd, "SEEN" ) && table_shm) {
+            printf("Seen now.\n");
+            table_shm->update(addr, std::chrono::time_point_cast<std::chrono::seconds>(
+                std::chrono::system_clock::now()));
+        }
+        if (!strcmp(cmd, "LEASE" )) {
+            dhcp_leases::lease l;
+            printf("%d leases known.\n", leases.lease_count());
+            if (leases.get_lease(addr, &l))
+                printf("  %s %s %s state %d, expires %lld\n", l.address, l.hwaddr,
+                    l.hostname, l.state, (long long)l.expire);
         }
     }
-    p_icmp.disable();
+    p->disable();
+    if (table_shm) table_shm->disable();
+    else if (lease_file[0]) leases.disable();
+    else if (neigh) table.disable();
+    else if (!ranges.empty()) sweep.disable();
+    delete p;
+    delete table_shm;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -45,6 +111,10 @@ void interactive(char* name, char* addr, int port) {
 int main(int argc, char *argv[]) {
     char addr[64], name[64], log_file[128];
     int port = 9999;
+    char replay_file[256] = "", record_file[256] = "", lease_file[256] = "";
+    char table_file[256] = "";
+    bool neigh = false;
+    std::vector<char*> ranges;
     strncpy(name, "TEST_PLUG", 64);
     strncpy(addr, "10.72.0.1", 64);
     strncpy(log_file, "presence.log", 128);
@@ -69,12 +139,40 @@ int main(int argc, char *argv[]) {
             strncpy(addr, argv[i+1], 64);
             i++;
         }
+        else if (!strcmp(argv[i], "-r") && (argc > i + 1)) {
+            ranges.push_back(argv[i+1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-N")) {
+            neigh = true;
+        }
+        else if (!strcmp(argv[i], "-R") && (argc > i + 1)) {
+            strncpy(replay_file, argv[i+1], 256);
+            neigh = true;
+            i++;
+        }
+        else if (!strcmp(argv[i], "-D") && (argc > i + 1)) {
+            strncpy(lease_file, argv[i+1], 256);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-T") && (argc > i + 1)) {
+            strncpy(table_file, argv[i+1], 256);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-W") && (argc > i + 1)) {
+            strncpy(record_file, argv[i+1], 256);
+            i++;
+        }
         else {
             printf("Commands are taken from stdin. Commands are:\n");
             printf("  SYNC  : Triggers all device states to be checked immediately.\n");
             printf("  SYNCW : Triggers all device states to be checked immediately.\n");
             printf("          Waits for the sync to complete before accepting another command.\n");
             printf("  QUERY : Prints the current state.\n");
+            printf("  HOSTS : Prints every host which replied to the last sweep (with -r).\n");
+            printf("  NEIGH : Prints the neighbour table entry of the device (with -N).\n");
+            printf("  LEASE : Prints the DHCP lease of the device (with -D).\n");
+            printf("  SEEN  : Marks the device as seen now in the presence table (with -T).\n");
             printf("\n");
             printf("Options are:\n");
             printf("\n");
@@ -95,6 +193,22 @@ int main(int argc, char *argv[]) {
             printf("\n");
             printf("  -p <port> : An open TCP port on the device.\n");
             printf("\n");
+            printf("  -r <cidr> : Sweep a range, e.g. 10.4.0.0/16, and follow the device\n");
+            printf("              through the sweep. May be given more than once.\n");
+            printf("\n");
+            printf("  -N : Follow the device through the kernel neighbour table (ARP/NDP).\n");
+            printf("       The address (-a) may be an IP or a MAC address.\n");
+            printf("\n");
+            printf("  -W <file> : Record every neighbour table message to a file (with -N).\n");
+            printf("\n");
+            printf("  -R <file> : Replay a recording instead of reading the kernel (implies -N).\n");
+            printf("\n");
+            printf("  -D <file> : Follow the device through a Kea DHCP lease file (memfile CSV).\n");
+            printf("              The address (-a) may be an IP, a MAC or a host name.\n");
+            printf("\n");
+            printf("  -T <file> : Follow the device through a shared presence table, which\n");
+            printf("              other processes update. Created if needed.\n");
+            printf("\n");
             return 1;
         }
     }
@@ -104,7 +218,8 @@ int main(int argc, char *argv[]) {
     signal(SIGTERM, signalHandler);
     signal(SIGINT , signalHandler);
 
-    std::thread thread = std::thread(interactive, name, addr, port);
+    std::thread thread = std::thread(interactive, name, addr, port, ranges,
+        neigh, replay_file, record_file, lease_file, table_file);
     thread.join();
 
     return 0;
@@ -1,6 +1,6 @@
 
-#include "modules/signal_handler.hpp"
 #include "modules/presence_icmp.hpp"
+#include "modules/signal_handler.hpp"
 #include "automations/kasa_alarm.hpp"
 #include "automations/kasa_timer.hpp"
 #include "automations/kasa_dimmer.hpp"
@@ -39,9 +39,6 @@ void iot() {
     // Modules actively monitor and control physical devices.
     // They provide a simple abstraction for automations to interact with.
 
-    signal_handler sigio_handler = signal_handler(SIGIO);
-
-
     while (!done) cv.wait(lck);
 
     // Automations
@@ -50,21 +47,26 @@ void iot() {
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// Terminate the "iot()" thread on interrupt.
+// Print a backtrace on a crash.
 ////////////////////////////////////////////////////////////////////////////////
 void signalHandler(int signum) {
-    if (signum == SIGSEGV) {
-        void *array[50];
-        size_t size;
+    void *array[50];
+    size_t size;
 
-        // get void*'s for all entries on the stack
-        size = backtrace(array, 50);
+    // get void*'s for all entries on the stack
+    size = backtrace(array, 50);
 
-        // print out all the frames to stderr
-        fprintf(stderr, "Error: signal %d:\n", signum);
-        backtrace_symbols_fd(array, size, STDOUT_FILENO);
-        exit(-1);
-    }
+    // print out all the frames to stderr
+    fprintf(stderr, "Error: signal %d:\n", signum);
+    backtrace_symbols_fd(array, size, STDOUT_FILENO);
+    exit(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Terminate the "iot()" thread on SIGTERM or SIGINT. Called from
+// signal_handler::sync(), not in signal context.
+////////////////////////////////////////////////////////////////////////////////
+void stop_iot() {
     std::unique_lock<std::mutex> lck(mtx);
     done = true;
     cv.notify_all();
@@ -103,9 +105,13 @@ int main(int argc, char *argv[]) {
 
     module::set_log_file(log_file);
 
+    // Before any thread is started, see signal_handler.
     signal(SIGSEGV, signalHandler);
-    signal(SIGTERM, signalHandler);
-    signal(SIGINT , signalHandler);
+    signal_handler::block({SIGTERM, SIGINT});
+    signal_handler sigterm_handler = signal_handler(SIGTERM, stop_iot);
+    signal_handler sigint_handler = signal_handler(SIGINT, stop_iot);
+    sigterm_handler.enable();
+    sigint_handler.enable();
 
     std::thread thread = std::thread(iot);
     thread.join();
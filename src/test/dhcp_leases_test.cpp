@@ -0,0 +1,177 @@
+#include "test.hpp"
+#include "../modules/presence_dhcp.hpp"
+#include <cstring>
+#include <string>
+
+////////////////////////////////////////////////////////////////////////////////
+// Writes a synthetic Kea DHCPv4 lease file and follows it with dhcp_leases
+// and a presence_dhcp: appends, a partial last line, a file replaced by the
+// lease file cleanup (LFC) with its columns in another order, and a lease
+// which expires.
+//
+// dhcp_leases::sync() reads the file, so after sync_wait() the leases are up
+// to date.
+////////////////////////////////////////////////////////////////////////////////
+static const char* HEADER =
+    "address,hwaddr,client_id,valid_lifetime,expire,subnet_id,fqdn_fwd,"
+    "fqdn_rev,hostname,state,user_context,pool_id\n";
+static const char* HEADER_LFC =
+    "hostname,state,expire,valid_lifetime,hwaddr,address,subnet_id\n";
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void append(const char* file, const std::string& text) {
+    FILE* f = fopen(file, "a");
+    fwrite(text.data(), text.size(), 1, f);
+    fclose(f);
+}
+
+std::string kea_line(const char* address, const char* hwaddr, int64_t valid,
+        int64_t expire, const char* hostname, int state) {
+    char line[256];
+    snprintf(line, 256, "%s,%s,01:%s,%lld,%lld,1,0,0,%s,%d,,0\n", address,
+        hwaddr, hwaddr, (long long)valid, (long long)expire, hostname, state);
+    return line;
+}
+
+std::string lfc_line(const char* address, const char* hwaddr, int64_t valid,
+        int64_t expire, const char* hostname, int state) {
+    char line[256];
+    snprintf(line, 256, "%s,%d,%lld,%lld,%s,%s,1\n", hostname, state,
+        (long long)expire, (long long)valid, hwaddr, address);
+    return line;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// 'address' is empty if 'key' should not match any lease.
+////////////////////////////////////////////////////////////////////////////////
+void check_lease(dhcp_leases* leases, const char* key, const char* address,
+        const char* hwaddr, const char* hostname, int64_t expire, int state,
+        const char* step) {
+    char what[256];
+    dhcp_leases::lease l;
+    bool known = leases->get_lease(key, &l);
+    if (!address[0]) {
+        snprintf(what, 256, "%s should be unknown", key);
+        check(!known, step, what);
+        return;
+    }
+    snprintf(what, 256, "%s should be known", key);
+    check(known, step, what);
+    if (!known) return;
+    snprintf(what, 256, "%s has address %s, expected %s", key, l.address, address);
+    check(!strcmp(l.address, address), step, what);
+    snprintf(what, 256, "%s has hwaddr %s, expected %s", key, l.hwaddr, hwaddr);
+    check(!strcmp(l.hwaddr, hwaddr), step, what);
+    snprintf(what, 256, "%s has hostname %s, expected %s", key, l.hostname, hostname);
+    check(!strcmp(l.hostname, hostname), step, what);
+    snprintf(what, 256, "%s expires at %lld, expected %lld", key,
+        (long long)l.expire, (long long)expire);
+    check(l.expire == expire, step, what);
+    snprintf(what, 256, "%s has state %d, expected %d", key, l.state, state);
+    check(l.state == state, step, what);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+int main() {
+    test_start("dhcp_leases_test");
+    char lease_file[256], lfc_file[256];
+    test_file(lease_file, 256, "csv");
+    test_file(lfc_file, 256, "csv.lfc");
+    unlink(lease_file);
+
+    int64_t now = unix_now();
+    start_absent("PRESENCE DHCP [ test @ 02:00:5e:00:00:0a ]");
+
+    append(lease_file, HEADER);
+    append(lease_file, kea_line("192.0.2.10", "02:00:5E:00:00:0A", 3600,
+        now + 3000, "Alpha.example.org.", 0));
+    std::string line_b = kea_line("192.0.2.11", "02:00:5e:00:00:0b", 3600,
+        now + 3000, "beta", 0);
+    // Kea is still writing the second lease.
+    append(lease_file, line_b.substr(0, 20));
+
+    dhcp_leases leases("test", lease_file);
+    presence_dhcp p("test", &leases, "02:00:5e:00:00:0a");
+    leases.enable();
+    p.enable();
+
+    const char* step = "partial last line";
+    leases.sync_wait();
+    p.sync_wait();
+    check_lease(&leases, "02:00:5e:00:00:0a", "192.0.2.10", "02:00:5e:00:00:0a",
+        "alpha.example.org", now + 3000, 0, step);
+    check_lease(&leases, "alpha.example.org.", "192.0.2.10", "02:00:5e:00:00:0a",
+        "alpha.example.org", now + 3000, 0, step);
+    check_lease(&leases, "192.0.2.11", "", "", "", 0, 0, step);
+    check(leases.lease_count() == 1, step, "lease count");
+    check(p.present(), step, "presence_dhcp should be present");
+
+    step = "append";
+    append(lease_file, line_b.substr(20));
+    append(lease_file, kea_line("192.0.2.12", "02:00:5e:00:00:0c", 3600,
+        now + 3000, "gamma", 0));
+    leases.sync_wait();
+    check_lease(&leases, "beta", "192.0.2.11", "02:00:5e:00:00:0b", "beta",
+        now + 3000, 0, step);
+    check_lease(&leases, "192.0.2.12", "192.0.2.12", "02:00:5e:00:00:0c", "gamma",
+        now + 3000, 0, step);
+    check(leases.lease_count() == 3, step, "lease count");
+
+    // The cleanup writes the leases as they are now into a new file, with
+    // the columns in another order, and moves it over the old one. 192.0.2.12
+    // was released in the meantime, and 192.0.2.13 is new.
+    step = "lfc replace";
+    unlink(lfc_file);
+    append(lfc_file, HEADER_LFC);
+    append(lfc_file, lfc_line("192.0.2.10", "02:00:5e:00:00:0a", 3600,
+        now + 3000, "alpha.example.org", 0));
+    append(lfc_file, lfc_line("192.0.2.11", "02:00:5e:00:00:0b", 3600,
+        now + 3000, "beta", 0));
+    append(lfc_file, lfc_line("192.0.2.12", "02:00:5e:00:00:0c", 3600,
+        now + 3000, "gamma", 2));
+    append(lfc_file, lfc_line("192.0.2.13", "02:00:5e:00:00:0d", 3600,
+        now + 3200, "delta", 0));
+    rename(lfc_file, lease_file);
+    leases.sync_wait();
+    check_lease(&leases, "alpha.example.org", "192.0.2.10", "02:00:5e:00:00:0a",
+        "alpha.example.org", now + 3000, 0, step);
+    check_lease(&leases, "beta", "192.0.2.11", "02:00:5e:00:00:0b", "beta",
+        now + 3000, 0, step);
+    check_lease(&leases, "gamma", "192.0.2.12", "02:00:5e:00:00:0c", "gamma",
+        now + 3000, 2, step);
+    check_lease(&leases, "02:00:5E:00:00:0D", "192.0.2.13", "02:00:5e:00:00:0d",
+        "delta", now + 3200, 0, step);
+    check(leases.lease_count() == 4, step, "lease count");
+
+    // Kea appends to the new file in the columns of its own header.
+    step = "append after lfc";
+    append(lease_file, lfc_line("192.0.2.11", "02:00:5e:00:00:0b", 3600,
+        now + 3400, "beta", 0));
+    leases.sync_wait();
+    check_lease(&leases, "beta", "192.0.2.11", "02:00:5e:00:00:0b", "beta",
+        now + 3400, 0, step);
+
+    // The lease of the followed device ran out two minutes ago, which is past
+    // the 60s time_limit of presence_dhcp. The change syncs it.
+    step = "expiry";
+    append(lease_file, lfc_line("192.0.2.10", "02:00:5e:00:00:0a", 3600,
+        now - 120, "alpha.example.org", 0));
+    leases.sync_wait();
+    p.sync_wait();
+    check_lease(&leases, "02:00:5e:00:00:0a", "192.0.2.10", "02:00:5e:00:00:0a",
+        "alpha.example.org", now - 120, 0, step);
+    check(!p.present(), step, "presence_dhcp should not be present");
+    check(p.get_last_time_present() ==
+        unit::time_point(unit::duration(now - 120)), step,
+        "presence_dhcp was last present when the lease expired");
+
+    p.disable();
+    leases.disable();
+
+    unlink(lease_file);
+    return test_finish();
+}
@@ -0,0 +1,183 @@
+#include "test.hpp"
+#include "../modules/presence_neigh.hpp"
+#include <linux/neighbour.h>
+#include <cstring>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+// Replays a recorded netlink trace through neigh_table and presence_neigh.
+//
+// fixtures/neigh.rec was recorded with presence_standalone -N -W on a host
+// with two stale entries of its own, while these were run:
+//
+//   ip neigh add 198.51.100.10 lladdr 02:00:5e:00:00:0a dev eth0 nud reachable
+//   ip neigh add 198.51.100.11 lladdr 02:00:5e:00:00:0b dev eth0 nud permanent
+//   ip neigh replace 198.51.100.10 lladdr 02:00:5e:00:00:0a dev eth0 nud stale
+//   ip neigh del 198.51.100.10 dev eth0
+//   ip neigh add 198.51.100.12 lladdr 02:00:5e:00:00:0a dev eth0 nud reachable
+//   ip neigh del 198.51.100.11 dev eth0
+//   ip neigh del 198.51.100.12 dev eth0
+//
+// Datagram 0 is the dump, every other one a single event. The first n
+// datagrams are replayed into a new table for each step, so every step sees
+// the state after exactly that many events. The dump is replayed once more
+// after two of the events, as if their deletions had been lost.
+////////////////////////////////////////////////////////////////////////////////
+static const char* MAC_A = "02:00:5e:00:00:0a";
+static const char* MAC_B = "02:00:5e:00:00:0b";
+
+////////////////////////////////////////////////////////////////////////////////
+// What the table should hold for a host after a step. 'ip' is empty if the
+// host should be unknown.
+////////////////////////////////////////////////////////////////////////////////
+struct expect {
+    const char* ip;
+    bool gone;
+    int state;
+};
+
+struct step {
+    expect a, b;
+    bool a_present;
+};
+
+static const step STEPS[] = {
+    {{"", false, 0}, {"", false, 0}, false},
+    {{"198.51.100.10", false, NUD_REACHABLE}, {"", false, 0}, true},
+    {{"198.51.100.10", false, NUD_REACHABLE}, {"198.51.100.11", false, NUD_PERMANENT}, true},
+    {{"198.51.100.10", false, NUD_STALE}, {"198.51.100.11", false, NUD_PERMANENT}, true},
+    {{"198.51.100.10", true, NUD_FAILED}, {"198.51.100.11", false, NUD_PERMANENT}, false},
+    {{"198.51.100.10", true, NUD_FAILED}, {"198.51.100.11", false, NUD_PERMANENT}, false},
+    {{"198.51.100.12", false, NUD_REACHABLE}, {"198.51.100.11", false, NUD_PERMANENT}, true},
+    {{"198.51.100.12", false, NUD_REACHABLE}, {"198.51.100.11", true, NUD_FAILED}, true},
+    {{"198.51.100.12", false, NUD_REACHABLE}, {"198.51.100.11", true, NUD_FAILED}, true},
+    {{"198.51.100.12", true, NUD_FAILED}, {"198.51.100.11", true, NUD_FAILED}, false},
+    {{"198.51.100.12", true, NUD_FAILED}, {"198.51.100.11", true, NUD_FAILED}, false},
+};
+static const int STEP_COUNT = sizeof(STEPS) / sizeof(STEPS[0]);
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+void check_host(neigh_table* table, const char* mac, const expect& e,
+        const char* step) {
+    char what[256];
+    neigh_table::host h;
+    bool known = table->get_host(mac, &h);
+    if (!e.ip[0]) {
+        snprintf(what, 256, "%s should be unknown", mac);
+        check(!known, step, what);
+        return;
+    }
+    snprintf(what, 256, "%s should be known", mac);
+    check(known, step, what);
+    if (!known) return;
+    snprintf(what, 256, "%s has ip %s, expected %s", mac, h.ip, e.ip);
+    check(!strcmp(h.ip, e.ip), step, what);
+    snprintf(what, 256, "%s gone is %d, expected %d", mac, h.gone, e.gone);
+    check(h.gone == e.gone, step, what);
+    snprintf(what, 256, "%s state 0x%02x, expected 0x%02x", mac, h.state, e.state);
+    check(h.state == e.state, step, what);
+
+    // The address finds the same host, as long as it is the current one.
+    neigh_table::host by_ip;
+    snprintf(what, 256, "lookup by %s should find %s", e.ip, mac);
+    check(table->get_host(e.ip, &by_ip) && !strcmp(by_ip.mac, mac), step, what);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Splits the recording into datagrams, in the recording layout (a uint32
+// length, then the datagram).
+////////////////////////////////////////////////////////////////////////////////
+bool load(const char* file, std::vector<std::vector<char>>* datagrams) {
+    FILE* f = fopen(file, "r");
+    if (!f) return false;
+    uint32_t len;
+    while (fread(&len, sizeof(len), 1, f) == 1) {
+        std::vector<char> d(len);
+        if (fread(d.data(), len, 1, f) != 1) break;
+        datagrams->push_back(d);
+    }
+    fclose(f);
+    return true;
+}
+
+void write(const char* file, const std::vector<std::vector<char>>& datagrams,
+        const std::vector<int>& order) {
+    FILE* f = fopen(file, "w");
+    for (int i : order) {
+        uint32_t len = datagrams[i].size();
+        fwrite(&len, sizeof(len), 1, f);
+        fwrite(datagrams[i].data(), len, 1, f);
+    }
+    fclose(f);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char *argv[]) {
+    const char* fixture = argc > 1 ? argv[1] : "src/test/fixtures/neigh.rec";
+    test_start("neigh_replay_test");
+    char replay_file[256];
+    test_file(replay_file, 256, "rec");
+
+    std::vector<std::vector<char>> datagrams;
+    if (!load(fixture, &datagrams) || datagrams.size() != STEP_COUNT) {
+        printf("FAIL: %s should hold %d datagrams\n", fixture, STEP_COUNT);
+        return 1;
+    }
+
+    for (int n = 1; n <= STEP_COUNT; n++) {
+        // A new name each step, so that nothing is restored from the steps
+        // before (see checkpoint).
+        char name[64], p_name[64], step[64];
+        snprintf(name, 64, "test_%d", n);
+        snprintf(p_name, 64, "PRESENCE NEIGH [ %s @ %s ]", name, MAC_A);
+        snprintf(step, 64, "after %d datagrams", n);
+        std::vector<int> prefix;
+        for (int i = 0; i < n; i++) prefix.push_back(i);
+        write(replay_file, datagrams, prefix);
+        start_absent(p_name);
+        neigh_table table(name, 300, replay_file);
+        presence_neigh p(name, &table, MAC_A);
+        table.enable();
+        p.enable();
+
+        const struct step& s = STEPS[n - 1];
+        check_host(&table, MAC_A, s.a, step);
+        check_host(&table, MAC_B, s.b, step);
+        // Multicast entries are not hosts, and the failed one has no MAC.
+        check(table.host_count() == 1 + !!s.a.ip[0] + !!s.b.ip[0], step,
+            "host count");
+        check(p.present() == s.a_present, step,
+            s.a_present ? "presence_neigh should be present" :
+            "presence_neigh should not be present");
+
+        p.disable();
+        table.disable();
+    }
+
+    // The deletions of .10 and .11 were lost (an overrun), and the next dump
+    // no longer has them. Replaying the dump after their events marks both
+    // gone once its NLMSG_DONE arrives.
+    const char* step = "dump after lost deletions";
+    start_absent("PRESENCE NEIGH [ lost @ 02:00:5e:00:00:0a ]");
+    write(replay_file, datagrams, {1, 2, 0});
+    neigh_table table("lost", 300, replay_file);
+    presence_neigh p("lost", &table, MAC_A);
+    table.enable();
+    p.enable();
+    check_host(&table, MAC_A, {"198.51.100.10", true, NUD_REACHABLE}, step);
+    check_host(&table, MAC_B, {"198.51.100.11", true, NUD_PERMANENT}, step);
+    check(table.host_count() == 3, step, "host count");
+    neigh_table::host h;
+    check(table.get_host("02:fc:00:00:00:05", &h) && !h.gone, step,
+        "the host in the dump should not be gone");
+    check(!p.present(), step, "presence_neigh should not be present");
+    p.disable();
+    table.disable();
+
+    unlink(replay_file);
+    return test_finish();
+}
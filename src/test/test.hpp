@@ -0,0 +1,76 @@
+#ifndef _TEST_H_
+#define _TEST_H_
+
+#include "../modules/unit.hpp"
+#include "../modules/checkpoint.hpp"
+#include <stdio.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// What the tests share. Each test logs to a file of its own under /tmp,
+// counts failed checks and removes its files when it is done:
+//
+//   test_start("neigh_replay_test");
+//   ...
+//   check(table.host_count() == 3, "after 2 datagrams", "host count");
+//   ...
+//   return test_finish();
+////////////////////////////////////////////////////////////////////////////////
+inline char test_name[64];
+inline int failures = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+// '/tmp/<test>.<pid>.<suffix>', for the log and any file the test writes.
+////////////////////////////////////////////////////////////////////////////////
+inline void test_file(char* buf, int size, const char* suffix) {
+    snprintf(buf, size, "/tmp/%s.%d.%s", test_name, (int)getpid(), suffix);
+}
+
+inline void test_start(const char* name) {
+    snprintf(test_name, 64, "%s", name);
+    static char log_file[256];
+    test_file(log_file, 256, "log");
+    unit::set_verbosity(0);
+    unit::set_log_file(log_file);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Removes the log with its index and checkpoint, and returns the exit code.
+////////////////////////////////////////////////////////////////////////////////
+inline int test_finish() {
+    const char* suffixes[] = {"log", "log.idx", "log.state"};
+    for (const char* suffix : suffixes) {
+        char file[256];
+        test_file(file, 256, suffix);
+        unlink(file);
+    }
+    printf("%s: %s\n", test_name, failures ? "FAIL" : "PASS");
+    return failures ? 1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////////////////////
+inline void check(bool ok, const char* step, const char* what) {
+    if (ok) return;
+    printf("FAIL: %s: %s\n", step, what);
+    failures++;
+}
+
+inline int64_t unix_now() {
+    return std::chrono::duration_cast<unit::duration>(
+        unit::sc::now().time_since_epoch()).count();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// A presence without a checkpoint or a report in the log counts as present
+// until 'time_limit' ran out. Call this with the full module name before the
+// presence is constructed, and it starts from a checkpoint which last saw
+// the device an hour ago: only what the test feeds it makes it present.
+////////////////////////////////////////////////////////////////////////////////
+inline void start_absent(const char* presence_name) {
+    int64_t times[2] = {unix_now() - 3600, unix_now() - 3600};
+    checkpoint::get().store(presence_name, times, 2);
+}
+
+#endif